@@ -0,0 +1,158 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "aot.h"
+#include "interp.h"
+#include "movie.h"
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+#define MAX_PATH_LENGTH 4096
+
+struct aot_state {
+    void* handle;
+    const aot_entry* entries;
+    uint32_t count;
+    aot_block_fn block_at[RAM_SIZE];
+    uint8_t covered[RAM_SIZE];      // set when some block was compiled from this byte
+};
+
+static const aot_helpers HELPERS = {
+        execute,
+        draw,
+        wide_draw,
+        draw_wrap,
+        wide_draw_wrap,
+        clear_screen,
+        scroll_left,
+        scroll_right,
+        scroll_down,
+        detect_spin,
+        mem_written,
+        stack_fault
+};
+
+
+static void* open_module(const char* path){
+#ifdef WIN32
+    return (void*)LoadLibraryA(path);
+#else
+    // a bare file name would be looked up on the library search path instead
+    char local[MAX_PATH_LENGTH];
+    if(!strchr(path, '/') && strlen(path) + 3 <= sizeof(local)){
+        strcpy(local, "./");
+        strcat(local, path);
+        path = local;
+    }
+    return dlopen(path, RTLD_NOW | RTLD_LOCAL);
+#endif
+}
+
+static void* module_symbol(void* handle, const char* name){
+#ifdef WIN32
+    return (void*)GetProcAddress((HMODULE)handle, name);
+#else
+    return dlsym(handle, name);
+#endif
+}
+
+static void close_module(void* handle){
+#ifdef WIN32
+    FreeLibrary((HMODULE)handle);
+#else
+    dlclose(handle);
+#endif
+}
+
+aot_state* aot_load(const char* path, const chip8* chip8_ctx, const char** error){
+    void* handle = open_module(path);
+    if(!handle){
+        *error = "cannot open module";
+        return NULL;
+    }
+
+    const aot_entry* entries = module_symbol(handle, AOT_BLOCKS);
+    const uint32_t* count = module_symbol(handle, AOT_NUM_BLOCKS);
+    const uint32_t* layout = module_symbol(handle, AOT_LAYOUT);
+    const uint64_t* rom_hash = module_symbol(handle, AOT_ROM_HASH);
+    const uint32_t* profile = module_symbol(handle, AOT_PROFILE);
+    void (*bind)(const aot_helpers*) = (void (*)(const aot_helpers*))module_symbol(handle, AOT_BIND);
+    if(!entries || !count || !layout || !rom_hash || !profile || !bind){
+        *error = "not a chip8-aot module";
+    }else if(*layout != sizeof(chip8)){
+        *error = "module built against a different emulator, recompile it";
+    }else if(*rom_hash != program_hash(chip8_ctx)){
+        *error = "module compiled from a different ROM";
+    }else if(*profile != chip8_ctx->profile){
+        *error = "module compiled for a different quirk profile";
+    }else{
+        aot_state* aot = calloc(1, sizeof(aot_state));
+        if(!aot){
+            *error = "out of memory";
+            close_module(handle);
+            return NULL;
+        }
+        bind(&HELPERS);
+        aot->handle = handle;
+        aot->entries = entries;
+        aot->count = *count;
+        for(uint32_t i = 0; i < aot->count; i++){
+            aot->block_at[entries[i].start] = entries[i].code;
+            memset(aot->covered + entries[i].start, 1, entries[i].end - entries[i].start);
+        }
+        return aot;
+    }
+    close_module(handle);
+    return NULL;
+}
+
+void aot_free(aot_state* aot){
+    if(!aot){
+        return;
+    }
+    close_module(aot->handle);
+    free(aot);
+}
+
+void aot_invalidate(aot_state* aot, uint16_t addr, uint32_t size){
+    uint8_t hit = 0;
+    for(uint32_t i = 0; i < size; i++){
+        hit |= aot->covered[(addr + i) & ADDR_MASK];
+    }
+    if(!hit){
+        return;
+    }
+    // the blocks can not be recompiled, whatever was stored over runs on the interpreter from now on
+    for(uint32_t i = 0; i < aot->count; i++){
+        const aot_entry* entry = &aot->entries[i];
+        if(addr < entry->end && addr + size > entry->start){
+            aot->block_at[entry->start] = NULL;
+        }
+    }
+}
+
+uint32_t run_aot(chip8* chip8_ctx, uint32_t n){
+    aot_state* aot = chip8_ctx->aot;
+    uint32_t executed = 0;
+
+    if(!aot){
+        return run_interpreter(chip8_ctx, n);
+    }
+
+    while(executed < n){
+        aot_block_fn block = aot->block_at[chip8_ctx->pc];
+        if(block){
+            executed += block(chip8_ctx, n - executed);
+        }else{
+            executed += run_interpreter(chip8_ctx, 1);
+        }
+        if(chip8_ctx->spin_length || chip8_ctx->fault){
+            break;
+        }
+    }
+    return executed;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "chip8.h"
+
+/*
+* Ahead-of-time compiled ROMs. chip8-aot walks a ROM's control flow from
+* PROGRAM_START and turns every reachable basic block into a C function with
+* the same contract as a JIT block: run at most budget instructions starting
+* at the block's address, leave pc after the last one and return how many
+* ran. The functions are built into a shared object next to the ROM that
+* --engine=aot loads at startup.
+*
+* Anywhere the walk did not reach (BNNN targets, code built at run time) and
+* any block a store has overwritten since is run by the interpreter instead.
+* The module calls the emulator's own instruction helpers through a table
+* handed over at load time, so it needs no symbols from the executable.
+*/
+
+#ifdef WIN32
+#define AOT_SUFFIX ".dll"
+#define AOT_EXPORT __declspec(dllexport)
+#else
+#define AOT_SUFFIX ".so"
+#define AOT_EXPORT __attribute__((visibility("default")))
+#endif
+
+typedef uint32_t (*aot_block_fn)(chip8* chip8_ctx, uint32_t budget);
+
+typedef struct {
+    uint16_t start;                 // guest byte range [start, end) the block was compiled from
+    uint16_t end;
+    aot_block_fn code;
+} aot_entry;
+
+// handed to the module by aot_load(), see chip8.h for what each one does
+typedef struct {
+    void (*execute)(chip8* chip8_ctx);
+    void (*draw)(chip8* chip8_ctx, uint8_t x, uint8_t y, uint8_t n);
+    void (*wide_draw)(chip8* chip8_ctx, uint8_t x, uint8_t y);
+    void (*draw_wrap)(chip8* chip8_ctx, uint8_t x, uint8_t y, uint8_t n);
+    void (*wide_draw_wrap)(chip8* chip8_ctx, uint8_t x, uint8_t y);
+    void (*clear_screen)(chip8* chip8_ctx);
+    void (*scroll_left)(chip8* chip8_ctx);
+    void (*scroll_right)(chip8* chip8_ctx);
+    void (*scroll_down)(chip8* chip8_ctx, int n);
+    void (*detect_spin)(chip8* chip8_ctx, uint16_t pc, uint16_t target);
+    void (*mem_written)(chip8* chip8_ctx, uint16_t addr, uint32_t size);
+    void (*stack_fault)(chip8* chip8_ctx, uint16_t opcode);
+} aot_helpers;
+
+// symbols every module exports
+#define AOT_BLOCKS "chip8_aot_blocks"           // const aot_entry[]
+#define AOT_NUM_BLOCKS "chip8_aot_num_blocks"   // const uint32_t
+#define AOT_LAYOUT "chip8_aot_layout"           // const uint32_t, sizeof(chip8) the module was built against
+#define AOT_ROM_HASH "chip8_aot_rom_hash"       // const uint64_t, program_hash() of the ROM
+#define AOT_PROFILE "chip8_aot_profile"         // const uint32_t, QUIRK_PROFILE the blocks were compiled for
+#define AOT_BIND "chip8_aot_bind"               // void (const aot_helpers*)
+
+/*
+* Load the module compiled for the program in chip8_ctx, returns NULL with
+* the reason in *error if it cannot be opened or was built for another ROM,
+* quirk profile or build of the emulator.
+*/
+aot_state* aot_load(const char* path, const chip8* chip8_ctx, const char** error);
+
+void aot_free(aot_state* aot);
+
+// drop the blocks compiled from a range the guest stored over
+void aot_invalidate(aot_state* aot, uint16_t addr, uint32_t size);
+
+// run n instructions on the loaded module, the interpreter fills in where it has no block
+uint32_t run_aot(chip8* chip8_ctx, uint32_t n);
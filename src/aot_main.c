@@ -0,0 +1,612 @@
+#include <stdlib.h>
+#include <string.h>
+#ifdef WIN32
+#include <process.h>
+#else
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "aot.h"
+#include "chip8.h"
+#include "movie.h"
+#include "trace.h"
+#include "utils.h"
+
+/*
+* Static recompiler, turns a ROM into a shared object for --engine=aot.
+*
+* The walk follows control flow from PROGRAM_START: jump and call targets,
+* the instruction after a call (where 00EE comes back to), both sides of
+* every skip and the restart after 00FD each start a block. A block runs
+* until a jump, call, return, skip, BNNN, FX0A or store, or until the next
+* block start, and is written out as one C function doing what execute()
+* does for each instruction. BNNN targets depend on V0 and are left to the
+* interpreter at run time, as is anything outside the ROM. The quirks of
+* the profile the ROM is compiled for are baked into the C, the module only
+* loads into a context running that same profile.
+*/
+
+#ifndef CHIP8_AOT_CC
+#define CHIP8_AOT_CC "cc"
+#endif
+
+#ifndef CHIP8_AOT_INCLUDE
+#define CHIP8_AOT_INCLUDE "src"
+#endif
+
+#define MAX_BLOCK_OPS 64
+#define MAX_PATH_LENGTH 4096
+
+typedef enum {
+    KIND_INVALID,                   // unknown opcode, the interpreter reports it
+    KIND_STRAIGHT,
+    KIND_JUMP,
+    KIND_CALL,
+    KIND_RETURN,
+    KIND_INDIRECT,                  // BNNN
+    KIND_SKIP,
+    KIND_WAIT,                      // FX0A
+    KIND_STORE,                     // FX33, FX55
+    KIND_RESET                      // 00FD
+} op_kind;
+
+static chip8 ctx;
+static uint8_t quirks;                  // of the profile being compiled for
+static uint32_t rom_end;
+static uint8_t leader[RAM_SIZE];
+static uint8_t reached[RAM_SIZE];
+static uint16_t work[RAM_SIZE];
+static uint32_t work_count;
+
+
+static void usage(const char* name){
+    printf("usage: %s [--cc COMPILER] [--c-only] [--quirks default|chip8|schip|xochip] [--quirk-db FILE] <rom> [module] \n"
+           "the module defaults to <rom>%s, the generated C is kept next to it \n", name, AOT_SUFFIX);
+}
+
+static op_kind classify(uint16_t opcode){
+    uint8_t y = (opcode & 0x00f0) >> 4;
+    uint8_t n = opcode & 0xf;
+    uint8_t kk = opcode & 0xff;
+
+    switch (opcode >> 12) {
+        case 0:
+            if(y == 0x0 || y == 0xC) return KIND_STRAIGHT;
+            if(y == 0xE && n == 0x0) return KIND_STRAIGHT;
+            if(y == 0xE && n == 0xE) return KIND_RETURN;
+            if(y == 0xF && (n == 0xB || n == 0xC || n == 0xE || n == 0xF)) return KIND_STRAIGHT;
+            if(y == 0xF && n == 0xD) return KIND_RESET;
+            return KIND_INVALID;
+        case 1:
+            return KIND_JUMP;
+        case 2:
+            return KIND_CALL;
+        case 3:
+        case 4:
+        case 5:
+        case 9:
+            return KIND_SKIP;
+        case 6:
+        case 7:
+        case 0xA:
+        case 0xC:
+        case 0xD:
+            return KIND_STRAIGHT;
+        case 8:
+            return (n <= 7 || n == 0xE) ? KIND_STRAIGHT : KIND_INVALID;
+        case 0xB:
+            return KIND_INDIRECT;
+        case 0xE:
+            return (kk == 0x9E || kk == 0xA1) ? KIND_SKIP : KIND_INVALID;
+        case 0xF:
+            switch (kk) {
+                case 0x00:
+                    return opcode == 0xF000 ? KIND_STRAIGHT : KIND_INVALID;
+                case 0x02:
+                    return opcode == 0xF002 ? KIND_STRAIGHT : KIND_INVALID;
+                case 0x01:
+                case 0x07:
+                case 0x15:
+                case 0x18:
+                case 0x1E:
+                case 0x29:
+                case 0x30:
+                case 0x3A:
+                case 0x65:
+                case 0x75:
+                case 0x85:
+                    return KIND_STRAIGHT;
+                case 0x0A:
+                    return KIND_WAIT;
+                case 0x33:
+                case 0x55:
+                    return KIND_STORE;
+                default:
+                    return KIND_INVALID;
+            }
+        default:
+            return KIND_INVALID;
+    }
+}
+
+// instructions that go through execute() count themselves
+static int counts_itself(uint16_t opcode){
+    op_kind kind = classify(opcode);
+    return kind == KIND_WAIT || kind == KIND_RESET || opcode == 0xF002;
+}
+
+// stop short of the top of memory so pc and the block end never wrap
+static int in_rom(uint32_t addr){
+    return addr >= PROGRAM_START && addr < rom_end && addr + 2 * LONG_OP_SIZE <= RAM_SIZE;
+}
+
+static uint16_t opcode_at(uint16_t pc){
+    return ctx.mem[pc] << 8 | ctx.mem[pc + 1];
+}
+
+static void add_leader(uint32_t addr){
+    if(in_rom(addr) && !leader[addr]){
+        leader[addr] = 1;
+        work[work_count++] = (uint16_t)addr;
+    }
+}
+
+static void walk(void){
+    add_leader(PROGRAM_START);
+    while(work_count){
+        uint16_t pc = work[--work_count];
+        int more = 1;
+        while(more && in_rom(pc) && !reached[pc]){
+            uint16_t opcode = opcode_at(pc);
+            uint16_t next = pc + op_size(&ctx, pc);
+            reached[pc] = 1;
+            more = 0;
+            switch (classify(opcode)) {
+                case KIND_STRAIGHT:
+                    pc = next;
+                    more = 1;
+                    break;
+                case KIND_JUMP:
+                    add_leader(opcode & 0xfff);
+                    break;
+                case KIND_CALL:
+                    add_leader(opcode & 0xfff);
+                    add_leader(next);
+                    break;
+                case KIND_SKIP:
+                    add_leader(next);
+                    add_leader(next + op_size(&ctx, next));
+                    break;
+                case KIND_WAIT:
+                    // retried until a key is down
+                    add_leader(pc);
+                    add_leader(next);
+                    break;
+                case KIND_STORE:
+                    add_leader(next);
+                    break;
+                case KIND_RESET:
+                    add_leader(PROGRAM_START);
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+}
+
+// C for the instruction at pc, k instructions into the block, count adds it to the statistics
+static void emit_op(FILE* out, uint16_t pc, uint16_t k, int count){
+    uint16_t opcode = opcode_at(pc);
+    uint8_t op = opcode >> 12;
+    uint8_t x = (opcode & 0x0f00) >> 8;
+    uint8_t y = (opcode & 0x00f0) >> 4;
+    uint8_t n = opcode & 0xf;
+    uint8_t kk = opcode & 0xff;
+    uint16_t addr = opcode & 0xfff;
+    uint16_t next = pc + OP_SIZE;
+
+    op_kind kind = classify(opcode);
+    char text[32];
+    const char* shifted = (quirks & QUIRK_SHIFT_VY) ? "y" : "x";
+    const char* wrap = (quirks & QUIRK_WRAP) ? "_wrap" : "";
+
+    disassemble(opcode, text, sizeof(text));
+    fprintf(out, "    /* %04X: %04X %s */\n", pc, opcode, text);
+
+    if(count && !counts_itself(opcode)){
+        fprintf(out, "    STAT_ADD(c, op_class[%u], 1);\n", op);
+    }
+
+    switch (kind) {
+        case KIND_JUMP:
+            if(addr == pc){
+                fprintf(out, "    c->spin_length = 1;\n");
+            }else if(addr + 2 * OP_SIZE == pc){
+                fprintf(out, "    h->detect_spin(c, 0x%04X, 0x%04X);\n", pc, addr);
+            }
+            fprintf(out, "    c->pc = 0x%04X;\n    return %u;\n", addr, k + 1);
+            return;
+        case KIND_CALL:
+            // a faulting call or return is left undone and not counted
+            fprintf(out, "    if(c->sp >= STACK_SIZE){\n        c->pc = 0x%04X;\n        h->stack_fault(c, 0x%04X);\n        return %u;\n    }\n",
+                    pc, opcode, k);
+            fprintf(out, "    c->stack[c->sp++] = 0x%04X;\n    c->pc = 0x%04X;\n    return %u;\n", pc, addr, k + 1);
+            return;
+        case KIND_RETURN:
+            fprintf(out, "    if(c->sp == 0){\n        c->pc = 0x%04X;\n        h->stack_fault(c, 0x%04X);\n        return %u;\n    }\n",
+                    pc, opcode, k);
+            fprintf(out, "    c->pc = c->stack[--c->sp] + %u;\n    return %u;\n", OP_SIZE, k + 1);
+            return;
+        case KIND_INDIRECT:
+            fprintf(out, "    c->pc = 0x%04X + v[%u];\n    return %u;\n", addr, (quirks & QUIRK_JUMP_VX) ? x : 0, k + 1);
+            return;
+        case KIND_SKIP: {
+            const char* taken;
+            char condition[64];
+            switch (op) {
+                case 3: taken = "=="; break;
+                case 4: taken = "!="; break;
+                case 5: taken = "=="; break;
+                case 9: taken = "!="; break;
+                default: taken = kk == 0x9E ? "" : "!"; break;
+            }
+            if(op == 3 || op == 4){
+                snprintf(condition, sizeof(condition), "v[%u] %s 0x%02X", x, taken, kk);
+            }else if(op == 5 || op == 9){
+                snprintf(condition, sizeof(condition), "v[%u] %s v[%u]", x, taken, y);
+            }else{
+                snprintf(condition, sizeof(condition), "%sc->keyboard[v[%u] & 0xf]", taken, x);
+            }
+            // the size of the skipped instruction is baked in, the block covers its opcode
+            fprintf(out, "    c->pc = %s ? 0x%04X : 0x%04X;\n    return %u;\n",
+                    condition, next + op_size(&ctx, next), next, k + 1);
+            return;
+        }
+        case KIND_WAIT:
+        case KIND_RESET:
+            fprintf(out, "    c->pc = 0x%04X;\n    h->execute(c);\n    return %u;\n", pc, k + 1);
+            return;
+        case KIND_STORE:
+            if(kk == 0x33){
+                fprintf(out, "    store_bcd(c, v[%u]);\n    h->mem_written(c, c->I, 3);\n", x);
+            }else{
+                fprintf(out, "    store_registers(c, v, %u);\n    h->mem_written(c, c->I, %u);\n", x + 1, x + 1);
+                if(quirks & QUIRK_MEMORY_I){
+                    fprintf(out, "    c->I += %u;\n", x + 1);
+                }
+            }
+            // the store may have gone over the rest of this block
+            fprintf(out, "    c->pc = 0x%04X;\n    return %u;\n", next, k + 1);
+            return;
+        default:
+            break;
+    }
+
+    switch (op) {
+        case 0:
+            if(y == 0xC){
+                fprintf(out, "    h->scroll_down(c, %u);\n", n);
+            }else if(y == 0xE){
+                fprintf(out, "    h->clear_screen(c);\n");
+            }else if(y == 0xF && n == 0xB){
+                fprintf(out, "    h->scroll_right(c);\n");
+            }else if(y == 0xF && n == 0xC){
+                fprintf(out, "    h->scroll_left(c);\n");
+            }else if(y == 0xF){
+                fprintf(out, "    h->clear_screen(c);\n    c->screen_mode = %s;\n", n == 0xE ? "LOW_RES64" : "HIGH_RES128");
+            }
+            break;
+        case 6:
+            fprintf(out, "    v[%u] = 0x%02X;\n", x, kk);
+            break;
+        case 7:
+            fprintf(out, "    v[%u] += 0x%02X;\n", x, kk);
+            break;
+        case 8:
+            fprintf(out, "    { uint8_t x = v[%u], y = v[%u];\n", x, y);
+            switch (n) {
+                case 0: fprintf(out, "      v[%u] = y; }\n", x); break;
+                case 1: fprintf(out, "      v[%u] = x | y; }\n", x); break;
+                case 2: fprintf(out, "      v[%u] = x & y; }\n", x); break;
+                case 3: fprintf(out, "      v[%u] = x ^ y; }\n", x); break;
+                case 4: fprintf(out, "      v[15] = x + y > 0xFF;\n      v[%u] = x + y; }\n", x); break;
+                case 5: fprintf(out, "      v[15] = x >= y;\n      v[%u] = x - y; }\n", x); break;
+                case 6: fprintf(out, "      v[15] = %s & 1;\n      v[%u] = %s >> 1; }\n", shifted, x, shifted); break;
+                case 7: fprintf(out, "      v[15] = y >= x;\n      v[%u] = y - x; }\n", x); break;
+                default: fprintf(out, "      v[15] = %s >> 7;\n      v[%u] = %s << 1; }\n", shifted, x, shifted); break;
+            }
+            break;
+        case 0xA:
+            fprintf(out, "    c->I = 0x%03X;\n", addr);
+            break;
+        case 0xC:
+            fprintf(out, "    v[%u] = random_byte(c) & 0x%02X;\n", x, kk);
+            break;
+        case 0xD:
+            if(n == 0){
+                fprintf(out, "    if(c->screen_mode == HIGH_RES128) h->wide_draw%s(c, %u, %u); else h->draw%s(c, %u, %u, 0);\n",
+                        wrap, x, y, wrap, x, y);
+            }else{
+                fprintf(out, "    h->draw%s(c, %u, %u, %u);\n", wrap, x, y, n);
+            }
+            break;
+        case 0xF:
+            switch (kk) {
+                case 0x00:
+                    // NNNN sits inside the block, a store to it drops the block
+                    fprintf(out, "    c->I = 0x%04X;\n", ctx.mem[pc + 2] << 8 | ctx.mem[pc + 3]);
+                    break;
+                case 0x01:
+                    fprintf(out, "    c->planes = %u;\n", x & ((1 << NUM_PLANES) - 1));
+                    break;
+                case 0x02:
+                    fprintf(out, "    c->pc = 0x%04X;\n    h->execute(c);\n", pc);
+                    break;
+                case 0x07:
+                    fprintf(out, "    v[%u] = c->delay_timer;\n", x);
+                    break;
+                case 0x15:
+                    fprintf(out, "    c->delay_timer = v[%u];\n", x);
+                    break;
+                case 0x18:
+                    fprintf(out, "    c->sound_timer = v[%u];\n", x);
+                    break;
+                case 0x1E:
+                    if(quirks & QUIRK_ADD_I_VF){
+                        fprintf(out, "    { uint8_t x = v[%u];\n      v[15] = !((0xFFFF - c->I) < x);\n      c->I += x; }\n", x);
+                    }else{
+                        fprintf(out, "    c->I += v[%u];\n", x);
+                    }
+                    break;
+                case 0x29:
+                    fprintf(out, "    c->I = v[%u] * 5;\n", x);
+                    break;
+                case 0x30:
+                    fprintf(out, "    c->I = %u + v[%u] * 10;\n", FONT_SET_SIZE, x);
+                    break;
+                case 0x3A:
+                    fprintf(out, "    c->pitch = v[%u];\n", x);
+                    break;
+                case 0x65:
+                    fprintf(out, "    load_registers(c, v, %u);\n", x + 1);
+                    if(quirks & QUIRK_MEMORY_I){
+                        fprintf(out, "    c->I += %u;\n", x + 1);
+                    }
+                    break;
+                case 0x75:
+                    fprintf(out, "    memcpy(c->flags, v, %u);\n", NUM_FLAGS);
+                    break;
+                case 0x85:
+                    fprintf(out, "    memcpy(v, c->flags, %u);\n", NUM_FLAGS);
+                    break;
+            }
+            break;
+    }
+}
+
+/*
+* Two functions per block start, returns the end of the guest bytes they were
+* compiled from or 0 if there is nothing to compile. The block runs every instruction without
+* looking at the budget and counts them per class up front, calls with a
+* budget short of the whole block go to the partial version instead, which
+* checks before every instruction. Only the last instruction of a block can
+* leave it, so the partial version never gets that far.
+*/
+static uint16_t emit_block(FILE* out, uint16_t start, uint32_t* instructions){
+    uint16_t pcs[MAX_BLOCK_OPS];
+    uint32_t counts[NUM_OP_CLASSES] = {0};
+    uint16_t pc = start;
+    uint16_t length = 0;
+    op_kind kind = KIND_STRAIGHT;           // of the last instruction taken in
+
+    while(kind == KIND_STRAIGHT && length < MAX_BLOCK_OPS && in_rom(pc)
+          && classify(opcode_at(pc)) != KIND_INVALID && (length == 0 || !leader[pc])){
+        uint16_t opcode = opcode_at(pc);
+        kind = classify(opcode);
+        pcs[length++] = pc;
+        if(!counts_itself(opcode)){
+            counts[opcode >> 12]++;
+        }
+        pc += op_size(&ctx, pc);
+    }
+    if(length == 0){
+        // starts on an opcode the interpreter rejects
+        return 0;
+    }
+
+    if(length > 1){
+        fprintf(out, "static uint32_t partial_%04X(chip8* c, uint32_t budget){\n    uint8_t* v = c->v;\n", start);
+        for(uint16_t k = 0; k < length - 1; k++){
+            if(k > 0){
+                fprintf(out, "    if(budget == %u){ c->pc = 0x%04X; return %u; }\n", k, pcs[k], k);
+            }
+            emit_op(out, pcs[k], k, 1);
+        }
+        fprintf(out, "    c->pc = 0x%04X;\n    return %u;\n}\n\n", pcs[length - 1], length - 1);
+    }
+
+    fprintf(out, "static uint32_t block_%04X(chip8* c, uint32_t budget){\n    uint8_t* v = c->v;\n", start);
+    if(length > 1){
+        fprintf(out, "    if(budget < %u){\n        return partial_%04X(c, budget);\n    }\n", length, start);
+    }
+    for(int i = 0; i < NUM_OP_CLASSES; i++){
+        if(counts[i]){
+            fprintf(out, "    STAT_ADD(c, op_class[%d], %u);\n", i, counts[i]);
+        }
+    }
+    for(uint16_t k = 0; k < length; k++){
+        emit_op(out, pcs[k], k, 0);
+    }
+    if(kind == KIND_STRAIGHT){
+        // ran into another block or the end of what was compiled
+        fprintf(out, "    c->pc = 0x%04X;\n    return %u;\n", pc, length);
+        if(length == MAX_BLOCK_OPS){
+            add_leader(pc);
+        }
+    }else if(kind == KIND_SKIP){
+        // a skip reads the size of the instruction after it, cover that opcode too
+        pc += OP_SIZE;
+    }
+    fprintf(out, "}\n\n");
+    *instructions += length;
+    return pc;
+}
+
+static int write_module(const char* path, const char* rom){
+    FILE* out = fopen(path, "w");
+    if(!out){
+        return 0;
+    }
+    static uint16_t ends[RAM_SIZE];
+    uint32_t blocks = 0;
+    uint32_t instructions = 0;
+    uint32_t covered = 0;
+
+    fprintf(out, "/* generated by chip8-aot from %s, %s quirks */\n\n#include <string.h>\n\n#include \"aot.h\"\n\n",
+            rom, profile_name(ctx.profile));
+    fprintf(out, "static const aot_helpers* h;\n\n");
+    // blocks split at the op cap add their continuation as a later start
+    for(uint32_t addr = PROGRAM_START; addr < RAM_SIZE; addr++){
+        if(leader[addr]){
+            ends[addr] = emit_block(out, (uint16_t)addr, &instructions);
+            blocks += ends[addr] != 0;
+        }
+    }
+
+    fprintf(out, "AOT_EXPORT const aot_entry chip8_aot_blocks[] = {\n");
+    for(uint32_t addr = PROGRAM_START; addr < RAM_SIZE; addr++){
+        if(leader[addr] && ends[addr]){
+            fprintf(out, "    {0x%04X, 0x%04X, block_%04X},\n", addr, ends[addr], addr);
+        }
+        covered += reached[addr];
+    }
+    // not counted, keeps the initializer valid C when nothing was compiled
+    fprintf(out, "    {0, 0, NULL}\n};\n\n");
+    fprintf(out, "AOT_EXPORT const uint32_t chip8_aot_num_blocks = %u;\n", blocks);
+    fprintf(out, "AOT_EXPORT const uint32_t chip8_aot_layout = sizeof(chip8);\n");
+    fprintf(out, "AOT_EXPORT const uint64_t chip8_aot_rom_hash = 0x%016llxULL;\n", (unsigned long long)program_hash(&ctx));
+    fprintf(out, "AOT_EXPORT const uint32_t chip8_aot_profile = %u;\n\n", (unsigned)ctx.profile);
+    fprintf(out, "AOT_EXPORT void chip8_aot_bind(const aot_helpers* helpers){\n    h = helpers;\n}\n");
+    fclose(out);
+
+    printf("BLOCKS > %u \n", blocks);
+    printf("INSTRUCTIONS > %u \n", instructions);
+    printf("REACHED > %u \n", covered);
+    return 1;
+}
+
+// run a program with its arguments as given, no shell in between to reinterpret them. Returns its exit status
+static int run_program(const char* const* args){
+#ifdef WIN32
+    return (int)_spawnvp(_P_WAIT, args[0], args);
+#else
+    pid_t pid = fork();
+    if(pid == 0){
+        execvp(args[0], (char* const*)args);
+        _exit(127);
+    }
+    int status;
+    if(pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status)){
+        return -1;
+    }
+    return WEXITSTATUS(status);
+#endif
+}
+
+int main(int argc, char *argv[]){
+    const char* rom = NULL;
+    const char* module = NULL;
+    const char* cc = CHIP8_AOT_CC;
+    int c_only = 0;
+    int quirks_given = 0;
+    QUIRK_PROFILE profile = PROFILE_DEFAULT;
+    const char* quirk_db_path = QUIRK_DB;
+
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--cc") == 0 && i + 1 < argc){
+            cc = argv[++i];
+        }else if(strcmp(argv[i], "--c-only") == 0){
+            c_only = 1;
+        }else if(strcmp(argv[i], "--quirks") == 0 && i + 1 < argc){
+            if(!parse_profile(argv[++i], &profile)){
+                printf("ERROR > Unknown quirk profile %s \n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+            quirks_given = 1;
+        }else if(strcmp(argv[i], "--quirk-db") == 0 && i + 1 < argc){
+            quirk_db_path = argv[++i];
+        }else if(argv[i][0] == '-' && argv[i][1] == '-'){
+            printf("ERROR > Unknown option %s \n", argv[i]);
+            usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }else if(!rom){
+            rom = argv[i];
+        }else{
+            module = argv[i];
+        }
+    }
+
+    if(!rom){
+        printf("ERROR > Input file not provided \n");
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    FILE* input = fopen(rom, "rb");
+    if(!input){
+        printf("ERROR > Input file not found \n");
+        exit(EXIT_FAILURE);
+    }
+    size_t size = file_size(input);
+    if(size > (PROGRAM_END - PROGRAM_START)){
+        printf("ERROR > file too big for emulator \n");
+        exit(EXIT_FAILURE);
+    }
+    init_emulator(input, &ctx);
+    fclose(input);
+    rom_end = PROGRAM_START + (uint32_t)size;
+
+    // picked the way the emulator will pick it, the module is rejected otherwise
+    if(!quirks_given){
+        quirk_db* db = quirk_db_read(quirk_db_path);
+        quirk_db_lookup(db, program_hash(&ctx), &profile);
+        quirk_db_free(db);
+    }
+    set_profile(&ctx, profile);
+    quirks = PROFILE_QUIRKS[profile];
+    printf("QUIRKS > %s \n", profile_name(profile));
+
+    // a truncated path would write over some other file
+    char module_path[MAX_PATH_LENGTH];
+    char source_path[MAX_PATH_LENGTH];
+    const char* module_suffix = module ? "" : AOT_SUFFIX;
+    if(strlen(module ? module : rom) + strlen(module_suffix) + strlen(".c") >= sizeof(source_path)){
+        printf("ERROR > Module path too long \n");
+        exit(EXIT_FAILURE);
+    }
+    strcpy(module_path, module ? module : rom);
+    strcat(module_path, module_suffix);
+    strcpy(source_path, module_path);
+    strcat(source_path, ".c");
+
+    walk();
+    if(!write_module(source_path, rom)){
+        printf("ERROR > Could not write %s \n", source_path);
+        exit(EXIT_FAILURE);
+    }
+    if(c_only){
+        return 0;
+    }
+
+    // the module only needs the headers, everything it calls comes in through chip8_aot_bind
+    const char* args[] = {cc, "-O2", "-shared", "-fPIC", "-w", "-I" CHIP8_AOT_INCLUDE, "-o", module_path, source_path,
+                          STATS_ENABLED ? "-DCHIP8_STATS" : NULL, NULL};
+    if(run_program(args) != 0){
+        printf("ERROR > %s could not compile %s \n", cc, source_path);
+        exit(EXIT_FAILURE);
+    }
+    printf("MODULE > %s \n", module_path);
+    return 0;
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+* The few atomic operations the threads hand data over with, on plain
+* integers so the structs holding them stay C99. GCC and Clang get their
+* builtins, MSVC the Interlocked functions (full barriers, stronger than
+* asked for), anything else C11 atomics.
+*/
+
+#if defined(__GNUC__)
+
+static inline uint32_t load_acquire_u32(const uint32_t* p){
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline uint32_t load_relaxed_u32(const uint32_t* p){
+    return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+static inline void store_release_u32(uint32_t* p, uint32_t value){
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+// swap in value and return the old one, acquire and release
+static inline uint32_t exchange_u32(uint32_t* p, uint32_t value){
+    return __atomic_exchange_n(p, value, __ATOMIC_ACQ_REL);
+}
+
+// set bits and return the old value, release so whatever was written before is seen with them
+static inline uint32_t fetch_or_u32(uint32_t* p, uint32_t bits){
+    return __atomic_fetch_or(p, bits, __ATOMIC_RELEASE);
+}
+
+static inline uint64_t load_relaxed_u64(const uint64_t* p){
+    return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+static inline void store_relaxed_u64(uint64_t* p, uint64_t value){
+    __atomic_store_n(p, value, __ATOMIC_RELAXED);
+}
+
+// returns the value before the add
+static inline uint64_t fetch_add_u64(uint64_t* p, uint64_t value){
+    return __atomic_fetch_add(p, value, __ATOMIC_RELAXED);
+}
+
+#elif defined(_MSC_VER)
+
+#include <windows.h>
+
+static inline uint32_t load_acquire_u32(const uint32_t* p){
+    return (uint32_t)InterlockedCompareExchange((volatile LONG*)p, 0, 0);
+}
+
+static inline uint32_t load_relaxed_u32(const uint32_t* p){
+    return load_acquire_u32(p);
+}
+
+static inline void store_release_u32(uint32_t* p, uint32_t value){
+    InterlockedExchange((volatile LONG*)p, (LONG)value);
+}
+
+static inline uint32_t exchange_u32(uint32_t* p, uint32_t value){
+    return (uint32_t)InterlockedExchange((volatile LONG*)p, (LONG)value);
+}
+
+static inline uint32_t fetch_or_u32(uint32_t* p, uint32_t bits){
+    return (uint32_t)InterlockedOr((volatile LONG*)p, (LONG)bits);
+}
+
+static inline uint64_t load_relaxed_u64(const uint64_t* p){
+    return (uint64_t)InterlockedCompareExchange64((volatile LONG64*)p, 0, 0);
+}
+
+static inline void store_relaxed_u64(uint64_t* p, uint64_t value){
+    InterlockedExchange64((volatile LONG64*)p, (LONG64)value);
+}
+
+static inline uint64_t fetch_add_u64(uint64_t* p, uint64_t value){
+    return (uint64_t)InterlockedExchangeAdd64((volatile LONG64*)p, (LONG64)value);
+}
+
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_ATOMICS__)
+
+#include <stdatomic.h>
+
+static inline uint32_t load_acquire_u32(const uint32_t* p){
+    return atomic_load_explicit((const _Atomic uint32_t*)p, memory_order_acquire);
+}
+
+static inline uint32_t load_relaxed_u32(const uint32_t* p){
+    return atomic_load_explicit((const _Atomic uint32_t*)p, memory_order_relaxed);
+}
+
+static inline void store_release_u32(uint32_t* p, uint32_t value){
+    atomic_store_explicit((_Atomic uint32_t*)p, value, memory_order_release);
+}
+
+static inline uint32_t exchange_u32(uint32_t* p, uint32_t value){
+    return atomic_exchange_explicit((_Atomic uint32_t*)p, value, memory_order_acq_rel);
+}
+
+static inline uint32_t fetch_or_u32(uint32_t* p, uint32_t bits){
+    return atomic_fetch_or_explicit((_Atomic uint32_t*)p, bits, memory_order_release);
+}
+
+static inline uint64_t load_relaxed_u64(const uint64_t* p){
+    return atomic_load_explicit((const _Atomic uint64_t*)p, memory_order_relaxed);
+}
+
+static inline void store_relaxed_u64(uint64_t* p, uint64_t value){
+    atomic_store_explicit((_Atomic uint64_t*)p, value, memory_order_relaxed);
+}
+
+static inline uint64_t fetch_add_u64(uint64_t* p, uint64_t value){
+    return atomic_fetch_add_explicit((_Atomic uint64_t*)p, value, memory_order_relaxed);
+}
+
+#else
+#error "no atomic operations for this compiler"
+#endif
@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "atomics.h"
+#include "audio.h"
+#include "utils.h"
+
+
+static void audio_callback(void* user_data, uint8_t* raw_buffer, int bytes){
+    audio_engine* audio = user_data;
+    int16_t* out = (int16_t*)raw_buffer;
+    int length = bytes / (int)sizeof(int16_t);
+
+    // changes since the last callback are spread over this buffer in the order and spacing they came in
+    uint64_t now = time_ns();
+    uint64_t start = audio->last_callback_ns;
+    uint64_t span = now > start ? now - start : 1;
+    audio->last_callback_ns = now;
+
+    int done = 0;
+    uint32_t tail = audio->tail;
+    uint32_t head = load_acquire_u32(&audio->head);
+    for(; tail != head; tail++){
+        const audio_event* e = &audio->queue[tail & (AUDIO_QUEUE_SIZE - 1)];
+        int at = 0;
+        if(e->stamp_ns >= now){
+            at = length;
+        }else if(e->stamp_ns > start){
+            at = (int)((e->stamp_ns - start) * length / span);
+        }
+        if(at > done){
+            render_sound(&audio->synth, out + done, at - done);
+            done = at;
+        }
+        set_voice(&audio->synth, &e->voice);
+    }
+    store_release_u32(&audio->tail, tail);
+    render_sound(&audio->synth, out + done, length - done);
+}
+
+int open_audio(audio_engine* audio, uint16_t buffer_samples){
+    init_synth(&audio->synth);
+    memset(&audio->requested, 0, sizeof(audio->requested));
+    audio->head = 0;
+    audio->tail = 0;
+    audio->last_callback_ns = time_ns();
+
+    SDL_AudioSpec spec;
+    SDL_zero(spec);
+    spec.freq = AUDIO_RATE;
+    spec.format = AUDIO_S16SYS;
+    spec.channels = 1;
+    spec.samples = buffer_samples;
+    spec.callback = audio_callback;
+    spec.userdata = audio;
+
+    audio->device = SDL_OpenAudioDevice(NULL, 0, &spec, NULL, 0);
+    if(audio->device == 0){
+        printf(
+                "ERROR > Failed to open audio \n"
+                "SDL_ERROR > %s \n",
+                SDL_GetError()
+        );
+        return 0;
+    }
+    // the device runs for good, silence comes from the voice being off
+    SDL_PauseAudioDevice(audio->device, 0);
+    return 1;
+}
+
+void close_audio(audio_engine* audio){
+    if(audio->device){
+        SDL_CloseAudioDevice(audio->device);
+        audio->device = 0;
+    }
+}
+
+void set_audio_voice(audio_engine* audio, const sound_voice* voice){
+    // the pattern and pitch only matter while something is playing
+    if(!audio->device || (voice->on == audio->requested.on
+                          && (!voice->on || memcmp(voice, &audio->requested, sizeof(sound_voice)) == 0))){
+        return;
+    }
+    uint32_t head = audio->head;
+    if(head - load_acquire_u32(&audio->tail) == AUDIO_QUEUE_SIZE){
+        return;
+    }
+    audio->queue[head & (AUDIO_QUEUE_SIZE - 1)].stamp_ns = time_ns();
+    audio->queue[head & (AUDIO_QUEUE_SIZE - 1)].voice = *voice;
+    store_release_u32(&audio->head, head + 1);
+    audio->requested = *voice;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <SDL.h>
+#include <stdint.h>
+
+#include "sound.h"
+
+/*
+* Audio device output. The emulator only reports changes to what should be
+* playing, stamped with the host time they happened, through a lock free single
+* producer single consumer queue. The callback places each change at the
+* matching offset in the buffer it fills and synthesises the rest with
+* render_sound(), which delays sound by one buffer but keeps the length of every
+* beep exact. The callback never allocates, locks or waits on the emulator.
+*/
+
+#define AUDIO_QUEUE_SIZE 64                 // power of two
+
+typedef struct {
+    uint64_t stamp_ns;
+    sound_voice voice;
+} audio_event;
+
+typedef struct {
+    SDL_AudioDeviceID device;
+
+    // callback side
+    sound_synth synth;
+    uint64_t last_callback_ns;
+
+    // emulator side
+    sound_voice requested;                  // voice of the newest queued event
+
+    audio_event queue[AUDIO_QUEUE_SIZE];
+    uint32_t head;                          // written by the emulator
+    uint32_t tail;                          // written by the callback
+} audio_engine;
+
+// buffer_samples must be a power of two, returns 0 if no device could be opened
+int open_audio(audio_engine* audio, uint16_t buffer_samples);
+
+void close_audio(audio_engine* audio);
+
+// queue a change of voice, one that does not fit is retried on the next call
+void set_audio_voice(audio_engine* audio, const sound_voice* voice);
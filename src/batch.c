@@ -0,0 +1,537 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <dirent.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "aot.h"
+#include "chip8.h"
+#include "engine.h"
+#include "interp.h"
+#include "jit.h"
+#include "movie.h"
+#include "quirks.h"
+#include "utils.h"
+
+/*
+ * Runs a corpus of ROMs headless across every core and reports the final framebuffer
+ * hash, speed and wall time of each one. Each ROM gets its own chip8 context, nothing
+ * is shared between workers. Jobs are dealt out in contiguous runs to per worker deques,
+ * a worker pops from the back of its own deque and steals from the front of the others
+ * once it runs dry, so a few slow ROMs do not leave the rest of the cores idle.
+ */
+
+#define MAX_LINE 1024
+#define DEFAULT_CYCLES 10000000ULL
+
+typedef struct {
+    char* rom;
+    char* script;                       // input script or recorded movie, NULL if none
+    unsigned long long cycles;
+
+    // results
+    const char* status;
+    unsigned long long executed;
+    uint64_t hash;
+    uint64_t wall_ns;
+    uint64_t fusions[NUM_FUSIONS];
+    uint64_t dispatches_saved;
+} job;
+
+typedef struct {
+    pthread_mutex_t lock;
+    size_t* jobs;
+    size_t head;
+    size_t tail;
+} deque;
+
+typedef struct {
+    job* jobs;
+    deque* deques;
+    unsigned threads;
+    ENGINE engine;
+    uint32_t ipf;
+    uint64_t seed;
+    const quirk_db* db;
+    int profile;                        // QUIRK_PROFILE for every ROM, -1 to look each one up in db
+} pool;
+
+typedef struct {
+    pool* p;
+    unsigned id;
+} worker;
+
+
+static void usage(const char* name){
+    printf("usage: %s [--engine=interp|jit|ref|aot] [--ipf N] [--cycles N] [--seed N] [--threads N] \n"
+           "          [--quirks default|chip8|schip|xochip] [--quirk-db FILE] \n"
+           "          [--json] [--out FILE] [--fusions] <manifest | directory | rom...> \n"
+           "manifest lines are: <rom> [cycles] [input movie or script] \n"
+           "input script lines are: <cycle> <key 0-f> <down|up> \n", name);
+}
+
+static char* copy_string(const char* s){
+    char* copy = malloc(strlen(s) + 1);
+    if(!copy){
+        printf("ERROR > Could not allocate the job list \n");
+        exit(EXIT_FAILURE);
+    }
+    strcpy(copy, s);
+    return copy;
+}
+
+static void add_job(job** jobs, size_t* count, size_t* cap, const char* rom, unsigned long long cycles, const char* script){
+    if(*count == *cap){
+        *cap = *cap ? *cap * 2 : 64;
+        *jobs = realloc(*jobs, *cap * sizeof(job));
+        if(!*jobs){
+            printf("ERROR > Could not allocate the job list \n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    job* j = &(*jobs)[(*count)++];
+    memset(j, 0, sizeof(job));
+    j->rom = copy_string(rom);
+    j->script = script ? copy_string(script) : NULL;
+    j->cycles = cycles;
+}
+
+static int has_suffix(const char* s, const char* suffix){
+    size_t n = strlen(s), m = strlen(suffix);
+    return n >= m && strcmp(s + n - m, suffix) == 0;
+}
+
+static int compare_jobs(const void* a, const void* b){
+    return strcmp(((const job*)a)->rom, ((const job*)b)->rom);
+}
+
+// every .ch8 file in the directory, in name order so reports diff cleanly
+static void load_directory(DIR* dir, const char* path, job** jobs, size_t* count, size_t* cap, unsigned long long cycles){
+    size_t first = *count;
+    struct dirent* entry;
+    char rom[MAX_LINE];
+    while((entry = readdir(dir))){
+        if(!has_suffix(entry->d_name, ".ch8")){
+            continue;
+        }
+        snprintf(rom, sizeof(rom), "%s/%s", path, entry->d_name);
+        add_job(jobs, count, cap, rom, cycles, NULL);
+    }
+    qsort(*jobs + first, *count - first, sizeof(job), compare_jobs);
+}
+
+static void load_manifest(FILE* manifest, job** jobs, size_t* count, size_t* cap, unsigned long long cycles){
+    char line[MAX_LINE];
+    char rom[MAX_LINE];
+    char script[MAX_LINE];
+    unsigned long long rom_cycles;
+    while(fgets(line, sizeof(line), manifest)){
+        if(line[0] == '#'){
+            continue;
+        }
+        int fields = sscanf(line, "%1023s %llu %1023s", rom, &rom_cycles, script);
+        if(fields < 1){
+            continue;
+        }
+        add_job(jobs, count, cap, rom, fields >= 2 ? rom_cycles : cycles, fields == 3 ? script : NULL);
+    }
+}
+
+static void run_job(job* j, chip8* ctx, const pool* p){
+    ENGINE engine = p->engine;
+    uint32_t ipf = p->ipf;
+    uint64_t seed = p->seed;
+    movie* script = NULL;
+    if(j->script && !(script = movie_read(j->script))){
+        j->status = "bad-script";
+        return;
+    }
+    // recorded movies carry their own seed and frame length, text scripts leave them to us
+    if(script && script->ipf){
+        seed = script->seed;
+        ipf = script->ipf;
+    }
+
+    FILE* input = fopen(j->rom, "rb");
+    if(!input){
+        movie_free(script);
+        j->status = "missing";
+        return;
+    }
+    if(file_size(input) > (PROGRAM_END - PROGRAM_START)){
+        fclose(input);
+        movie_free(script);
+        j->status = "too-big";
+        return;
+    }
+    init_emulator(input, ctx);
+    seed_random(ctx, seed);
+    fclose(input);
+    QUIRK_PROFILE profile = PROFILE_DEFAULT;
+    if(p->profile >= 0){
+        profile = (QUIRK_PROFILE)p->profile;
+    }else{
+        quirk_db_lookup(p->db, program_hash(ctx), &profile);
+    }
+    set_profile(ctx, profile);
+    if(engine == ENGINE_AOT){
+        char module_path[MAX_LINE + 8];
+        const char* error;
+        snprintf(module_path, sizeof(module_path), "%s%s", j->rom, AOT_SUFFIX);
+        if(!(ctx->aot = aot_load(module_path, ctx, &error))){
+            movie_free(script);
+            j->status = "no-module";
+            return;
+        }
+    }
+    // the engines stop at every scripted event so keys change on the exact instruction
+    ctx->movie = script;
+
+    unsigned long long cycles = 0;
+    uint64_t start = time_ns();
+
+    while(!ctx->fault && j->cycles - cycles >= ipf){
+        cycles += run_frame(engine, ctx, ipf);
+    }
+    if(!ctx->fault && cycles < j->cycles){
+        cycles += run_engine(engine, ctx, j->cycles - cycles);
+    }
+
+    j->wall_ns = time_ns() - start;
+    j->executed = cycles;
+    j->hash = screen_hash(ctx);
+    memcpy(j->fusions, ctx->stats.fusions, sizeof(j->fusions));
+    j->dispatches_saved = ctx->stats.dispatches_saved;
+    // a fault only ends this job, the hash is of the screen it stopped on
+    switch (ctx->fault) {
+        case FAULT_BAD_OPCODE:
+            j->status = "bad-opcode";
+            break;
+        case FAULT_STACK:
+            j->status = "stack-fault";
+            break;
+        default:
+            j->status = "ok";
+    }
+    movie_free(script);
+    free_engines(ctx);
+}
+
+static int pop_job(deque* d, size_t* index){
+    pthread_mutex_lock(&d->lock);
+    int found = d->head < d->tail;
+    if(found){
+        *index = d->jobs[--d->tail];
+    }
+    pthread_mutex_unlock(&d->lock);
+    return found;
+}
+
+static int steal_job(deque* d, size_t* index){
+    pthread_mutex_lock(&d->lock);
+    int found = d->head < d->tail;
+    if(found){
+        *index = d->jobs[d->head++];
+    }
+    pthread_mutex_unlock(&d->lock);
+    return found;
+}
+
+static void* run_worker(void* arg){
+    worker* w = arg;
+    pool* p = w->p;
+    chip8* ctx = malloc(sizeof(chip8));
+    size_t index;
+    if(!ctx){
+        printf("ERROR > Could not allocate an emulator for worker %u \n", w->id);
+        exit(EXIT_FAILURE);
+    }
+
+    for(;;){
+        int found = pop_job(&p->deques[w->id], &index);
+        // nothing left locally, go round the other workers starting with the next one
+        for(unsigned i = 1; !found && i < p->threads; i++){
+            found = steal_job(&p->deques[(w->id + i) % p->threads], &index);
+        }
+        if(!found){
+            break;
+        }
+        run_job(&p->jobs[index], ctx, p);
+    }
+
+    free(ctx);
+    return NULL;
+}
+
+static void run_pool(job* jobs, size_t count, unsigned threads, ENGINE engine, uint32_t ipf, uint64_t seed,
+                     const quirk_db* db, int profile){
+    pool p = {jobs, malloc(threads * sizeof(deque)), threads, engine, ipf, seed, db, profile};
+    worker* workers = malloc(threads * sizeof(worker));
+    pthread_t* ids = malloc(threads * sizeof(pthread_t));
+    if(!p.deques || !workers || !ids){
+        printf("ERROR > Could not allocate %u workers \n", threads);
+        exit(EXIT_FAILURE);
+    }
+
+    // an even share each up front, stealing evens out whatever the shares cost
+    size_t per_worker = (count + threads - 1) / threads;
+    for(unsigned i = 0; i < threads; i++){
+        deque* d = &p.deques[i];
+        size_t first = i * per_worker < count ? i * per_worker : count;
+        size_t last = first + per_worker < count ? first + per_worker : count;
+        pthread_mutex_init(&d->lock, NULL);
+        d->jobs = malloc((last - first + 1) * sizeof(size_t));
+        if(!d->jobs){
+            printf("ERROR > Could not allocate %u workers \n", threads);
+            exit(EXIT_FAILURE);
+        }
+        d->head = 0;
+        d->tail = 0;
+        // owner pops from the back, push in reverse so it still runs its share in order
+        for(size_t k = last; k > first; k--){
+            d->jobs[d->tail++] = k - 1;
+        }
+    }
+
+    for(unsigned i = 0; i < threads; i++){
+        workers[i].p = &p;
+        workers[i].id = i;
+        if(pthread_create(&ids[i], NULL, run_worker, &workers[i]) != 0){
+            printf("ERROR > Could not start worker thread \n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for(unsigned i = 0; i < threads; i++){
+        pthread_join(ids[i], NULL);
+    }
+
+    for(unsigned i = 0; i < threads; i++){
+        pthread_mutex_destroy(&p.deques[i].lock);
+        free(p.deques[i].jobs);
+    }
+    free(p.deques);
+    free(workers);
+    free(ids);
+}
+
+static double job_ips(const job* j){
+    return j->wall_ns ? j->executed * 1e9 / (double)j->wall_ns : 0.0;
+}
+
+// quoted if it holds a separator, quote or line break, quotes doubled
+static void write_csv_field(FILE* out, const char* s){
+    if(!strpbrk(s, ",\"\r\n")){
+        fputs(s, out);
+        return;
+    }
+    fputc('"', out);
+    for(; *s; s++){
+        if(*s == '"'){
+            fputc('"', out);
+        }
+        fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+static void write_csv(FILE* out, const job* jobs, size_t count, ENGINE engine){
+    fprintf(out, "rom,engine,status,cycles,hash,ips,wall_ms\n");
+    for(size_t i = 0; i < count; i++){
+        const job* j = &jobs[i];
+        write_csv_field(out, j->rom);
+        fprintf(out, ",%s,%s,%llu,%016llx,%.0f,%.3f\n", engine_name(engine), j->status,
+                j->executed, (unsigned long long)j->hash, job_ips(j), j->wall_ns / 1e6);
+    }
+}
+
+// how often each fused run of the interpreter fired over the whole corpus
+static void write_fusions(FILE* out, const job* jobs, size_t count){
+    uint64_t fired[NUM_FUSIONS] = {0};
+    uint64_t saved = 0;
+    unsigned long long executed = 0;
+    for(size_t i = 0; i < count; i++){
+        for(int f = 0; f < NUM_FUSIONS; f++){
+            fired[f] += jobs[i].fusions[f];
+        }
+        saved += jobs[i].dispatches_saved;
+        executed += jobs[i].executed;
+    }
+    for(int f = 0; f < NUM_FUSIONS; f++){
+        fprintf(out, "FUSION > %-10s %llu \n", fusion_name(f), (unsigned long long)fired[f]);
+    }
+    fprintf(out, "FUSION > %llu of %llu dispatches saved (%.2f%%) \n", (unsigned long long)saved, executed,
+            executed ? 100.0 * saved / executed : 0.0);
+}
+
+static void write_json_string(FILE* out, const char* s){
+    fputc('"', out);
+    for(; *s; s++){
+        if(*s == '"' || *s == '\\'){
+            fputc('\\', out);
+        }
+        fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+static void write_json(FILE* out, const job* jobs, size_t count, ENGINE engine){
+    fprintf(out, "[\n");
+    for(size_t i = 0; i < count; i++){
+        const job* j = &jobs[i];
+        fprintf(out, "  {\"rom\": ");
+        write_json_string(out, j->rom);
+        fprintf(out, ", \"engine\": \"%s\", \"status\": \"%s\", \"cycles\": %llu, \"hash\": \"%016llx\", "
+                     "\"ips\": %.0f, \"wall_ms\": %.3f}%s\n", engine_name(engine), j->status, j->executed,
+                (unsigned long long)j->hash, job_ips(j), j->wall_ns / 1e6, i + 1 < count ? "," : "");
+    }
+    fprintf(out, "]\n");
+}
+
+
+int main(int argc, char *argv[]){
+    ENGINE engine = ENGINE_INTERP;
+    uint32_t ipf = INSTRUCTIONS_PER_FRAME;
+    unsigned long long cycles = DEFAULT_CYCLES;
+    uint64_t seed = DEFAULT_SEED;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    uint8_t json = 0;
+    uint8_t fusions = 0;
+    const char* out_path = NULL;
+    int profile = -1;
+    const char* quirk_db_path = QUIRK_DB;
+
+    job* jobs = NULL;
+    size_t count = 0, cap = 0;
+    const char** inputs = malloc(argc * sizeof(char*));
+    int num_inputs = 0;
+    if(!inputs){
+        printf("ERROR > Could not allocate the input list \n");
+        exit(EXIT_FAILURE);
+    }
+
+    for(int i = 1; i < argc; i++){
+        if(strncmp(argv[i], "--engine=", 9) == 0){
+            if(!parse_engine(argv[i] + 9, &engine)){
+                printf("ERROR > Unknown engine %s \n", argv[i] + 9);
+                exit(EXIT_FAILURE);
+            }
+        }else if(strcmp(argv[i], "--cycles") == 0 && i + 1 < argc){
+            cycles = strtoull(argv[++i], NULL, 10);
+        }else if(strcmp(argv[i], "--ipf") == 0 && i + 1 < argc){
+            ipf = strtoul(argv[++i], NULL, 10);
+        }else if(strcmp(argv[i], "--seed") == 0 && i + 1 < argc){
+            seed = strtoull(argv[++i], NULL, 10);
+        }else if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc){
+            threads = strtol(argv[++i], NULL, 10);
+        }else if(strcmp(argv[i], "--json") == 0){
+            json = 1;
+        }else if(strcmp(argv[i], "--fusions") == 0){
+            fusions = 1;
+        }else if(strcmp(argv[i], "--quirks") == 0 && i + 1 < argc){
+            QUIRK_PROFILE given;
+            if(!parse_profile(argv[++i], &given)){
+                printf("ERROR > Unknown quirk profile %s \n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+            profile = (int)given;
+        }else if(strcmp(argv[i], "--quirk-db") == 0 && i + 1 < argc){
+            quirk_db_path = argv[++i];
+        }else if(strcmp(argv[i], "--out") == 0 && i + 1 < argc){
+            out_path = argv[++i];
+        }else if(argv[i][0] == '-' && argv[i][1] == '-'){
+            printf("ERROR > Unknown option %s \n", argv[i]);
+            usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }else{
+            inputs[num_inputs++] = argv[i];
+        }
+    }
+
+    if(!num_inputs){
+        printf("ERROR > No ROMs given \n");
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if(engine == ENGINE_JIT && !jit_available()){
+        printf("ERROR > The JIT is not supported on this host \n");
+        exit(EXIT_FAILURE);
+    }
+
+    if(ipf == 0 || threads < 1){
+        printf("ERROR > --ipf and --threads must be at least 1 \n");
+        exit(EXIT_FAILURE);
+    }
+
+    if(fusions && !STATS_ENABLED){
+        printf("ERROR > Built without CHIP8_STATS, --fusions is not available \n");
+        exit(EXIT_FAILURE);
+    }
+
+    // options are all parsed by now, so --cycles applies wherever it was given
+    for(int i = 0; i < num_inputs; i++){
+        DIR* dir = opendir(inputs[i]);
+        if(dir){
+            load_directory(dir, inputs[i], &jobs, &count, &cap, cycles);
+            closedir(dir);
+        }else if(has_suffix(inputs[i], ".ch8")){
+            add_job(&jobs, &count, &cap, inputs[i], cycles, NULL);
+        }else{
+            FILE* manifest = fopen(inputs[i], "r");
+            if(!manifest){
+                printf("ERROR > Input file not found %s \n", inputs[i]);
+                exit(EXIT_FAILURE);
+            }
+            load_manifest(manifest, &jobs, &count, &cap, cycles);
+            fclose(manifest);
+        }
+    }
+    free(inputs);
+
+    if(count == 0){
+        printf("ERROR > No ROMs found \n");
+        exit(EXIT_FAILURE);
+    }
+
+    if((size_t)threads > count){
+        threads = (long)count;
+    }
+
+    // read once up front, the workers only look entries up
+    quirk_db* db = profile < 0 ? quirk_db_read(quirk_db_path) : NULL;
+
+    uint64_t start = time_ns();
+    run_pool(jobs, count, (unsigned)threads, engine, ipf, seed, db, profile);
+    uint64_t elapsed = time_ns() - start;
+    quirk_db_free(db);
+
+    FILE* out = stdout;
+    if(out_path && !(out = fopen(out_path, "w"))){
+        printf("ERROR > Could not open %s \n", out_path);
+        exit(EXIT_FAILURE);
+    }
+    if(json){
+        write_json(out, jobs, count, engine);
+    }else{
+        write_csv(out, jobs, count, engine);
+    }
+    if(out != stdout){
+        fclose(out);
+    }
+    if(fusions){
+        write_fusions(stderr, jobs, count);
+    }
+
+    int failed = 0;
+    for(size_t i = 0; i < count; i++){
+        failed |= strcmp(jobs[i].status, "ok") != 0;
+        free(jobs[i].rom);
+        free(jobs[i].script);
+    }
+    free(jobs);
+
+    fprintf(stderr, "BATCH > %zu roms on %ld threads in %.3f s \n", count, threads, elapsed / 1e9);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,356 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "engine.h"
+#include "jit.h"
+#include "lanes.h"
+#include "rewind.h"
+#include "snapshot.h"
+#include "utils.h"
+
+#ifdef CHIP8_SDL
+#include "gfx.h"
+#endif
+
+/*
+ * Synthetic workloads for the core and the renderer. Every case is timed over a number
+ * of runs from a fresh machine and reported as ns per operation at the median, 90th and
+ * 99th percentile plus the best run. An operation is one guest instruction for the ROM
+ * cases, one presented frame for the render case, a save plus a restore for the
+ * snapshot case, one captured frame for the rewind case and one guest instruction of one
+ * lane for the lanes case. Use --csv to keep results around
+ * and compare them across commits.
+ */
+
+#define DEFAULT_RUNS 21
+#define DEFAULT_OPS 200000
+#define RENDER_FRAMES 200
+#define SNAPSHOTS 1000
+
+typedef struct {
+    const char* name;
+    const uint8_t* program;
+    size_t size;
+} workload;
+
+// 8xyN arithmetic in a tight loop
+static const uint8_t ALU[] = {
+        0x60, 0x01,             // 200: V0 = 1
+        0x61, 0x03,             // 202: V1 = 3
+        0x80, 0x14,             // 204: V0 += V1
+        0x81, 0x05,             // 206: V1 -= V0
+        0x82, 0x02,             // 208: V2 &= V0
+        0x82, 0x13,             // 20A: V2 ^= V1
+        0x83, 0x06,             // 20C: V3 >>= 1
+        0x74, 0x0F,             // 20E: V4 += 15
+        0x85, 0x41,             // 210: V5 |= V4
+        0x85, 0x0E,             // 212: V5 <<= 1
+        0x12, 0x04              // 214: jump 204
+};
+
+// four nested calls and returns per loop
+static const uint8_t CALLS[] = {
+        0x22, 0x06,             // 200: call 206
+        0x12, 0x00,             // 202: jump 200
+        0x60, 0x00,             // 204: padding
+        0x22, 0x0C,             // 206: call 20C
+        0x70, 0x01,             // 208: V0 += 1
+        0x00, 0xEE,             // 20A: return
+        0x22, 0x12,             // 20C: call 212
+        0x71, 0x01,             // 20E: V1 += 1
+        0x00, 0xEE,             // 210: return
+        0x22, 0x18,             // 212: call 218
+        0x72, 0x01,             // 214: V2 += 1
+        0x00, 0xEE,             // 216: return
+        0x73, 0x01,             // 218: V3 += 1
+        0x00, 0xEE              // 21A: return
+};
+
+#define SPRITE_DATA \
+        0xFF, 0x81, 0xBD, 0xA5, 0xA5, 0xBD, 0x81, 0xFF, \
+        0x3C, 0x42, 0x99, 0xA5, 0xA5, 0x99, 0x42, 0x3C, \
+        0xFF, 0x00, 0xFF, 0x00, 0xAA, 0x55, 0xAA, 0x55, \
+        0x18, 0x3C, 0x7E, 0xFF, 0xFF, 0x7E, 0x3C, 0x18
+
+// a sprite every third instruction, walking diagonally over the screen and wrapping
+#define SPRITE_STORM(mode, height) { \
+        0x00, mode,             /* 200: select resolution */ \
+        0xA2, 0x10,             /* 202: I = 210 */ \
+        0x60, 0x00,             /* 204: V0 = 0 */ \
+        0x61, 0x00,             /* 206: V1 = 0 */ \
+        0xD0, 0x10 | height,    /* 208: draw at V0, V1 */ \
+        0x70, 0x05,             /* 20A: V0 += 5 */ \
+        0x71, 0x03,             /* 20C: V1 += 3 */ \
+        0x12, 0x08,             /* 20E: jump 208 */ \
+        SPRITE_DATA             /* 210: sprite rows */ \
+}
+
+static const uint8_t DRAW_8X15_LOW[] = SPRITE_STORM(0xFE, 0xF);
+static const uint8_t DRAW_8X15_HIGH[] = SPRITE_STORM(0xFF, 0xF);
+// DXY0 only draws 16 x 16 in high resolution on SUPER-CHIP 1.1
+static const uint8_t DRAW_16X16_HIGH[] = SPRITE_STORM(0xFF, 0x0);
+
+// a screenful of sprites, then scroll it around
+#define SCROLLS(mode) { \
+        0x00, mode,             /* 200: select resolution */ \
+        0xA2, 0x1C,             /* 202: I = 21C */ \
+        0xD0, 0x1F,             /* 204: draw at V0, V1 */ \
+        0x70, 0x07,             /* 206: V0 += 7 */ \
+        0x71, 0x0B,             /* 208: V1 += 11 */ \
+        0x72, 0x01,             /* 20A: V2 += 1 */ \
+        0x32, 0x10,             /* 20C: skip if V2 == 16 */ \
+        0x12, 0x04,             /* 20E: jump 204 */ \
+        0x00, 0xFB,             /* 210: scroll right */ \
+        0x00, 0xFC,             /* 212: scroll left */ \
+        0x00, 0xC3,             /* 214: scroll down 3 */ \
+        0x00, 0xFC,             /* 216: scroll left */ \
+        0x12, 0x10,             /* 218: jump 210 */ \
+        0x00, 0x00,             /* 21A: padding */ \
+        SPRITE_DATA             /* 21C: sprite rows */ \
+}
+
+static const uint8_t SCROLL_LOW[] = SCROLLS(0xFE);
+static const uint8_t SCROLL_HIGH[] = SCROLLS(0xFF);
+
+static const workload WORKLOADS[] = {
+        {"alu", ALU, sizeof(ALU)},
+        {"calls", CALLS, sizeof(CALLS)},
+        {"draw8x15-lowres", DRAW_8X15_LOW, sizeof(DRAW_8X15_LOW)},
+        {"draw8x15-hires", DRAW_8X15_HIGH, sizeof(DRAW_8X15_HIGH)},
+        {"draw16x16-hires", DRAW_16X16_HIGH, sizeof(DRAW_16X16_HIGH)},
+        {"scroll-lowres", SCROLL_LOW, sizeof(SCROLL_LOW)},
+        {"scroll-hires", SCROLL_HIGH, sizeof(SCROLL_HIGH)},
+};
+
+#define NUM_WORKLOADS (sizeof(WORKLOADS) / sizeof(WORKLOADS[0]))
+
+
+static void usage(const char* name){
+    printf("usage: %s [--engine=interp|jit|ref] [--runs N] [--ops N] [--csv] [case...] \n", name);
+}
+
+static int compare_doubles(const void* a, const void* b){
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// nearest rank percentile of sorted samples
+static double percentile(const double* sorted, uint32_t count, uint32_t p){
+    uint32_t rank = (p * count + 99) / 100;
+    return sorted[rank ? rank - 1 : 0];
+}
+
+static void report(const char* name, double* samples, uint32_t runs, uint8_t csv){
+    qsort(samples, runs, sizeof(double), compare_doubles);
+    double p50 = percentile(samples, runs, 50);
+    double p90 = percentile(samples, runs, 90);
+    double p99 = percentile(samples, runs, 99);
+    double ops = p50 > 0 ? 1e9 / p50 : 0.0;
+    if(csv){
+        printf("%s,%.3f,%.3f,%.3f,%.3f,%.0f\n", name, p50, p90, p99, samples[0], ops);
+    }else{
+        printf("%-18s %10.3f %10.3f %10.3f %10.3f %14.0f \n", name, p50, p90, p99, samples[0], ops);
+    }
+}
+
+static void load_workload(chip8* ctx, const workload* w){
+    // init_emulator reads from a file, go through a temporary one
+    FILE* rom = tmpfile();
+    if(!rom){
+        printf("ERROR > Could not create temporary file \n");
+        exit(EXIT_FAILURE);
+    }
+    fwrite(w->program, 1, w->size, rom);
+    rewind(rom);
+    init_emulator(rom, ctx);
+    fclose(rom);
+}
+
+static void bench_workload(chip8* ctx, const workload* w, ENGINE engine, uint32_t runs, uint32_t ops, double* samples){
+    // one untimed run to fault in the pages and fill the caches
+    load_workload(ctx, w);
+    run_engine(engine, ctx, ops);
+    free_engines(ctx);
+
+    for(uint32_t r = 0; r < runs; r++){
+        load_workload(ctx, w);
+        uint64_t start = time_ns();
+        run_engine(engine, ctx, ops);
+        samples[r] = (double)(time_ns() - start) / ops;
+        free_engines(ctx);
+    }
+}
+
+// save and restore a machine that keeps running in between, as a rewind or fork would
+static void bench_snapshot(chip8* ctx, ENGINE engine, uint32_t runs, double* samples){
+    chip8_snapshot* snapshot = calloc(1, sizeof(chip8_snapshot));
+    load_workload(ctx, &WORKLOADS[3]);
+
+    for(uint32_t r = 0; r < runs; r++){
+        uint64_t elapsed = 0;
+        for(uint32_t i = 0; i < SNAPSHOTS; i++){
+            uint64_t start = time_ns();
+            save_snapshot(ctx, snapshot);
+            load_snapshot(ctx, snapshot);
+            elapsed += time_ns() - start;
+            run_engine(engine, ctx, INSTRUCTIONS_PER_FRAME);
+        }
+        samples[r] = (double)elapsed / SNAPSHOTS;
+    }
+    free_engines(ctx);
+    free(snapshot);
+}
+
+// per frame rewind capture of a sprite storm, the screen changes every frame
+static void bench_rewind(chip8* ctx, ENGINE engine, uint32_t runs, double* samples){
+    for(uint32_t r = 0; r < runs; r++){
+        rewind_buffer* history = rewind_create(REWIND_ARENA_SIZE, 60 * FRAME_RATE, REWIND_KEYFRAME_INTERVAL);
+        load_workload(ctx, &WORKLOADS[3]);
+        uint64_t elapsed = 0;
+        for(uint32_t i = 0; i < SNAPSHOTS; i++){
+            run_frame(engine, ctx, INSTRUCTIONS_PER_FRAME);
+            uint64_t start = time_ns();
+            rewind_capture(history, ctx);
+            elapsed += time_ns() - start;
+        }
+        samples[r] = (double)elapsed / SNAPSHOTS;
+        rewind_free(history);
+        free_engines(ctx);
+    }
+}
+
+// the alu loop on every lane of the lockstep engine
+static void bench_lanes(uint32_t runs, uint32_t ops, double* samples){
+    for(uint32_t r = 0; r < runs; r++){
+        chip8_lanes* l = lanes_create(ALU, sizeof(ALU), NULL);
+        if(!l){
+            printf("ERROR > Could not allocate the lanes \n");
+            exit(EXIT_FAILURE);
+        }
+        uint64_t start = time_ns();
+        run_lanes(l, ops);
+        samples[r] = (double)(time_ns() - start) / ((double)ops * LANES);
+        lanes_free(l);
+    }
+}
+
+#ifdef CHIP8_SDL
+static void bench_render(chip8* ctx, uint32_t runs, double* samples){
+    GraphicsContext g_ctx;
+    g_ctx.width = SCREEN_WIDTH;
+    g_ctx.height = SCREEN_HEIGHT;
+    g_ctx.scale = 10;
+    get_offscreen_context(&g_ctx);
+
+    // start from a busy screen
+    load_workload(ctx, &WORKLOADS[3]);
+    run_engine(ENGINE_REF, ctx, DEFAULT_OPS);
+
+    for(uint32_t r = 0; r < runs; r++){
+        uint64_t start = time_ns();
+        for(uint32_t f = 0; f < RENDER_FRAMES; f++){
+            // flip a pixel so the unchanged frame check never skips the upload
+            ctx->screen[0][f % SCREEN_HEIGHT][0] ^= 1ULL << 63;
+            render_graphics(&g_ctx, ctx->screen, ~0ULL);
+        }
+        samples[r] = (double)(time_ns() - start) / RENDER_FRAMES;
+    }
+    free_graphics(&g_ctx);
+}
+#endif
+
+static int selected(const char* name, const char** cases, int num_cases){
+    for(int i = 0; i < num_cases; i++){
+        if(strcmp(name, cases[i]) == 0){
+            return 1;
+        }
+    }
+    return num_cases == 0;
+}
+
+
+int main(int argc, char *argv[]){
+    ENGINE engine = ENGINE_INTERP;
+    uint32_t runs = DEFAULT_RUNS;
+    uint32_t ops = DEFAULT_OPS;
+    uint8_t csv = 0;
+    const char** cases = malloc(argc * sizeof(char*));
+    int num_cases = 0;
+
+    for(int i = 1; i < argc; i++){
+        if(strncmp(argv[i], "--engine=", 9) == 0){
+            if(!parse_engine(argv[i] + 9, &engine)){
+                printf("ERROR > Unknown engine %s \n", argv[i] + 9);
+                exit(EXIT_FAILURE);
+            }
+        }else if(strcmp(argv[i], "--runs") == 0 && i + 1 < argc){
+            runs = strtoul(argv[++i], NULL, 10);
+        }else if(strcmp(argv[i], "--ops") == 0 && i + 1 < argc){
+            ops = strtoul(argv[++i], NULL, 10);
+        }else if(strcmp(argv[i], "--csv") == 0){
+            csv = 1;
+        }else if(argv[i][0] == '-' && argv[i][1] == '-'){
+            printf("ERROR > Unknown option %s \n", argv[i]);
+            usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }else{
+            cases[num_cases++] = argv[i];
+        }
+    }
+
+    if(engine == ENGINE_JIT && !jit_available()){
+        printf("ERROR > The JIT is not supported on this host \n");
+        exit(EXIT_FAILURE);
+    }
+
+    if(runs == 0 || ops == 0){
+        printf("ERROR > --runs and --ops must be at least 1 \n");
+        exit(EXIT_FAILURE);
+    }
+
+    chip8* ctx = malloc(sizeof(chip8));
+    double* samples = malloc(runs * sizeof(double));
+
+    if(csv){
+        printf("case,p50_ns,p90_ns,p99_ns,min_ns,ops_per_s\n");
+    }else{
+        printf("engine %s, %u runs of %u instructions \n", engine_name(engine), runs, ops);
+        printf("%-18s %10s %10s %10s %10s %14s \n", "case", "p50 ns/op", "p90", "p99", "min", "op/s");
+    }
+
+    for(size_t i = 0; i < NUM_WORKLOADS; i++){
+        if(!selected(WORKLOADS[i].name, cases, num_cases)){
+            continue;
+        }
+        bench_workload(ctx, &WORKLOADS[i], engine, runs, ops, samples);
+        report(WORKLOADS[i].name, samples, runs, csv);
+    }
+
+    if(selected("snapshot", cases, num_cases)){
+        bench_snapshot(ctx, engine, runs, samples);
+        report("snapshot", samples, runs, csv);
+    }
+
+    if(selected("rewind", cases, num_cases)){
+        bench_rewind(ctx, engine, runs, samples);
+        report("rewind", samples, runs, csv);
+    }
+
+    if(selected("lanes", cases, num_cases)){
+        bench_lanes(runs, ops, samples);
+        report("lanes", samples, runs, csv);
+    }
+
+#ifdef CHIP8_SDL
+    if(selected("render", cases, num_cases)){
+        bench_render(ctx, runs, samples);
+        report("render", samples, runs, csv);
+    }
+#endif
+
+    free(samples);
+    free(ctx);
+    free(cases);
+    return 0;
+}
@@ -1,32 +1,58 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
-#include <time.h>
 
+#include "atomics.h"
 #include "chip8.h"
+#include "jit.h"
+#include "aot.h"
 #include "utils.h"
 
 
+// mem_epoch of the next init, shared by every context in the process
+static uint64_t next_epoch = 1;
+
 static void fetch(chip8* chip8_ctx);
 static void adv(chip8* chip8_ctx, size_t steps);
-static void wait_key(chip8* chip8_ctx);
-static void draw(chip8* chip8_ctx);
-static void wide_draw(chip8* chip8_ctx);
-static void scroll_left(chip8 *chip8_ctx);
-static void scroll_right(chip8 *chip8_ctx);
-static void scroll_down(chip8* chip8_ctx, int n);
+static void skip(chip8* chip8_ctx, uint8_t taken);
 
 
 void init_emulator(FILE* input, chip8* chip8_ctx){
+    init_emulator_rom(NULL, 0, chip8_ctx);
+    // like init_emulator_rom, whatever would run past the end of memory is dropped
+    size_t size = file_size(input);
+    if(size > PROGRAM_END - PROGRAM_START){
+        size = PROGRAM_END - PROGRAM_START;
+    }
+    fread(chip8_ctx->mem + PROGRAM_START, 1, size, input);
+}
+
+void init_emulator_rom(const uint8_t* rom, size_t size, chip8* chip8_ctx){
 
     memset(chip8_ctx->mem, 0, RAM_SIZE);
-    fread(chip8_ctx->mem + PROGRAM_START, 1, file_size(input), input);
+    if(size > PROGRAM_END - PROGRAM_START){
+        size = PROGRAM_END - PROGRAM_START;
+    }
+    if(size){
+        memcpy(chip8_ctx->mem + PROGRAM_START, rom, size);
+    }
 
-    memset(chip8_ctx->stack, 0, STACK_SIZE);
+    memset(chip8_ctx->stack, 0, sizeof(chip8_ctx->stack));
     memset(chip8_ctx->v, 0, NUM_REGISTERS);
-    memset(chip8_ctx->screen, 0, SCREEN_WIDTH * SCREEN_HEIGHT);
+    memset(chip8_ctx->screen, 0, sizeof(chip8_ctx->screen));
     memset(chip8_ctx->keyboard, 0, NUM_KEYS);
     memset(chip8_ctx->flags, 0, NUM_FLAGS);
+    memset(chip8_ctx->decoded, 0, sizeof(chip8_ctx->decoded));
+    // a snapshot of an earlier init must not take the page stamps of this one for its own
+    chip8_ctx->mem_epoch = fetch_add_u64(&next_epoch, 1);
+    chip8_ctx->mem_stamp = 0;
+    memset(chip8_ctx->page_stamp, 0, sizeof(chip8_ctx->page_stamp));
+    chip8_ctx->jit = NULL;
+    chip8_ctx->aot = NULL;
+    chip8_ctx->trace = NULL;
+    chip8_ctx->movie = NULL;
+    chip8_ctx->cycles = 0;
+    reset_stats(&chip8_ctx->stats);
 
     chip8_ctx->pc = PROGRAM_START;
     chip8_ctx->sp = 0;
@@ -34,17 +60,36 @@ void init_emulator(FILE* input, chip8* chip8_ctx){
 
     chip8_ctx->delay_timer = 0;
     chip8_ctx->sound_timer = 0;
+    chip8_ctx->pitch = DEFAULT_PITCH;
+    chip8_ctx->xo_audio = 0;
+    memset(chip8_ctx->audio_pattern, 0, AUDIO_PATTERN_SIZE);
     chip8_ctx->exit = 0;
-    chip8_ctx->step_cycles = 0;
+    chip8_ctx->fault = FAULT_NONE;
     chip8_ctx->draw = 1;
+    chip8_ctx->dirty_rows = ~0ULL;
     chip8_ctx->wait = 0;
+    chip8_ctx->rewind = 0;
+    chip8_ctx->spin_length = 0;
+    chip8_ctx->idle = 0;
     chip8_ctx->screen_mode = LOW_RES64;
+    chip8_ctx->planes = 1;
+    chip8_ctx->profile = PROFILE_DEFAULT;
 
     // read font sets
     memcpy(chip8_ctx->mem, FONT_SET, FONT_SET_SIZE);
     memcpy(chip8_ctx->mem + FONT_SET_SIZE, SUPER_FONT_SET, SUPER_FONT_SET_SIZE);
 
-    srand(time(0));
+    seed_random(chip8_ctx, DEFAULT_SEED);
+}
+
+void seed_random(chip8* chip8_ctx, uint64_t seed){
+    // splitmix64 step, spreads small seeds over the whole state
+    uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    chip8_ctx->seed = seed;
+    chip8_ctx->rng = z ? z : 1;
 }
 
 
@@ -53,10 +98,11 @@ void reset_emulator(chip8* chip8_ctx){
     memset(chip8_ctx->screen, 0 , sizeof(chip8_ctx->screen));
     // clear program memory upto the font sets
     memset(chip8_ctx->mem + FONT_SET_SIZE + SUPER_FONT_SET_SIZE, 0, PROGRAM_START - (FONT_SET_SIZE + SUPER_FONT_SET_SIZE));
+    mem_written(chip8_ctx, FONT_SET_SIZE + SUPER_FONT_SET_SIZE, PROGRAM_START - (FONT_SET_SIZE + SUPER_FONT_SET_SIZE));
 
     memset(chip8_ctx->v, 0 , NUM_REGISTERS);
     memset(chip8_ctx->keyboard, 0, NUM_KEYS);
-    memset(chip8_ctx->stack, 0, STACK_SIZE);
+    memset(chip8_ctx->stack, 0, sizeof(chip8_ctx->stack));
 
     chip8_ctx->pc = PROGRAM_START;
     chip8_ctx->sp = 0;
@@ -64,16 +110,30 @@ void reset_emulator(chip8* chip8_ctx){
 
     chip8_ctx->delay_timer = 0;
     chip8_ctx->sound_timer = 0;
+    chip8_ctx->pitch = DEFAULT_PITCH;
+    chip8_ctx->xo_audio = 0;
+    memset(chip8_ctx->audio_pattern, 0, AUDIO_PATTERN_SIZE);
     chip8_ctx->exit = 0;
-    chip8_ctx->step_cycles = 0;
+    chip8_ctx->fault = FAULT_NONE;
     chip8_ctx->draw = 1;
+    chip8_ctx->dirty_rows = ~0ULL;
     chip8_ctx->wait = 0;
+    chip8_ctx->spin_length = 0;
+    chip8_ctx->idle = 0;
+    chip8_ctx->planes = 1;
+    seed_random(chip8_ctx, chip8_ctx->seed);
+}
+
+void set_profile(chip8* chip8_ctx, QUIRK_PROFILE profile){
+    chip8_ctx->profile = profile;
+    // the recompilers baked the old quirks into whatever they compiled
+    mem_written(chip8_ctx, 0, RAM_SIZE);
 }
 
 
 static void fetch(chip8* chip8_ctx){
 
-    uint16_t opcode = chip8_ctx->mem[chip8_ctx->pc] << 8 | chip8_ctx->mem[chip8_ctx->pc + 1];
+    uint16_t opcode = chip8_ctx->mem[chip8_ctx->pc & ADDR_MASK] << 8 | chip8_ctx->mem[(chip8_ctx->pc + 1) & ADDR_MASK];
 
     chip8_ctx->current_op.op = (opcode & 0xf000) >> 12;
     chip8_ctx->current_op.x = (opcode & 0x0f00) >> 8;
@@ -82,24 +142,14 @@ static void fetch(chip8* chip8_ctx){
     chip8_ctx->current_op.kk = opcode & 0xff;
     chip8_ctx->current_op.n = opcode & 0xf;
     chip8_ctx->current_op.full_op = opcode;
-
-    if(chip8_ctx->debug) {
-        printf("OP > %4X | op = %1X |  x = %1X | y = %1X | addr = %3X | nn = %2X | n = %1X \n",
-               opcode,
-               chip8_ctx->current_op.op,
-               chip8_ctx->current_op.x,
-               chip8_ctx->current_op.y,
-               chip8_ctx->current_op.addr,
-               chip8_ctx->current_op.kk,
-               chip8_ctx->current_op.n
-        );
-    }
 }
 
 void execute(chip8* chip8_ctx){
     fetch(chip8_ctx);
     opcode op = chip8_ctx->current_op;
+    STAT_ADD(chip8_ctx, op_class[op.op], 1);
 
+    uint8_t quirks = PROFILE_QUIRKS[chip8_ctx->profile];
     uint8_t v_x = chip8_ctx->v[op.x];
     uint8_t v_y = chip8_ctx->v[op.y];
     uint16_t wide_sum;
@@ -120,18 +170,20 @@ void execute(chip8* chip8_ctx){
                     switch (op.n) {
                         case 0x0:
                             // clear screen
-                            memset(chip8_ctx->screen, 0 , sizeof(chip8_ctx->screen));
+                            clear_screen(chip8_ctx);
                             adv(chip8_ctx, 1);
-                            chip8_ctx->draw = 1;
                             break;
                         case 0xE:
                             // return
+                            if(chip8_ctx->sp == 0){
+                                stack_fault(chip8_ctx, op.full_op);
+                                break;
+                            }
                             chip8_ctx->pc = chip8_ctx->stack[(--chip8_ctx->sp)] + OP_SIZE;
                             break;
                         default:
                             // unknown opcode
-                            printf("ERROR > Opcode %X not recognized \n", op.full_op);
-                            exit(EXIT_FAILURE);
+                            unknown_opcode(chip8_ctx, op.full_op);
                     }
                     break;
                 case 0xF:
@@ -152,50 +204,51 @@ void execute(chip8* chip8_ctx){
                             break;
                         case 0xE:
                             // disable 128 x 64 screen mode
-                            memset(chip8_ctx->screen, 0 , sizeof(chip8_ctx->screen));
+                            clear_screen(chip8_ctx);
                             chip8_ctx->screen_mode = LOW_RES64;
-                            chip8_ctx->draw = 1;
                             adv(chip8_ctx, 1);
                             break;
                         case 0xF:
                             // enable 128 x 64 screen mode
-                            memset(chip8_ctx->screen, 0 , sizeof(chip8_ctx->screen));
+                            clear_screen(chip8_ctx);
                             chip8_ctx->screen_mode = HIGH_RES128;
-                            chip8_ctx->draw = 1;
                             adv(chip8_ctx, 1);
                             break;
                         default:
                             // unknown opcode
-                            printf("ERROR > Opcode %X not recognized \n", op.full_op);
-                            exit(EXIT_FAILURE);
+                            unknown_opcode(chip8_ctx, op.full_op);
                     }
                     break;
                 default:
                     // unknown opcode
-                    printf("ERROR > Opcode %X not recognized \n", op.full_op);
-                    exit(EXIT_FAILURE);
+                    unknown_opcode(chip8_ctx, op.full_op);
             }
             break;
         case 1:
             // jump
+            detect_spin(chip8_ctx, chip8_ctx->pc, op.addr);
             chip8_ctx->pc = op.addr;
             break;
         case 2:
             // call
+            if(chip8_ctx->sp >= STACK_SIZE){
+                stack_fault(chip8_ctx, op.full_op);
+                break;
+            }
             chip8_ctx->stack[(chip8_ctx->sp++)] = chip8_ctx->pc;
             chip8_ctx->pc = op.addr;
             break;
         case 3:
             // skip next op if Vx = kk
-            adv(chip8_ctx, 1 + (v_x == op.kk));
+            skip(chip8_ctx, v_x == op.kk);
             break;
         case 4:
             // skip next op if Vx != kk
-            adv(chip8_ctx, 1 + (v_x != op.kk));
+            skip(chip8_ctx, v_x != op.kk);
             break;
         case 5:
             // skip next op if Vx = Vy
-            adv(chip8_ctx, 1 + (v_x == v_y));
+            skip(chip8_ctx, v_x == v_y);
             break;
         case 6:
             // set Vx = kk
@@ -238,7 +291,10 @@ void execute(chip8* chip8_ctx){
                     chip8_ctx->v[op.x] = v_x - v_y;
                     break;
                 case 6:
-                    // set Vx = Vx SHR 1
+                    // set Vx = Vx SHR 1, or Vy SHR 1
+                    if(quirks & QUIRK_SHIFT_VY){
+                        v_x = v_y;
+                    }
                     chip8_ctx->v[VF_IDX] = v_x & 1;
                     chip8_ctx->v[op.x] = v_x >> 1;
                     break;
@@ -248,20 +304,23 @@ void execute(chip8* chip8_ctx){
                     chip8_ctx->v[op.x] = v_y - v_x;
                     break;
                 case 0xE:
-                    // set Vx = Vx SHL 1
+                    // set Vx = Vx SHL 1, or Vy SHL 1
+                    if(quirks & QUIRK_SHIFT_VY){
+                        v_x = v_y;
+                    }
                     chip8_ctx->v[VF_IDX] = v_x >> 7;
                     chip8_ctx->v[op.x] = v_x << 1;
                     break;
                 default:
-                    // unknown opcode
-                    printf("ERROR > Opcode %X not recognized \n", op.full_op);
-                    exit(EXIT_FAILURE);
+                    // unknown opcode, stay on it
+                    unknown_opcode(chip8_ctx, op.full_op);
+                    return;
             }
             adv(chip8_ctx, 1);
             break;
         case 9:
             // skip next op if Vx != Vy
-            adv(chip8_ctx, 1 + (v_x != v_y));
+            skip(chip8_ctx, v_x != v_y);
             break;
         case 0xA:
             // set I == nnn
@@ -269,12 +328,12 @@ void execute(chip8* chip8_ctx){
             adv(chip8_ctx, 1);
             break;
         case 0xB:
-            // jump to nnn + V0
-            chip8_ctx->pc = op.addr + chip8_ctx->v[0];
+            // jump to nnn + V0, or xnn + Vx
+            chip8_ctx->pc = op.addr + chip8_ctx->v[(quirks & QUIRK_JUMP_VX) ? op.x : 0];
             break;
         case 0xC:
             // Vx = random byte AND kk
-            chip8_ctx->v[op.x] = (uint8_t)rand() & op.kk;
+            chip8_ctx->v[op.x] = random_byte(chip8_ctx) & op.kk;
             adv(chip8_ctx, 1);
             break;
         case 0xD:
@@ -282,30 +341,58 @@ void execute(chip8* chip8_ctx){
             // set VF = collision if any pixel is unset
             if(op.n == 0 && chip8_ctx->screen_mode == HIGH_RES128){
                 // draw a 16 x 16 sprite
-                wide_draw(chip8_ctx);
+                if(quirks & QUIRK_WRAP){
+                    wide_draw_wrap(chip8_ctx, op.x, op.y);
+                }else{
+                    wide_draw(chip8_ctx, op.x, op.y);
+                }
+            }else if(quirks & QUIRK_WRAP){
+                draw_wrap(chip8_ctx, op.x, op.y, op.n);
             }else {
-                draw(chip8_ctx);
+                draw(chip8_ctx, op.x, op.y, op.n);
             }
             adv(chip8_ctx, 1);
             break;
         case 0xE:
             switch (op.kk) {
                 case 0x9E:
-                    // skip next op if key with value Vx is pressed
-                    adv(chip8_ctx, 1 + chip8_ctx->keyboard[v_x]);
+                    // skip next op if key with value Vx is pressed, only the low nibble names a key
+                    skip(chip8_ctx, chip8_ctx->keyboard[v_x & 0xf]);
                     break;
                 case 0xA1:
                     // skip next op if key with value Vx is not pressed
-                    adv(chip8_ctx, 1 + (!chip8_ctx->keyboard[v_x]));
+                    skip(chip8_ctx, !chip8_ctx->keyboard[v_x & 0xf]);
                     break;
                 default:
                     // unknown opcode
-                    printf("ERROR > Opcode %X not recognized \n", op.full_op);
-                    exit(EXIT_FAILURE);
+                    unknown_opcode(chip8_ctx, op.full_op);
             }
             break;
         case 0xF:
             switch (op.kk) {
+                case 0x00:
+                    if(op.x != 0){
+                        unknown_opcode(chip8_ctx, op.full_op);
+                        break;
+                    }
+                    // XO-CHIP set I = NNNN, the 16 bit address following the opcode
+                    chip8_ctx->I = chip8_ctx->mem[(chip8_ctx->pc + 2) & ADDR_MASK] << 8 | chip8_ctx->mem[(chip8_ctx->pc + 3) & ADDR_MASK];
+                    chip8_ctx->pc += LONG_OP_SIZE;
+                    break;
+                case 0x01:
+                    // XO-CHIP select the drawing planes, bit n of N picks plane n
+                    chip8_ctx->planes = op.x & ((1 << NUM_PLANES) - 1);
+                    adv(chip8_ctx, 1);
+                    break;
+                case 0x02:
+                    if(op.x != 0){
+                        unknown_opcode(chip8_ctx, op.full_op);
+                        break;
+                    }
+                    // XO-CHIP load the audio pattern from memory location I
+                    load_audio_pattern(chip8_ctx);
+                    adv(chip8_ctx, 1);
+                    break;
                 case 7:
                     // Vx = delay timer value
                     chip8_ctx->v[op.x] = chip8_ctx->delay_timer;
@@ -313,7 +400,7 @@ void execute(chip8* chip8_ctx){
                     break;
                 case 0x0A:
                     // Wait for keypress and store value of the key in Vx
-                    wait_key(chip8_ctx);
+                    wait_key(chip8_ctx, op.x);
                     break;
                 case 0x15:
                     // delay timer = Vx
@@ -325,9 +412,16 @@ void execute(chip8* chip8_ctx){
                     chip8_ctx->sound_timer = v_x;
                     adv(chip8_ctx, 1);
                     break;
+                case 0x3A:
+                    // XO-CHIP set the audio pattern pitch = Vx
+                    chip8_ctx->pitch = v_x;
+                    adv(chip8_ctx, 1);
+                    break;
                 case 0x1E:
                     // set I = I + Vx
-                    chip8_ctx->v[VF_IDX] = !((0xFFFF - chip8_ctx->I) < v_x);
+                    if(quirks & QUIRK_ADD_I_VF){
+                        chip8_ctx->v[VF_IDX] = !((0xFFFF - chip8_ctx->I) < v_x);
+                    }
                     chip8_ctx->I += v_x;
                     adv(chip8_ctx, 1);
                     break;
@@ -343,19 +437,25 @@ void execute(chip8* chip8_ctx){
                     break;
                 case 0x33:
                     // store BCD representation of Vx in memory location I, I+1 and I+2
-                    chip8_ctx->mem[chip8_ctx->I] = v_x / 100;
-                    chip8_ctx->mem[chip8_ctx->I + 1] = (v_x / 10) % 10;
-                    chip8_ctx->mem[chip8_ctx->I + 2] = v_x % 10;
+                    store_bcd(chip8_ctx, v_x);
+                    mem_written(chip8_ctx, chip8_ctx->I, 3);
                     adv(chip8_ctx, 1);
                     break;
                 case 0x55:
                     // store registers V0 through Vx in memory starting at location I
-                    memcpy(chip8_ctx->mem + chip8_ctx->I, chip8_ctx->v, op.x + 1);
+                    store_registers(chip8_ctx, chip8_ctx->v, op.x + 1);
+                    mem_written(chip8_ctx, chip8_ctx->I, op.x + 1);
+                    if(quirks & QUIRK_MEMORY_I){
+                        chip8_ctx->I += op.x + 1;
+                    }
                     adv(chip8_ctx, 1);
                     break;
                 case 0x65:
                     // read registers v0 through Vx from memory at location I
-                    memcpy(chip8_ctx->v, chip8_ctx->mem + chip8_ctx->I, op.x + 1);
+                    load_registers(chip8_ctx, chip8_ctx->v, op.x + 1);
+                    if(quirks & QUIRK_MEMORY_I){
+                        chip8_ctx->I += op.x + 1;
+                    }
                     adv(chip8_ctx, 1);
                     break;
                 case 0x75:
@@ -370,135 +470,291 @@ void execute(chip8* chip8_ctx){
                     break;
                 default:
                     // unknown opcode
-                    printf("ERROR > Opcode %X not recognized \n", op.full_op);
-                    exit(EXIT_FAILURE);
+                    unknown_opcode(chip8_ctx, op.full_op);
 
             }
             break;
         default:
             // unknown opcode
-            printf("ERROR > Opcode %X not recognized \n", op.full_op);
-            exit(EXIT_FAILURE);
+            unknown_opcode(chip8_ctx, op.full_op);
     }
 
 }
 
 
+void unknown_opcode(chip8* chip8_ctx, uint16_t opcode){
+    chip8_ctx->fault = FAULT_BAD_OPCODE;
+    chip8_ctx->fault_pc = chip8_ctx->pc;
+    chip8_ctx->fault_opcode = opcode;
+    chip8_ctx->exit = 1;
+}
+
+void stack_fault(chip8* chip8_ctx, uint16_t opcode){
+    chip8_ctx->fault = FAULT_STACK;
+    chip8_ctx->fault_pc = chip8_ctx->pc;
+    chip8_ctx->fault_opcode = opcode;
+    chip8_ctx->exit = 1;
+}
+
+void mem_written(chip8* chip8_ctx, uint16_t addr, uint32_t size){
+    // a decode starting up to DECODE_SPAN - 1 bytes before the write (F000 NNNN, fused runs) overlaps it as well
+    uint16_t start = (addr - (DECODE_SPAN - 1)) & ADDR_MASK;
+    for(uint32_t i = 0; i < size + DECODE_SPAN - 1 && i < RAM_SIZE; i++){
+        chip8_ctx->decoded[(start + i) & ADDR_MASK].handler = 0;
+    }
+    if(size){
+        uint64_t stamp = ++chip8_ctx->mem_stamp;
+        uint32_t first = addr / MEM_PAGE_SIZE;
+        uint32_t pages = ((uint32_t)addr + size - 1) / MEM_PAGE_SIZE - first + 1;
+        for(uint32_t p = 0; p < pages && p < NUM_PAGES; p++){
+            chip8_ctx->page_stamp[(first + p) % NUM_PAGES] = stamp;
+        }
+    }
+    // the recompilers compare address ranges, a write running off the end of memory is split where it wraps
+    uint32_t room = RAM_SIZE - (uint32_t)addr;
+    uint32_t head = size < room ? size : room;
+    if(chip8_ctx->jit){
+        jit_invalidate(chip8_ctx->jit, addr, head);
+        if(head < size){
+            jit_invalidate(chip8_ctx->jit, 0, size - head);
+        }
+    }
+    if(chip8_ctx->aot){
+        aot_invalidate(chip8_ctx->aot, addr, head);
+        if(head < size){
+            aot_invalidate(chip8_ctx->aot, 0, size - head);
+        }
+    }
+}
+
+void tick_timers(chip8* chip8_ctx){
+    chip8_ctx->delay_timer -= (chip8_ctx->delay_timer > 0);
+    chip8_ctx->sound_timer -= (chip8_ctx->sound_timer > 0);
+}
+
+void detect_spin(chip8* chip8_ctx, uint16_t pc, uint16_t target){
+    const uint8_t* mem = chip8_ctx->mem;
+    uint8_t x = mem[target & ADDR_MASK] & 0xf;
+
+    if(target == pc){
+        // jump to self
+        chip8_ctx->spin_length = 1;
+    }else if(target + 2 * OP_SIZE == pc
+             && mem[target & ADDR_MASK] == (0xF0 | x) && mem[(target + 1) & ADDR_MASK] == 0x07
+             && (mem[(target + 2) & ADDR_MASK] == (0x30 | x) || mem[(target + 2) & ADDR_MASK] == (0x40 | x))){
+        // Fx07; 3xkk / 4xkk; jump back, polling the delay timer
+        chip8_ctx->spin_length = 3;
+    }
+}
+
+uint64_t screen_hash(const chip8* chip8_ctx){
+    // a screen that only ever used plane 0 hashes the same as before XO-CHIP planes
+    static const uint64_t blank[SCREEN_HEIGHT][SCREEN_ROW_WORDS];
+    if(memcmp(chip8_ctx->screen[1], blank, sizeof(blank)) == 0){
+        return hash_bytes(chip8_ctx->screen[0], sizeof(chip8_ctx->screen[0]));
+    }
+    return hash_bytes(chip8_ctx->screen, sizeof(chip8_ctx->screen));
+}
+
+
 static void adv(chip8* chip8_ctx, size_t steps){
     chip8_ctx->pc  += (OP_SIZE * steps);
 }
 
-static void draw(chip8* chip8_ctx){
-    opcode op = chip8_ctx->current_op;
-    uint8_t v_x = chip8_ctx->v[op.x];
-    uint8_t v_y = chip8_ctx->v[op.y];
-    uint16_t y, coord_1, coord_2, w_y;
-    uint8_t pixel, x, w_x;
-    // clear collision register
-    chip8_ctx->v[VF_IDX] = 0;
-    y = 0;
-    if(chip8_ctx->screen_mode == LOW_RES64) {
-        v_x *= 2;
-        v_y *= 2;
-        // wrap starting coordinates
-        v_x %= SCREEN_WIDTH;
-        v_y %= SCREEN_HEIGHT;
-        for (w_y = 0; y < op.n; w_y += 2, y++) {
-            pixel = chip8_ctx->mem[chip8_ctx->I + y];
-            x = 0;
-            for (w_x = 0; w_x < 16; x++, w_x += 2) {
-                if (pixel & (0x80 >> x)) {
-                    coord_1 = (w_y + v_y) * SCREEN_WIDTH + w_x + v_x;
-                    coord_2 = (w_y + 1 + v_y) * SCREEN_WIDTH + w_x + v_x;
-                    // use top left pixel as collision representative of the whole 2 x 2 pixel
-                    chip8_ctx->v[VF_IDX] = chip8_ctx->v[VF_IDX] || chip8_ctx->screen[coord_1];
-                    chip8_ctx->screen[coord_1] ^= 1;
-                    chip8_ctx->screen[coord_2] ^= 1;
-                    chip8_ctx->screen[coord_1 + 1] ^= 1;
-                    chip8_ctx->screen[coord_2 + 1] ^= 1;
-                }
-            }
-        }
+static void skip(chip8* chip8_ctx, uint8_t taken){
+    adv(chip8_ctx, 1);
+    if(taken){
+        chip8_ctx->pc += op_size(chip8_ctx, chip8_ctx->pc);
+    }
+}
+
+// spread each bit of a low resolution sprite byte over two pixels
+static uint16_t double_bits(uint8_t byte){
+    uint16_t bits = byte;
+    bits = (bits | (bits << 4)) & 0x0F0F;
+    bits = (bits | (bits << 2)) & 0x3333;
+    bits = (bits | (bits << 1)) & 0x5555;
+    return bits | (bits << 1);
+}
+
+// xor a sprite row of `width` bits (msb = leftmost pixel) into row y of a plane starting
+// at column x, pixels past the right edge are clipped. Returns 1 if a lit pixel was hit
+static uint8_t xor_row(chip8* chip8_ctx, uint8_t plane, uint8_t y, uint32_t bits, uint8_t width, uint8_t x){
+    uint64_t* row = chip8_ctx->screen[plane][y];
+    uint64_t sprite = (uint64_t)bits << (64 - width);
+    uint64_t left, right;
+    if(x < 64){
+        left = sprite >> x;
+        right = x ? sprite << (64 - x) : 0;
     }else{
-        // wrap starting coordinates
-        v_x %= SCREEN_WIDTH;
-        v_y %= SCREEN_HEIGHT;
-        // render high resolution 128 x 64
-        for(y = 0; y < op.n; y++){
-            pixel = chip8_ctx->mem[chip8_ctx->I + y];
-            for(x = 0; x < 8; x++){
-                if(pixel & (0x80 >> x)){
-                    coord_1 = (y + v_y) * SCREEN_WIDTH + x + v_x;
-                    chip8_ctx->v[VF_IDX] = chip8_ctx->v[VF_IDX] || chip8_ctx->screen[coord_1];
-                    chip8_ctx->screen[coord_1] ^= 1;
-                }
+        left = 0;
+        right = sprite >> (x - 64);
+    }
+    uint64_t hit = (row[0] & left) | (row[1] & right);
+    row[0] ^= left;
+    row[1] ^= right;
+    chip8_ctx->dirty_rows |= 1ULL << y;
+    return hit != 0;
+}
+
+// xor_row for a row that may run past the right edge, with wrap the pixels past it come back in on the left
+static inline uint8_t put_row(chip8* chip8_ctx, uint8_t plane, uint8_t y, uint32_t bits, uint8_t width, uint8_t x, uint8_t wrap){
+    uint8_t hit = xor_row(chip8_ctx, plane, y, bits, width, x);
+    if(wrap && x + width > SCREEN_WIDTH){
+        uint8_t spill = x + width - SCREEN_WIDTH;
+        hit |= xor_row(chip8_ctx, plane, y, bits & ((1u << spill) - 1), spill, 0);
+    }
+    return hit;
+}
+
+// body of draw() and draw_wrap(), each passes a constant wrap
+static inline void draw_sprite(chip8* chip8_ctx, uint8_t x, uint8_t y, uint8_t n, uint8_t wrap){
+    uint8_t v_x = chip8_ctx->v[x];
+    uint8_t v_y = chip8_ctx->v[y];
+    uint8_t collision = 0;
+    uint8_t row = 0;
+    // each selected plane takes the next n bytes of sprite data
+    uint16_t addr = chip8_ctx->I;
+
+    for(uint8_t plane = 0; plane < NUM_PLANES; plane++){
+        if(!(chip8_ctx->planes & (1 << plane))){
+            continue;
+        }
+        if(chip8_ctx->screen_mode == LOW_RES64) {
+            // every low resolution pixel covers 2 x 2 screen pixels
+            uint8_t lx = (v_x * 2) % SCREEN_WIDTH;
+            uint8_t ly = (v_y * 2) % SCREEN_HEIGHT;
+            for (row = 0; row < n && (wrap || ly + row * 2 < SCREEN_HEIGHT); row++) {
+                uint8_t sy = (ly + row * 2) % SCREEN_HEIGHT;
+                uint16_t bits = double_bits(chip8_ctx->mem[(addr + row) & ADDR_MASK]);
+                // use the top row as collision representative of the whole 2 x 2 pixel
+                collision |= put_row(chip8_ctx, plane, sy, bits, 16, lx, wrap);
+                put_row(chip8_ctx, plane, sy + 1, bits, 16, lx, wrap);
+            }
+        }else{
+            // wrap starting coordinates and render high resolution 128 x 64
+            uint8_t hx = v_x % SCREEN_WIDTH;
+            uint8_t hy = v_y % SCREEN_HEIGHT;
+            for(row = 0; row < n && (wrap || hy + row < SCREEN_HEIGHT); row++){
+                collision |= put_row(chip8_ctx, plane, (hy + row) % SCREEN_HEIGHT, chip8_ctx->mem[(addr + row) & ADDR_MASK], 8, hx, wrap);
             }
         }
+        STAT_ADD(chip8_ctx, pixels_drawn, row * 8);
+        addr += n;
     }
+    chip8_ctx->v[VF_IDX] = collision;
     chip8_ctx->draw = 1;
 }
 
-static void wide_draw(chip8* chip8_ctx){
-    opcode op = chip8_ctx->current_op;
-    uint8_t v_x = chip8_ctx->v[op.x];
-    uint8_t v_y = chip8_ctx->v[op.y];
-    uint16_t y, coord, pixel;
-    uint8_t x;
-    // wrap starting coordinates
-    v_x %= SCREEN_WIDTH;
-    v_y %= SCREEN_HEIGHT;
-    // clear collision register
-    chip8_ctx->v[VF_IDX] = 0;
-
-    for(y = 0; y < 16; y++){
-        pixel = (chip8_ctx->mem[chip8_ctx->I + y * 2] << 8) | chip8_ctx->mem[chip8_ctx->I + y * 2 + 1];
-        for(x = 0; x < 16; x++){
-            if(pixel & (0x8000 >> x)){
-                coord = (y + v_y) * SCREEN_WIDTH + x + v_x;
-                chip8_ctx->v[VF_IDX] = chip8_ctx->v[VF_IDX] || chip8_ctx->screen[coord];
-                chip8_ctx->screen[coord] ^= 1;
-            }
+// body of wide_draw() and wide_draw_wrap()
+static inline void wide_sprite(chip8* chip8_ctx, uint8_t x, uint8_t y, uint8_t wrap){
+    uint8_t v_x = chip8_ctx->v[x] % SCREEN_WIDTH;
+    uint8_t v_y = chip8_ctx->v[y] % SCREEN_HEIGHT;
+    uint8_t collision = 0;
+    uint8_t row;
+    // each selected plane takes the next 32 bytes of sprite data
+    uint16_t addr = chip8_ctx->I;
+
+    for(uint8_t plane = 0; plane < NUM_PLANES; plane++){
+        if(!(chip8_ctx->planes & (1 << plane))){
+            continue;
+        }
+        for(row = 0; row < 16 && (wrap || v_y + row < SCREEN_HEIGHT); row++){
+            uint16_t bits = (chip8_ctx->mem[(addr + row * 2) & ADDR_MASK] << 8) | chip8_ctx->mem[(addr + row * 2 + 1) & ADDR_MASK];
+            collision |= put_row(chip8_ctx, plane, (v_y + row) % SCREEN_HEIGHT, bits, 16, v_x, wrap);
         }
+        STAT_ADD(chip8_ctx, pixels_drawn, row * 16);
+        addr += 32;
     }
+    chip8_ctx->v[VF_IDX] = collision;
     chip8_ctx->draw = 1;
 }
 
-static void scroll_left(chip8 *chip8_ctx) {
-    for(size_t y = 0; y < SCREEN_HEIGHT; y++){
-        for (size_t x = SCROLL_STEP; x < SCREEN_WIDTH; x++){
-            chip8_ctx->screen[y * SCREEN_WIDTH + x - SCROLL_STEP] = chip8_ctx->screen[y * SCREEN_WIDTH + x];
-            if(x > SCREEN_WIDTH - 1 - SCROLL_STEP) {
-                chip8_ctx->screen[y * SCREEN_WIDTH + x] = 0;
-            }
+void draw(chip8* chip8_ctx, uint8_t x, uint8_t y, uint8_t n){
+    draw_sprite(chip8_ctx, x, y, n, 0);
+}
+
+void draw_wrap(chip8* chip8_ctx, uint8_t x, uint8_t y, uint8_t n){
+    draw_sprite(chip8_ctx, x, y, n, 1);
+}
+
+void wide_draw(chip8* chip8_ctx, uint8_t x, uint8_t y){
+    wide_sprite(chip8_ctx, x, y, 0);
+}
+
+void wide_draw_wrap(chip8* chip8_ctx, uint8_t x, uint8_t y){
+    wide_sprite(chip8_ctx, x, y, 1);
+}
+
+void clear_screen(chip8* chip8_ctx){
+    for(uint8_t plane = 0; plane < NUM_PLANES; plane++){
+        if(chip8_ctx->planes & (1 << plane)){
+            memset(chip8_ctx->screen[plane], 0, sizeof(chip8_ctx->screen[plane]));
         }
     }
+    chip8_ctx->dirty_rows = ~0ULL;
+    chip8_ctx->draw = 1;
 }
 
-static void scroll_right(chip8 *chip8_ctx) {
-    for(size_t y = 0; y < SCREEN_HEIGHT; y++){
-        for (long long x = SCREEN_WIDTH - SCROLL_STEP - 1; x >= 0; x--){
-            chip8_ctx->screen[y * SCREEN_WIDTH + x + SCROLL_STEP] = chip8_ctx->screen[y * SCREEN_WIDTH + x];
-            if(x < SCROLL_STEP) {
-                chip8_ctx->screen[y * SCREEN_WIDTH + x] = 0;
-            }
+void scroll_left(chip8 *chip8_ctx) {
+    for(uint8_t plane = 0; plane < NUM_PLANES; plane++){
+        if(!(chip8_ctx->planes & (1 << plane))){
+            continue;
+        }
+        for(size_t y = 0; y < SCREEN_HEIGHT; y++){
+            uint64_t* row = chip8_ctx->screen[plane][y];
+            row[0] = (row[0] << SCROLL_STEP) | (row[1] >> (64 - SCROLL_STEP));
+            row[1] <<= SCROLL_STEP;
         }
     }
+    chip8_ctx->dirty_rows = ~0ULL;
+    chip8_ctx->draw = 1;
 }
 
-static void scroll_down(chip8* chip8_ctx, int n){
-    for(long long y = SCREEN_HEIGHT - n - 1; y >= 0; y--){
-        memcpy(chip8_ctx->screen + (y + n)*SCREEN_WIDTH, chip8_ctx->screen + (y * SCREEN_WIDTH), SCREEN_WIDTH);
+void scroll_right(chip8 *chip8_ctx) {
+    for(uint8_t plane = 0; plane < NUM_PLANES; plane++){
+        if(!(chip8_ctx->planes & (1 << plane))){
+            continue;
+        }
+        for(size_t y = 0; y < SCREEN_HEIGHT; y++){
+            uint64_t* row = chip8_ctx->screen[plane][y];
+            row[1] = (row[1] >> SCROLL_STEP) | (row[0] << (64 - SCROLL_STEP));
+            row[0] >>= SCROLL_STEP;
+        }
+    }
+    chip8_ctx->dirty_rows = ~0ULL;
+    chip8_ctx->draw = 1;
+}
+
+void scroll_down(chip8* chip8_ctx, int n){
+    for(uint8_t plane = 0; plane < NUM_PLANES; plane++){
+        if(!(chip8_ctx->planes & (1 << plane))){
+            continue;
+        }
+        uint64_t (*screen)[SCREEN_ROW_WORDS] = chip8_ctx->screen[plane];
+        memmove(screen[n], screen[0], (SCREEN_HEIGHT - n) * sizeof(screen[0]));
+        memset(screen, 0, n * sizeof(screen[0]));
     }
-    memset(chip8_ctx->screen, 0, SCREEN_WIDTH * n);
+    chip8_ctx->dirty_rows = ~0ULL;
+    chip8_ctx->draw = 1;
 }
 
-static void wait_key(chip8* chip8_ctx){
+void wait_key(chip8* chip8_ctx, uint8_t x){
     uint8_t i;
     for (i = 0; i < NUM_KEYS; i++){
         if(chip8_ctx->keyboard[i]){
-            chip8_ctx->v[chip8_ctx->current_op.x] = i;
+            chip8_ctx->v[x] = i;
             adv(chip8_ctx, 1);
-            break;
+            return;
         }
     }
+    // no key down, the guest spins on this instruction
+    chip8_ctx->spin_length = 1;
+}
+
+void load_audio_pattern(chip8* chip8_ctx){
+    for(int i = 0; i < AUDIO_PATTERN_SIZE; i++){
+        chip8_ctx->audio_pattern[i] = chip8_ctx->mem[(chip8_ctx->I + i) & ADDR_MASK];
+    }
+    chip8_ctx->xo_audio = 1;
 }
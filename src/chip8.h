@@ -2,36 +2,48 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
-#define RAM_SIZE 4096
+#include "quirks.h"
+#include "stats.h"
+#include "trace.h"
+
+#define RAM_SIZE 0x10000            // XO-CHIP address space, F000 NNNN reaches all of it
+#define CLASSIC_RAM_SIZE 0x1000
+#define ADDR_MASK (RAM_SIZE - 1)
 #define STACK_SIZE 16
 #define FONT_SET_SIZE 80
 #define SUPER_FONT_SET_SIZE 100
 #define OP_SIZE 2
+#define LONG_OP_SIZE 4              // F000 NNNN
+#define DECODE_SPAN 6               // bytes a cached decode may depend on, a fused run of three opcodes
+#define MEM_PAGE_SIZE 1024          // granularity of the write tracking snapshots and rewind rely on
+#define NUM_PAGES (RAM_SIZE / MEM_PAGE_SIZE)
 
 #define NUM_REGISTERS 16
 #define NUM_FLAGS 8
 #define VF_IDX 15
 
 #define PROGRAM_START 0x200
-#define PROGRAM_END 0xFF
+#define PROGRAM_END RAM_SIZE
 
 #define SCREEN_WIDTH 128
 #define SCREEN_HEIGHT 64
+#define SCREEN_ROW_WORDS (SCREEN_WIDTH / 64)
 #define WINDOW_WIDTH 1024
 #define WINDOW_HEIGHT 512
 #define SCROLL_STEP 4
+#define NUM_PLANES 2                // XO-CHIP bitplanes, plane 0 is the classic screen
 
-#ifdef WIN32
-#define CPU_CLOCK_DELAY 1 //ms
-#else
-#define CPU_CLOCK_DELAY 1000 //us
-#endif
-
-#define CLOCK_DIV 9
+#define FRAME_RATE 60               // timers count down once per frame
+#define DEFAULT_SEED 0
+#define INSTRUCTIONS_PER_FRAME 16
 
 #define NUM_KEYS 16
 
+#define AUDIO_PATTERN_SIZE 16       // XO-CHIP audio pattern, 128 one bit samples
+#define DEFAULT_PITCH 64            // 4000 samples per second
+
 const static uint8_t FONT_SET[FONT_SET_SIZE] = {
         0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
         0x20, 0x60, 0x20, 0x20, 0x70, // 1
@@ -91,6 +103,34 @@ typedef struct {
 } opcode;
 
 
+/*
+* An instruction decoded once and cached per memory address. handler indexes
+* the interpreter dispatch table, 0 means the entry still has to be decoded.
+*/
+
+typedef struct {
+    uint8_t handler;
+    uint8_t x;
+    uint8_t y;
+    uint8_t n;
+    uint8_t kk;
+    uint16_t addr;
+} decoded_op;
+
+
+// why a context stopped on its own, it runs no further instructions until reset
+typedef enum {
+    FAULT_NONE = 0,
+    FAULT_BAD_OPCODE = 1,           // fault_opcode at fault_pc is not an instruction of any supported variant
+    FAULT_STACK = 2                 // the call at fault_pc found the stack full, or the return found it empty
+} FAULT;
+
+
+typedef struct jit_state jit_state;
+typedef struct aot_state aot_state;
+typedef struct movie movie;
+
+
 typedef struct {
     uint8_t mem[RAM_SIZE];
     uint16_t stack[STACK_SIZE];
@@ -104,23 +144,146 @@ typedef struct {
 
     uint8_t delay_timer;
     uint8_t sound_timer;
+    uint8_t pitch;                  // XO-CHIP pattern playback rate, 4000 * 2^((pitch - 64) / 48) Hz
+    uint8_t xo_audio;               // the guest loaded a pattern, play it instead of the beep
+    uint8_t audio_pattern[AUDIO_PATTERN_SIZE];
 
-    uint8_t screen[SCREEN_HEIGHT * SCREEN_WIDTH];
+    uint64_t seed;                  // restored on reset so a run can be replayed
+    uint64_t cycles;                // instructions run since init, skipped spins included
+    uint64_t rng;                   // xorshift64* state, never zero
+
+    // plane major, one bit per pixel, msb of word 0 is the leftmost
+    uint64_t screen[NUM_PLANES][SCREEN_HEIGHT][SCREEN_ROW_WORDS];
+    uint64_t dirty_rows;            // one bit per screen row changed since the last render
+    uint8_t planes;                 // XO-CHIP FN01, bit n set if drawing goes to plane n
 
     uint8_t keyboard[NUM_KEYS];
     uint8_t wait;
     uint8_t exit;
+    uint8_t fault;                  // FAULT, exit is set along with it
+    uint16_t fault_pc;
+    uint16_t fault_opcode;
     uint8_t draw;
+    uint8_t rewind;                 // host asked to step back through the rewind history
+    uint8_t spin_length;            // set by the engines when the guest spins, instructions per iteration
+    uint8_t idle;                   // the last frame ended spinning
     SCREEN_MODE screen_mode;
-    uint8_t step_cycles;
-    uint8_t debug;
+    QUIRK_PROFILE profile;          // how the opcodes the variants disagree on behave, see quirks.h
+
+    decoded_op decoded[RAM_SIZE];   // pre-decoded instruction cache, see interp.c
+    uint64_t mem_epoch;             // unique to every init, 0 is never used
+    uint64_t mem_stamp;             // bumped by every mem_written()
+    uint64_t page_stamp[NUM_PAGES]; // mem_stamp of the newest write to each page
+    jit_state* jit;                 // recompiled blocks, created on first use, see jit.c
+    aot_state* aot;                 // ahead-of-time compiled blocks, NULL unless a module was loaded, see aot.h
+    chip8_stats stats;              // hot path counters, see stats.h
+    trace_ring* trace;              // execution trace, NULL when not tracing, see trace.h
+    movie* movie;                   // input being recorded or replayed, NULL otherwise, see movie.h
 
 
 } chip8;
 
 
+// colour of a pixel, bit n is set if it is lit on plane n
+static inline uint8_t screen_pixel(const chip8* chip8_ctx, uint8_t x, uint8_t y){
+    uint8_t colour = 0;
+    for(int p = 0; p < NUM_PLANES; p++){
+        colour |= ((chip8_ctx->screen[p][y][x >> 6] >> (63 - (x & 63))) & 1) << p;
+    }
+    return colour;
+}
+
+// bytes taken by the instruction at pc, skips jump over F000 NNNN as a whole
+static inline uint16_t op_size(const chip8* chip8_ctx, uint16_t pc){
+    return chip8_ctx->mem[pc] == 0xF0 && chip8_ctx->mem[(pc + 1) & ADDR_MASK] == 0x00 ? LONG_OP_SIZE : OP_SIZE;
+}
+
+
+// random byte for CXKK, xorshift64* keeping the top bits of the product
+static inline uint8_t random_byte(chip8* chip8_ctx){
+    uint64_t x = chip8_ctx->rng;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    chip8_ctx->rng = x;
+    return (uint8_t)((x * 0x2545F4914F6CDD1DULL) >> 56);
+}
+
+// FX33, FX55 and FX65 at I, which may sit right below the end of memory. They wrap like every other access
+static inline void store_bcd(chip8* chip8_ctx, uint8_t value){
+    chip8_ctx->mem[chip8_ctx->I] = value / 100;
+    chip8_ctx->mem[(chip8_ctx->I + 1) & ADDR_MASK] = (value / 10) % 10;
+    chip8_ctx->mem[(chip8_ctx->I + 2) & ADDR_MASK] = value % 10;
+}
+
+static inline void store_registers(chip8* chip8_ctx, const uint8_t* v, uint8_t count){
+    if(chip8_ctx->I + count <= RAM_SIZE){
+        memcpy(chip8_ctx->mem + chip8_ctx->I, v, count);
+        return;
+    }
+    for(uint8_t i = 0; i < count; i++){
+        chip8_ctx->mem[(chip8_ctx->I + i) & ADDR_MASK] = v[i];
+    }
+}
+
+static inline void load_registers(const chip8* chip8_ctx, uint8_t* v, uint8_t count){
+    if(chip8_ctx->I + count <= RAM_SIZE){
+        memcpy(v, chip8_ctx->mem + chip8_ctx->I, count);
+        return;
+    }
+    for(uint8_t i = 0; i < count; i++){
+        v[i] = chip8_ctx->mem[(chip8_ctx->I + i) & ADDR_MASK];
+    }
+}
+
+
 void init_emulator(FILE* rom, chip8* chip8_ctx);
 
+// same as init_emulator with the program already in memory, anything past PROGRAM_END is dropped
+void init_emulator_rom(const uint8_t* rom, size_t size, chip8* chip8_ctx);
+
+// seed the random generator, the same seed and input give the same run
+void seed_random(chip8* chip8_ctx, uint64_t seed);
+
 void reset_emulator(chip8* chip8_ctx);
 
+// switch quirk profiles, blocks compiled for the old one are dropped. Loading a ROM resets it to PROFILE_DEFAULT
+void set_profile(chip8* chip8_ctx, QUIRK_PROFILE profile);
+
 void execute(chip8* chip8_ctx);
+
+/*
+* Recognise a guest busy-wait at a jump from pc to target: a jump to self or
+* an Fx07; 3xkk/4xkk; 1NNN loop polling the delay timer. FX0A with no key down
+* is flagged by wait_key(). Until the timers tick or a key changes another
+* pass through such a loop leaves the machine exactly as it was, so the
+* engines stop and let the caller skip whole iterations.
+*/
+void detect_spin(chip8* chip8_ctx, uint16_t pc, uint16_t target);
+
+// count the delay and sound timers down by one, called once per frame
+void tick_timers(chip8* chip8_ctx);
+
+uint64_t screen_hash(const chip8* chip8_ctx);
+
+// invalidate cached decodes and blocks overlapping a guest memory write and stamp its pages
+void mem_written(chip8* chip8_ctx, uint16_t addr, uint32_t size);
+
+// stop on an opcode no variant defines, pc is left on it. Reporting the fault is up to the host
+void unknown_opcode(chip8* chip8_ctx, uint16_t opcode);
+
+// stop on a call with all STACK_SIZE entries in use or a return with none, pc is left on it
+void stack_fault(chip8* chip8_ctx, uint16_t opcode);
+
+// instruction helpers shared by the execution engines
+void draw(chip8* chip8_ctx, uint8_t x, uint8_t y, uint8_t n);
+void wide_draw(chip8* chip8_ctx, uint8_t x, uint8_t y);
+// QUIRK_WRAP versions of the two above
+void draw_wrap(chip8* chip8_ctx, uint8_t x, uint8_t y, uint8_t n);
+void wide_draw_wrap(chip8* chip8_ctx, uint8_t x, uint8_t y);
+void clear_screen(chip8* chip8_ctx);
+void scroll_left(chip8 *chip8_ctx);
+void scroll_right(chip8 *chip8_ctx);
+void scroll_down(chip8* chip8_ctx, int n);
+void wait_key(chip8* chip8_ctx, uint8_t x);
+void load_audio_pattern(chip8* chip8_ctx);
@@ -0,0 +1,146 @@
+#include <string.h>
+
+#include "engine.h"
+#include "aot.h"
+#include "interp.h"
+#include "jit.h"
+#include "movie.h"
+
+static const char* ENGINE_NAMES[] = {
+        "ref",
+        "interp",
+        "jit",
+        "aot"
+};
+
+
+static uint32_t run_reference(chip8* chip8_ctx, uint32_t n){
+    for(uint32_t i = 0; i < n; i++){
+        execute(chip8_ctx);
+        if(chip8_ctx->fault){
+            return i;
+        }
+        if(chip8_ctx->spin_length){
+            return i + 1;
+        }
+    }
+    return n;
+}
+
+// step through execute() leaving a record of every instruction in the trace ring
+static uint32_t run_traced(chip8* chip8_ctx, uint32_t n){
+    trace_ring* trace = chip8_ctx->trace;
+    uint8_t before[NUM_REGISTERS];
+
+    for(uint32_t i = 0; i < n; i++){
+        // the record goes in first so an unknown opcode still shows up in the dump
+        trace_entry* e = &trace->entries[trace->count++ & trace->mask];
+        uint16_t pc = chip8_ctx->pc & ADDR_MASK;
+        e->cycle = trace->cycle++;
+        e->pc = pc;
+        e->opcode = chip8_ctx->mem[pc] << 8 | chip8_ctx->mem[(pc + 1) & ADDR_MASK];
+        e->I = chip8_ctx->I;
+        e->changed = 0;
+        memcpy(before, chip8_ctx->v, NUM_REGISTERS);
+
+        execute(chip8_ctx);
+
+        for(int r = 0; r < NUM_REGISTERS; r++){
+            e->changed |= (uint16_t)(chip8_ctx->v[r] != before[r]) << r;
+        }
+        e->I = chip8_ctx->I;
+        e->vx = chip8_ctx->v[(e->opcode >> 8) & 0xf];
+        e->vf = chip8_ctx->v[VF_IDX];
+        e->sp = (uint8_t)chip8_ctx->sp;
+        e->padding = 0;
+
+        if(chip8_ctx->fault){
+            return i;
+        }
+        if(chip8_ctx->spin_length){
+            return i + 1;
+        }
+    }
+    return n;
+}
+
+static uint32_t dispatch(ENGINE engine, chip8* chip8_ctx, uint32_t n){
+    if(chip8_ctx->trace){
+        return run_traced(chip8_ctx, n);
+    }
+    switch (engine) {
+        case ENGINE_INTERP:
+            return run_interpreter(chip8_ctx, n);
+        case ENGINE_JIT:
+            return run_jit(chip8_ctx, n);
+        case ENGINE_AOT:
+            return run_aot(chip8_ctx, n);
+        case ENGINE_REF:
+        default:
+            return run_reference(chip8_ctx, n);
+    }
+}
+
+uint32_t run_engine(ENGINE engine, chip8* chip8_ctx, uint32_t n){
+    uint32_t executed = 0;
+    uint32_t settled = 0;           // where the guest last saw the keyboard change
+    // a fault ends the run where it happened
+    while(executed < n && !chip8_ctx->fault){
+        uint32_t end = n;
+        if(chip8_ctx->movie){
+            // recorded input lands between instructions, never inside a skipped spin
+            uint8_t changed;
+            end = executed + movie_sync(chip8_ctx->movie, chip8_ctx, n - executed, &changed);
+            if(changed){
+                settled = executed;
+            }
+        }
+        chip8_ctx->spin_length = 0;
+        uint32_t done = dispatch(engine, chip8_ctx, end - executed);
+        executed += done;
+        chip8_ctx->cycles += done;
+        // only a loop that went all the way round since the last timer tick is known to be stuck
+        if(chip8_ctx->spin_length && executed - settled >= chip8_ctx->spin_length){
+            uint32_t rest = end - executed;
+            uint32_t skipped = rest - rest % chip8_ctx->spin_length;
+            executed += skipped;
+            chip8_ctx->cycles += skipped;
+            if(chip8_ctx->trace){
+                chip8_ctx->trace->cycle += skipped;
+            }
+            chip8_ctx->idle = 1;
+        }
+    }
+    chip8_ctx->spin_length = 0;
+    STAT_ADD(chip8_ctx, instructions, executed);
+    return executed;
+}
+
+uint32_t run_frame(ENGINE engine, chip8* chip8_ctx, uint32_t ipf){
+    chip8_ctx->idle = 0;
+    uint32_t executed = run_engine(engine, chip8_ctx, ipf);
+    tick_timers(chip8_ctx);
+    STAT_ADD(chip8_ctx, frames, 1);
+    return executed;
+}
+
+int parse_engine(const char* name, ENGINE* engine){
+    for(size_t i = 0; i < sizeof(ENGINE_NAMES) / sizeof(ENGINE_NAMES[0]); i++){
+        if(strcmp(name, ENGINE_NAMES[i]) == 0){
+            *engine = (ENGINE)i;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+const char* engine_name(ENGINE engine){
+    return ENGINE_NAMES[engine];
+}
+
+void free_engines(chip8* chip8_ctx){
+    jit_free(chip8_ctx->jit);
+    chip8_ctx->jit = NULL;
+    aot_free(chip8_ctx->aot);
+    chip8_ctx->aot = NULL;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "chip8.h"
+
+typedef enum {
+    ENGINE_REF = 0,                 // execute(), fetch and decode every instruction
+    ENGINE_INTERP = 1,              // pre-decoded threaded interpreter
+    ENGINE_JIT = 2,                 // x86-64 basic block recompiler
+    ENGINE_AOT = 3                  // blocks compiled ahead of time by chip8-aot, see aot.h
+} ENGINE;
+
+// run n instructions on the selected engine, returns the number executed. Whole iterations
+// of a guest busy-wait are skipped and counted as executed, setting chip8_ctx->idle
+uint32_t run_engine(ENGINE engine, chip8* chip8_ctx, uint32_t n);
+
+// run one frame worth of instructions then count the timers down, returns the number executed
+uint32_t run_frame(ENGINE engine, chip8* chip8_ctx, uint32_t ipf);
+
+// parse an engine name as given to --engine, returns 0 if it is not known
+int parse_engine(const char* name, ENGINE* engine);
+
+const char* engine_name(ENGINE engine);
+
+// release whatever per context state the engines built up
+void free_engines(chip8* chip8_ctx);
@@ -1,17 +1,28 @@
 #include "gfx.h"
+#include "utils.h"
 
 #include <stdlib.h>
 #include <stdio.h>
-#include <math.h>
+#include <string.h>
 
+#define PIXEL_ON 0xFFFFFFFF
+#define PIXEL_OFF 0x000000FF
 
-static void audio_callback(void *user_data, uint8_t *raw_buffer, int bytes);
+// indexed by pixel colour, bit n set if the pixel is lit on plane n
+static const uint32_t PALETTE[1 << NUM_PLANES] = {
+    PIXEL_OFF,
+    PIXEL_ON,
+    0x555555FF,                     // XO-CHIP plane 1 only
+    0xAAAAAAFF                      // XO-CHIP both planes
+};
+
+static void init_texture(GraphicsContext* ctx);
 
 void get_graphics_context(GraphicsContext* ctx){
 
     SDL_Init(SDL_INIT_EVERYTHING);
     ctx->window = SDL_CreateWindow(
-        "SUPER CHIP 1.1 EMULATOR",
+        WINDOW_TITLE,
         SDL_WINDOWPOS_CENTERED,
         SDL_WINDOWPOS_CENTERED,
         ctx->width * ctx->scale,
@@ -31,6 +42,13 @@ void get_graphics_context(GraphicsContext* ctx){
         exit(EXIT_FAILURE);
     }
 
+    ctx->renderer = NULL;
+    ctx->texture = NULL;
+    ctx->pixels = NULL;
+    ctx->target = NULL;
+}
+
+void init_renderer(GraphicsContext* ctx){
     ctx->renderer = SDL_CreateRenderer(ctx->window, -1, 0);
 
     if(ctx->renderer == NULL){
@@ -42,10 +60,56 @@ void get_graphics_context(GraphicsContext* ctx){
         exit(EXIT_FAILURE);
     }
 
+    init_texture(ctx);
+    SDL_SetRenderDrawColor(ctx->renderer, 0, 0, 0, 255);
+    SDL_RenderClear(ctx->renderer);
+    SDL_RenderPresent(ctx->renderer);
+}
+
+void free_renderer(GraphicsContext* ctx){
+    if(ctx->texture){
+        SDL_DestroyTexture(ctx->texture);
+    }
+    if(ctx->renderer){
+        SDL_DestroyRenderer(ctx->renderer);
+    }
+    free(ctx->pixels);
+    ctx->texture = NULL;
+    ctx->renderer = NULL;
+    ctx->pixels = NULL;
+}
+
+void get_offscreen_context(GraphicsContext* ctx){
+    ctx->window = NULL;
+    ctx->target = SDL_CreateRGBSurfaceWithFormat(0, ctx->width * ctx->scale, ctx->height * ctx->scale, 32, SDL_PIXELFORMAT_RGBA8888);
+    if(ctx->target == NULL){
+        printf(
+            "ERROR > Could not create offscreen surface \n"
+            "SDL_ERROR > %s \n",
+            SDL_GetError()
+        );
+        exit(EXIT_FAILURE);
+    }
+
+    ctx->renderer = SDL_CreateSoftwareRenderer(ctx->target);
+    if(ctx->renderer == NULL){
+        printf(
+            "ERROR > Could not create renderer \n"
+            "SDL_ERROR > %s \n",
+            SDL_GetError()
+        );
+        exit(EXIT_FAILURE);
+    }
+    init_texture(ctx);
+}
+
+static void init_texture(GraphicsContext* ctx){
+    // keep the pixels sharp when the texture is scaled up to the window
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "0");
     ctx->texture = SDL_CreateTexture(
         ctx->renderer,
         SDL_PIXELFORMAT_RGBA8888,
-        SDL_TEXTUREACCESS_TARGET,
+        SDL_TEXTUREACCESS_STREAMING,
         ctx->width,
         ctx->height
     );
@@ -59,65 +123,62 @@ void get_graphics_context(GraphicsContext* ctx){
         exit(EXIT_FAILURE);
     }
 
-    int sample_nr = 0;
-
-    SDL_AudioSpec spec;
-    SDL_zero(spec);
-
-    spec.freq = 44100; // number of samples per second
-    spec.format = AUDIO_S16SYS;
-    spec.channels = 2;
-    spec.samples = 2048; // buffer-size
-    spec.callback = audio_callback; // function SDL calls periodically to refill the buffer
-    spec.userdata = &sample_nr; // counter, keeping track of current sample number
-
-    SDL_AudioSpec get_spec;
-    ctx->audio_device = SDL_OpenAudioDevice(NULL, 0, &spec, NULL, 0);
-    if (ctx->audio_device == 0) {
-        printf(
-                "ERROR > Failed to open audio \n"
-                "SDL_ERROR > %s \n",
-                SDL_GetError()
-        );
+    ctx->pixels = malloc(ctx->width * ctx->height * sizeof(uint32_t));
+    if(ctx->pixels == NULL){
+        printf("ERROR > Could not allocate pixel buffer \n");
+        exit(EXIT_FAILURE);
     }
-
-    SDL_SetRenderDrawColor(ctx->renderer, 0, 0, 0, 255);
-    SDL_RenderClear(ctx->renderer);
-    SDL_RenderPresent(ctx->renderer);
+    for(int i = 0; i < ctx->width * ctx->height; i++){
+        ctx->pixels[i] = PIXEL_OFF;
+    }
+    SDL_UpdateTexture(ctx->texture, NULL, ctx->pixels, ctx->width * sizeof(uint32_t));
+    ctx->frame_hash = 0;
 }
 
-void render_graphics(GraphicsContext* g_ctx, const uint8_t* buffer){
-    SDL_SetRenderDrawColor(g_ctx->renderer, 0, 0, 0, 255);
-    SDL_RenderClear(g_ctx->renderer);
-    SDL_SetRenderDrawColor(g_ctx->renderer, 255, 255, 255, 255);
+int render_graphics(GraphicsContext* g_ctx, const uint64_t screen[NUM_PLANES][SCREEN_HEIGHT][SCREEN_ROW_WORDS], uint64_t dirty_rows){
+    // XOR redraws often cancel out, nothing to present if the content is unchanged
+    uint64_t hash = hash_bytes(screen, NUM_PLANES * SCREEN_HEIGHT * SCREEN_ROW_WORDS * sizeof(uint64_t));
+    if(hash == g_ctx->frame_hash){
+        return 0;
+    }
+    g_ctx->frame_hash = hash;
 
+    int first = -1, last = -1;
     for (int y = 0; y < g_ctx->height; y++) {
-        for (int x = 0; x < g_ctx->width; x++) {
-            if (buffer[x + (y * g_ctx->width)]) {
-                SDL_Rect rect;
-                rect.x = x * g_ctx->scale;
-                rect.y = y * g_ctx->scale;
-                rect.w = g_ctx->scale;
-                rect.h = g_ctx->scale;
-                SDL_RenderFillRect(g_ctx->renderer, &rect);
+        if(!(dirty_rows & (1ULL << y))){
+            continue;
+        }
+        // both planes of a row are combined into colours in a single pass
+        uint32_t* row = g_ctx->pixels + y * g_ctx->width;
+        for (int w = 0; w < SCREEN_ROW_WORDS && w * 64 < g_ctx->width; w++) {
+            uint64_t low = screen[0][y][w];
+            uint64_t high = screen[1][y][w];
+            for (int b = 63, x = w * 64; b >= 0 && x < g_ctx->width; b--, x++) {
+                row[x] = PALETTE[((low >> b) & 1) | (((high >> b) & 1) << 1)];
             }
         }
+        if(first < 0){
+            first = y;
+        }
+        last = y;
     }
-    SDL_RenderPresent(g_ctx->renderer);
-}
-
-static void audio_callback(void *user_data, uint8_t *raw_buffer, int bytes) {
-    double sample_rate = 44100.0, time;
-    int amplitude = 28000;
-
-    Sint16* buffer = (Sint16*) raw_buffer;
-    int length = bytes / 2; // 2 bytes per sample for AUDIO_S16SYS
-    int sample_nr = *(int*) user_data;
 
-    for (int i = 0; i < length; i++, sample_nr++) {
-        time = sample_nr / sample_rate;
-        buffer[i] = (Sint16)(amplitude * sin(2.0f * M_PI * 441.0f * time)); // render 441 HZ sine wave
+    if(first >= 0){
+        // upload only the band of rows that changed
+        SDL_Rect band = {0, first, g_ctx->width, last - first + 1};
+        uint8_t* dst;
+        int pitch;
+        if(SDL_LockTexture(g_ctx->texture, &band, (void**)&dst, &pitch) == 0){
+            for (int y = first; y <= last; y++) {
+                memcpy(dst + (y - first) * pitch, g_ctx->pixels + y * g_ctx->width, g_ctx->width * sizeof(uint32_t));
+            }
+            SDL_UnlockTexture(g_ctx->texture);
+        }
     }
+
+    SDL_RenderCopy(g_ctx->renderer, g_ctx->texture, NULL, NULL);
+    SDL_RenderPresent(g_ctx->renderer);
+    return 1;
 }
 
 void beep(){
@@ -127,8 +188,12 @@ void beep(){
 }
 
 void free_graphics(GraphicsContext* ctx){
-    SDL_DestroyWindow(ctx->window);
-    SDL_DestroyRenderer(ctx->renderer);
-    SDL_DestroyTexture(ctx->texture);
+    free_renderer(ctx);
+    if(ctx->window){
+        SDL_DestroyWindow(ctx->window);
+    }
+    if(ctx->target){
+        SDL_FreeSurface(ctx->target);
+    }
     SDL_Quit();
 }
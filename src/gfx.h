@@ -2,30 +2,17 @@
 
 #include <SDL.h>
 
-const static int KEYMAP[0x10] = {
-        SDLK_x, // 0
-        SDLK_1, // 1
-        SDLK_2, // 2
-        SDLK_3, // 3
-        SDLK_q, // 4
-        SDLK_w, // 5
-        SDLK_e, // 6
-        SDLK_a, // 7
-        SDLK_s, // 8
-        SDLK_d, // 9
-        SDLK_z, // A
-        SDLK_c, // B
-        SDLK_4, // C
-        SDLK_r, // D
-        SDLK_f, // E
-        SDLK_v  // F
-};
+#include "chip8.h"
+
+#define WINDOW_TITLE "SUPER CHIP 1.1 EMULATOR"
 
 typedef struct{
     SDL_Window* window;
     SDL_Renderer* renderer;
     SDL_Texture* texture;
-    SDL_AudioDeviceID audio_device;
+    SDL_Surface* target;            // offscreen render target, NULL when drawing to the window
+    uint32_t* pixels;               // native resolution copy of what the texture holds
+    uint64_t frame_hash;            // screen hash of the last presented frame
     int width;
     int height;
     int scale;
@@ -36,6 +23,15 @@ void free_graphics(GraphicsContext* ctx);
 
 void beep();
 
+// window only, the renderer is created separately by whichever thread draws
 void get_graphics_context(GraphicsContext* ctx);
 
-void render_graphics(GraphicsContext* g_ctx, const uint8_t* buffer);
\ No newline at end of file
+// renderer and texture for the window, only use them from the calling thread
+void init_renderer(GraphicsContext* ctx);
+void free_renderer(GraphicsContext* ctx);
+
+// software renderer drawing into a surface, no window, for benchmarks
+void get_offscreen_context(GraphicsContext* ctx);
+
+// returns 0 when the frame was skipped because nothing changed since the last one
+int render_graphics(GraphicsContext* g_ctx, const uint64_t screen[NUM_PLANES][SCREEN_HEIGHT][SCREEN_ROW_WORDS], uint64_t dirty_rows);
\ No newline at end of file
@@ -0,0 +1,23 @@
+#include "input.h"
+#include "utils.h"
+
+
+void sync_keys(chip8* chip8_ctx, const key_state* state){
+    uint64_t stamp_ns;
+    uint16_t keys = read_keys(state, &stamp_ns);
+    uint8_t changed = 0;
+    for(uint8_t k = 0; k < NUM_KEYS; k++){
+        uint8_t down = (keys >> k) & 1;
+        changed |= chip8_ctx->keyboard[k] ^ down;
+        chip8_ctx->keyboard[k] = down;
+    }
+    if(changed && STATS_ENABLED){
+        uint64_t now = time_ns();
+        uint64_t latency = now > stamp_ns ? now - stamp_ns : 0;
+        STAT_ADD(chip8_ctx, key_changes, 1);
+        STAT_ADD(chip8_ctx, key_latency_ns, latency);
+        if(latency > chip8_ctx->stats.key_latency_max_ns){
+            chip8_ctx->stats.key_latency_max_ns = latency;
+        }
+    }
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "atomics.h"
+#include "chip8.h"
+
+/*
+* Key state handed from the host input side to the core. The platform keeps one
+* bit per CHIP-8 key and publishes the whole mask with a single atomic store
+* whenever it changes, the core picks it up with sync_keys() at the start of
+* every host frame. Neither side ever blocks on the other, so input handling
+* can live on a different thread from emulation.
+*/
+
+typedef struct {
+    uint32_t keys;                  // bit n set while key n is held
+    uint64_t stamp_ns;              // host time of the newest key transition
+} key_state;
+
+static inline void publish_keys(key_state* state, uint16_t keys, uint64_t stamp_ns){
+    // the stamp goes first, a reader that sees the new mask sees at least this stamp
+    store_relaxed_u64(&state->stamp_ns, stamp_ns);
+    store_release_u32(&state->keys, keys);
+}
+
+static inline uint16_t read_keys(const key_state* state, uint64_t* stamp_ns){
+    uint16_t keys = (uint16_t)load_acquire_u32(&state->keys);
+    *stamp_ns = load_relaxed_u64(&state->stamp_ns);
+    return keys;
+}
+
+/*
+* Copy the published mask into the guest keyboard. When it changed, the time
+* since the transition reached the host is added to the key latency stats.
+*/
+void sync_keys(chip8* chip8_ctx, const key_state* state);
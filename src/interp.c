@@ -0,0 +1,300 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "interp.h"
+
+/*
+* Pre-decoded interpreter. Every address of mem gets a decoded_op the first
+* time it is executed, holding the handler to dispatch to and the operands
+* already extracted. Dispatch is threaded through computed goto where the
+* compiler supports it and falls back to a single flat switch otherwise.
+* Stores through FX33 and FX55 invalidate the overlapping entries only.
+*
+* Common idioms are fused while decoding: the first instruction of a pair or
+* triple gets a handler that runs the whole run without going back through
+* dispatch, reading the operands of the others from their own entries. Each
+* instruction of a fused run is still counted on its own and the run stops
+* wherever the budget does, so nothing outside can tell it was fused.
+*
+* The handlers live in interp_core.h, compiled into one function per quirk
+* profile. run_interpreter() picks the one for the context on every call.
+*/
+
+#if defined(__GNUC__) || defined(__clang__)
+#define USE_COMPUTED_GOTO
+#endif
+
+enum {
+    OP_DECODE = 0,
+    OP_SYS,
+    OP_SCD,
+    OP_CLS,
+    OP_RET,
+    OP_SCR,
+    OP_SCL,
+    OP_EXIT,
+    OP_LOW,
+    OP_HIGH,
+    OP_JP,
+    OP_CALL,
+    OP_SE_KK,
+    OP_SNE_KK,
+    OP_SE_XY,
+    OP_LD_KK,
+    OP_ADD_KK,
+    OP_LD_XY,
+    OP_OR,
+    OP_AND,
+    OP_XOR,
+    OP_ADD_XY,
+    OP_SUB,
+    OP_SHR,
+    OP_SUBN,
+    OP_SHL,
+    OP_SNE_XY,
+    OP_LD_I,
+    OP_JP_V0,
+    OP_RND,
+    OP_DRW,
+    OP_DRW0,
+    OP_SKP,
+    OP_SKNP,
+    OP_LD_X_DT,
+    OP_LD_KEY,
+    OP_LD_DT_X,
+    OP_LD_ST_X,
+    OP_ADD_I,
+    OP_LD_F,
+    OP_LD_HF,
+    OP_BCD,
+    OP_STORE,
+    OP_LOAD,
+    OP_SAVE_FLAGS,
+    OP_LOAD_FLAGS,
+    OP_AUDIO,
+    OP_PITCH,
+    OP_LD_I_LONG,
+    OP_PLANE,
+    OP_UNKNOWN,
+    // fused runs, see fuse(), in the order of FUSION_NAMES
+    OP_LD_KK_TIMER,                 // 6xkk; Fy15 or Fy18
+    OP_POLL_DT,                     // Fx07; 3ykk or 4ykk; 1NNN
+    OP_ADD_KK_SKIP,                 // 7xkk; 3ykk or 4ykk
+    OP_LD_I_DRW,                    // Annn; Dxyn
+    OP_LD_I_LOAD,                   // Annn; Fx65
+    NUM_HANDLERS
+};
+
+#define FIRST_FUSED OP_LD_KK_TIMER
+
+static const char* const FUSION_NAMES[] = {
+        "ld-timer",
+        "poll-dt",
+        "add-skip",
+        "ld-i-drw",
+        "ld-i-load"
+};
+
+typedef char fusion_names_match[(sizeof(FUSION_NAMES) / sizeof(FUSION_NAMES[0]) == NUM_FUSIONS
+                                 && NUM_HANDLERS - FIRST_FUSED == NUM_FUSIONS) ? 1 : -1];
+
+
+#ifdef CHIP8_STATS
+// opcode class (high nibble) of every handler, for the stats counters
+static const uint8_t HANDLER_CLASS[NUM_HANDLERS] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0,       // OP_DECODE .. OP_HIGH
+    0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7,  // OP_JP .. OP_ADD_KK
+    0x8, 0x8, 0x8, 0x8, 0x8, 0x8, 0x8, 0x8, 0x8,    // OP_LD_XY .. OP_SHL
+    0x9, 0xA, 0xB, 0xC, 0xD, 0xD,       // OP_SNE_XY .. OP_DRW0
+    0xE, 0xE,                           // OP_SKP, OP_SKNP
+    0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF,     // OP_LD_X_DT .. OP_LOAD_FLAGS
+    0xF, 0xF,                           // OP_AUDIO, OP_PITCH
+    0xF, 0xF,                           // OP_LD_I_LONG, OP_PLANE
+    0,                                  // OP_UNKNOWN
+    0x6, 0xF, 0x7, 0xA, 0xA             // fused runs, class of their first instruction
+};
+#endif
+
+static uint8_t decode_handler(uint16_t opcode){
+    uint8_t y = (opcode & 0x00f0) >> 4;
+    uint8_t n = opcode & 0xf;
+    uint8_t kk = opcode & 0xff;
+
+    switch (opcode >> 12) {
+        case 0:
+            switch (y) {
+                case 0x0: return OP_SYS;
+                case 0xC: return OP_SCD;
+                case 0xE:
+                    if(n == 0x0) return OP_CLS;
+                    if(n == 0xE) return OP_RET;
+                    return OP_UNKNOWN;
+                case 0xF:
+                    switch (n) {
+                        case 0xB: return OP_SCR;
+                        case 0xC: return OP_SCL;
+                        case 0xD: return OP_EXIT;
+                        case 0xE: return OP_LOW;
+                        case 0xF: return OP_HIGH;
+                        default: return OP_UNKNOWN;
+                    }
+                default: return OP_UNKNOWN;
+            }
+        case 1: return OP_JP;
+        case 2: return OP_CALL;
+        case 3: return OP_SE_KK;
+        case 4: return OP_SNE_KK;
+        case 5: return OP_SE_XY;
+        case 6: return OP_LD_KK;
+        case 7: return OP_ADD_KK;
+        case 8:
+            switch (n) {
+                case 0x0: return OP_LD_XY;
+                case 0x1: return OP_OR;
+                case 0x2: return OP_AND;
+                case 0x3: return OP_XOR;
+                case 0x4: return OP_ADD_XY;
+                case 0x5: return OP_SUB;
+                case 0x6: return OP_SHR;
+                case 0x7: return OP_SUBN;
+                case 0xE: return OP_SHL;
+                default: return OP_UNKNOWN;
+            }
+        case 9: return OP_SNE_XY;
+        case 0xA: return OP_LD_I;
+        case 0xB: return OP_JP_V0;
+        case 0xC: return OP_RND;
+        case 0xD: return n ? OP_DRW : OP_DRW0;
+        case 0xE:
+            if(kk == 0x9E) return OP_SKP;
+            if(kk == 0xA1) return OP_SKNP;
+            return OP_UNKNOWN;
+        case 0xF:
+            switch (kk) {
+                case 0x00: return (opcode == 0xF000) ? OP_LD_I_LONG : OP_UNKNOWN;
+                case 0x01: return OP_PLANE;
+                case 0x02: return (opcode == 0xF002) ? OP_AUDIO : OP_UNKNOWN;
+                case 0x07: return OP_LD_X_DT;
+                case 0x0A: return OP_LD_KEY;
+                case 0x15: return OP_LD_DT_X;
+                case 0x18: return OP_LD_ST_X;
+                case 0x1E: return OP_ADD_I;
+                case 0x29: return OP_LD_F;
+                case 0x30: return OP_LD_HF;
+                case 0x33: return OP_BCD;
+                case 0x55: return OP_STORE;
+                case 0x65: return OP_LOAD;
+                case 0x75: return OP_SAVE_FLAGS;
+                case 0x85: return OP_LOAD_FLAGS;
+                case 0x3A: return OP_PITCH;
+                default: return OP_UNKNOWN;
+            }
+        default:
+            return OP_UNKNOWN;
+    }
+}
+
+static void decode_one(chip8* chip8_ctx, uint16_t pc){
+    decoded_op* op = &chip8_ctx->decoded[pc];
+    uint16_t opcode = chip8_ctx->mem[pc] << 8 | chip8_ctx->mem[(pc + 1) & ADDR_MASK];
+
+    op->x = (opcode & 0x0f00) >> 8;
+    op->y = (opcode & 0x00f0) >> 4;
+    op->n = opcode & 0xf;
+    op->kk = opcode & 0xff;
+    op->addr = opcode & 0xfff;
+    op->handler = decode_handler(opcode);
+    if(op->handler == OP_LD_I_LONG){
+        // the address is the 16 bit word following the opcode
+        op->addr = chip8_ctx->mem[(pc + 2) & ADDR_MASK] << 8 | chip8_ctx->mem[(pc + 3) & ADDR_MASK];
+    }
+}
+
+// handler of the instruction at pc without touching its entry
+static uint8_t peek_handler(const chip8* chip8_ctx, uint16_t pc){
+    return decode_handler(chip8_ctx->mem[pc] << 8 | chip8_ctx->mem[pc + 1]);
+}
+
+/*
+* Give the entry at pc a fused handler if it starts one of the idioms. The
+* instructions after it are decoded here as the fused handler reads them from
+* their entries, none of them starts an idiom itself so nothing is lost by not
+* fusing them. mem_written() clears DECODE_SPAN bytes back from a store, so
+* an entry never outlives the ones it was fused with.
+*/
+static void fuse(chip8* chip8_ctx, uint16_t pc){
+    decoded_op* op = &chip8_ctx->decoded[pc];
+    uint8_t fused = 0;
+    uint8_t length = 2;
+
+    if(pc + DECODE_SPAN > RAM_SIZE){
+        return;
+    }
+    uint8_t next = peek_handler(chip8_ctx, pc + OP_SIZE);
+    switch (op->handler) {
+        case OP_LD_KK:
+            if(next == OP_LD_DT_X || next == OP_LD_ST_X) fused = OP_LD_KK_TIMER;
+            break;
+        case OP_LD_X_DT:
+            if((next == OP_SE_KK || next == OP_SNE_KK) && peek_handler(chip8_ctx, pc + 2 * OP_SIZE) == OP_JP){
+                fused = OP_POLL_DT;
+                length = 3;
+            }
+            break;
+        case OP_ADD_KK:
+            if(next == OP_SE_KK || next == OP_SNE_KK) fused = OP_ADD_KK_SKIP;
+            break;
+        case OP_LD_I:
+            if(next == OP_DRW) fused = OP_LD_I_DRW;
+            if(next == OP_LOAD) fused = OP_LD_I_LOAD;
+            break;
+    }
+    if(!fused){
+        return;
+    }
+    for(uint8_t i = 1; i < length; i++){
+        decode_one(chip8_ctx, pc + i * OP_SIZE);
+    }
+    op->handler = fused;
+}
+
+static void decode(chip8* chip8_ctx, uint16_t pc){
+    decode_one(chip8_ctx, pc);
+    fuse(chip8_ctx, pc);
+}
+
+const char* fusion_name(int fusion){
+    return FUSION_NAMES[fusion];
+}
+
+// one copy of the interpreter per quirk profile
+#define CORE_NAME run_default
+#define CORE_QUIRKS DEFAULT_QUIRKS
+#include "interp_core.h"
+
+#define CORE_NAME run_chip8
+#define CORE_QUIRKS CHIP8_QUIRKS
+#include "interp_core.h"
+
+#define CORE_NAME run_schip
+#define CORE_QUIRKS SCHIP_QUIRKS
+#include "interp_core.h"
+
+#define CORE_NAME run_xochip
+#define CORE_QUIRKS XOCHIP_QUIRKS
+#include "interp_core.h"
+
+// in QUIRK_PROFILE order
+static uint32_t (*const CORES[])(chip8* chip8_ctx, uint32_t n) = {
+        run_default,
+        run_chip8,
+        run_schip,
+        run_xochip
+};
+
+typedef char cores_match_profiles[(sizeof(CORES) / sizeof(CORES[0]) == NUM_PROFILES) ? 1 : -1];
+
+uint32_t run_interpreter(chip8* chip8_ctx, uint32_t n){
+    return CORES[chip8_ctx->profile](chip8_ctx, n);
+}
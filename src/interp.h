@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "chip8.h"
+
+// run up to n instructions through the pre-decoded interpreter, returns the number executed
+uint32_t run_interpreter(chip8* chip8_ctx, uint32_t n);
+
+// name of a fused instruction run as counted in chip8_stats.fusions, for reports
+const char* fusion_name(int fusion);
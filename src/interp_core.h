@@ -0,0 +1,403 @@
+/*
+* Body of the pre-decoded interpreter, interp.c includes it once per quirk
+* profile with CORE_NAME naming the function to define and CORE_QUIRKS the
+* quirks of the profile. Every quirk test in here is on that constant, so
+* each copy is left with the code of its own profile only. There is no
+* include guard on purpose.
+*/
+
+#define HAS(quirk) ((CORE_QUIRKS & (quirk)) != 0)
+#define DRAW(x, y, n) (HAS(QUIRK_WRAP) ? draw_wrap : draw)(chip8_ctx, x, y, n)
+#define WIDE_DRAW(x, y) (HAS(QUIRK_WRAP) ? wide_draw_wrap : wide_draw)(chip8_ctx, x, y)
+
+static uint32_t CORE_NAME(chip8* chip8_ctx, uint32_t n){
+    uint8_t* v = chip8_ctx->v;
+    uint16_t pc = chip8_ctx->pc;
+    uint32_t executed = 0;
+    decoded_op* op;
+    uint8_t v_x, v_y;
+    uint16_t wide_sum;
+
+    if(n == 0){
+        return 0;
+    }
+
+#ifdef USE_COMPUTED_GOTO
+    static const void* const dispatch_table[NUM_HANDLERS] = {
+        &&L_OP_DECODE, &&L_OP_SYS, &&L_OP_SCD, &&L_OP_CLS, &&L_OP_RET, &&L_OP_SCR,
+        &&L_OP_SCL, &&L_OP_EXIT, &&L_OP_LOW, &&L_OP_HIGH, &&L_OP_JP, &&L_OP_CALL,
+        &&L_OP_SE_KK, &&L_OP_SNE_KK, &&L_OP_SE_XY, &&L_OP_LD_KK, &&L_OP_ADD_KK,
+        &&L_OP_LD_XY, &&L_OP_OR, &&L_OP_AND, &&L_OP_XOR, &&L_OP_ADD_XY, &&L_OP_SUB,
+        &&L_OP_SHR, &&L_OP_SUBN, &&L_OP_SHL, &&L_OP_SNE_XY, &&L_OP_LD_I, &&L_OP_JP_V0,
+        &&L_OP_RND, &&L_OP_DRW, &&L_OP_DRW0, &&L_OP_SKP, &&L_OP_SKNP, &&L_OP_LD_X_DT,
+        &&L_OP_LD_KEY, &&L_OP_LD_DT_X, &&L_OP_LD_ST_X, &&L_OP_ADD_I, &&L_OP_LD_F,
+        &&L_OP_LD_HF, &&L_OP_BCD, &&L_OP_STORE, &&L_OP_LOAD, &&L_OP_SAVE_FLAGS,
+        &&L_OP_LOAD_FLAGS, &&L_OP_AUDIO, &&L_OP_PITCH, &&L_OP_LD_I_LONG, &&L_OP_PLANE,
+        &&L_OP_UNKNOWN, &&L_OP_LD_KK_TIMER, &&L_OP_POLL_DT, &&L_OP_ADD_KK_SKIP,
+        &&L_OP_LD_I_DRW, &&L_OP_LD_I_LOAD
+    };
+#define TARGET(name) L_##name:
+#define DISPATCH() goto *dispatch_table[op->handler]
+#else
+#define TARGET(name) case name:
+#define DISPATCH() goto dispatch
+#endif
+
+// count the instruction just executed and move on to the one at pc
+#define NEXT() do { \
+        STAT_ADD(chip8_ctx, op_class[HANDLER_CLASS[op->handler]], 1); \
+        if(++executed == n) goto done; \
+        op = &chip8_ctx->decoded[pc & ADDR_MASK]; \
+        DISPATCH(); \
+    } while(0)
+
+// count the instruction just executed and carry on with the next one of a fused run
+#define CHAIN() do { \
+        STAT_ADD(chip8_ctx, op_class[HANDLER_CLASS[op->handler]], 1); \
+        if(++executed == n) goto done; \
+        STAT_ADD(chip8_ctx, dispatches_saved, 1); \
+        op = &chip8_ctx->decoded[pc & ADDR_MASK]; \
+    } while(0)
+
+// step over the next instruction when cond holds, F000 NNNN is skipped whole
+#define SKIP(cond) do { \
+        pc += OP_SIZE; \
+        if(cond) pc += op_size(chip8_ctx, pc); \
+    } while(0)
+
+// hand a spinning guest back to the caller
+#define SPIN_CHECK() do { \
+        if(chip8_ctx->spin_length){ \
+            STAT_ADD(chip8_ctx, op_class[HANDLER_CLASS[op->handler]], 1); \
+            executed++; \
+            goto done; \
+        } \
+    } while(0)
+
+    op = &chip8_ctx->decoded[pc & ADDR_MASK];
+
+#ifndef USE_COMPUTED_GOTO
+dispatch:
+    switch (op->handler) {
+#endif
+    TARGET(OP_DECODE)
+        decode(chip8_ctx, pc & ADDR_MASK);
+        DISPATCH();
+    TARGET(OP_SYS)
+        // ignore old SYS opcode
+        pc += OP_SIZE;
+        NEXT();
+    TARGET(OP_SCD)
+        scroll_down(chip8_ctx, op->n);
+        pc += OP_SIZE;
+        NEXT();
+    TARGET(OP_CLS)
+        clear_screen(chip8_ctx);
+        pc += OP_SIZE;
+        NEXT();
+    TARGET(OP_RET)
+        if(chip8_ctx->sp == 0){
+            chip8_ctx->pc = pc;
+            stack_fault(chip8_ctx, 0x00EE);
+            goto done;
+        }
+        pc = chip8_ctx->stack[(--chip8_ctx->sp)] + OP_SIZE;
+        NEXT();
+    TARGET(OP_SCR)
+        scroll_right(chip8_ctx);
+        pc += OP_SIZE;
+        NEXT();
+    TARGET(OP_SCL)
+        scroll_left(chip8_ctx);
+        pc += OP_SIZE;
+        NEXT();
+    TARGET(OP_EXIT)
+        // exit interpreter, we will just reset instead
+        reset_emulator(chip8_ctx);
+        pc = chip8_ctx->pc;
+        NEXT();
+    TARGET(OP_LOW)
+        clear_screen(chip8_ctx);
+        chip8_ctx->screen_mode = LOW_RES64;
+        pc += OP_SIZE;
+        NEXT();
+    TARGET(OP_HIGH)
+        clear_screen(chip8_ctx);
+        chip8_ctx->screen_mode = HIGH_RES128;
+        pc += OP_SIZE;
+        NEXT();
+    TARGET(OP_JP)
+        if(op->addr == pc || op->addr + 2 * OP_SIZE == pc){
+            detect_spin(chip8_ctx, pc, op->addr);
+        }
+        pc = op->addr;
+        SPIN_CHECK();
+        NEXT();
+    TARGET(OP_CALL)
+        if(chip8_ctx->sp >= STACK_SIZE){
+            chip8_ctx->pc = pc;
+            stack_fault(chip8_ctx, 0x2000 | op->addr);
+            goto done;
+        }
+        chip8_ctx->stack[(chip8_ctx->sp++)] = pc;
+        pc = op->addr;
+        NEXT();
+    TARGET(OP_SE_KK)
+        SKIP(v[op->x] == op->kk);
+        NEXT();
+    TARGET(OP_SNE_KK)
+        SKIP(v[op->x] != op->kk);
+        NEXT();
+    TARGET(OP_SE_XY)
+        SKIP(v[op->x] == v[op->y]);
+        NEXT();
+    TARGET(OP_LD_KK)
+        v[op->x] = op->kk;
+        pc += OP_SIZE;
+        NEXT();
+    TARGET(OP_ADD_KK)
+        v[op->x] += op->kk;
+        pc += OP_SIZE;
+        NEXT();
+    TARGET(OP_LD_XY)
+        v[op->x] = v[op->y];
+        pc += OP_SIZE;
+        NEXT();
+    TARGET(OP_OR)
+        v[op->x] |= v[op->y];
+        pc += OP_SIZE;
+        NEXT();
+    TARGET(OP_AND)
+        v[op->x] &= v[op->y];
+        pc += OP_SIZE;
+        NEXT();
+    TARGET(OP_XOR)
+        v[op->x] ^= v[op->y];
+        pc += OP_SIZE;
+        NEXT();
+    TARGET(OP_ADD_XY)
+        wide_sum = (uint16_t)v[op->x] + (uint16_t)v[op->y];
+        v[VF_IDX] = wide_sum > 0xff;
+        v[op->x] = wide_sum & 0xff;
+        pc += OP_SIZE;
+        NEXT();
+    TARGET(OP_SUB)
+        v_x = v[op->x];
+        v_y = v[op->y];
+        v[VF_IDX] = v_x >= v_y;
+        v[op->x] = v_x - v_y;
+        pc += OP_SIZE;
+        NEXT();
+    TARGET(OP_SHR)
+        v_x = v[HAS(QUIRK_SHIFT_VY) ? op->y : op->x];
+        v[VF_IDX] = v_x & 1;
+        v[op->x] = v_x >> 1;
+        pc += OP_SIZE;
+        NEXT();
+    TARGET(OP_SUBN)
+        v_x = v[op->x];
+        v_y = v[op->y];
+        v[VF_IDX] = v_y >= v_x;
+        v[op->x] = v_y - v_x;
+        pc += OP_SIZE;
+        NEXT();
+    TARGET(OP_SHL)
+        v_x = v[HAS(QUIRK_SHIFT_VY) ? op->y : op->x];
+        v[VF_IDX] = v_x >> 7;
+        v[op->x] = v_x << 1;
+        pc += OP_SIZE;
+        NEXT();
+    TARGET(OP_SNE_XY)
+        SKIP(v[op->x] != v[op->y]);
+        NEXT();
+    TARGET(OP_LD_I)
+        chip8_ctx->I = op->addr;
+        pc += OP_SIZE;
+        NEXT();
+    TARGET(OP_JP_V0)
+        pc = op->addr + v[HAS(QUIRK_JUMP_VX) ? op->x : 0];
+        NEXT();
+    TARGET(OP_RND)
+        v[op->x] = random_byte(chip8_ctx) & op->kk;
+        pc += OP_SIZE;
+        NEXT();
+    TARGET(OP_DRW)
+        DRAW(op->x, op->y, op->n);
+        pc += OP_SIZE;
+        NEXT();
+    TARGET(OP_DRW0)
+        if(chip8_ctx->screen_mode == HIGH_RES128){
+            WIDE_DRAW(op->x, op->y);
+        }else{
+            DRAW(op->x, op->y, 0);
+        }
+        pc += OP_SIZE;
+        NEXT();
+    TARGET(OP_SKP)
+        SKIP(chip8_ctx->keyboard[v[op->x] & 0xf]);
+        NEXT();
+    TARGET(OP_SKNP)
+        SKIP(!chip8_ctx->keyboard[v[op->x] & 0xf]);
+        NEXT();
+    TARGET(OP_LD_X_DT)
+        v[op->x] = chip8_ctx->delay_timer;
+        pc += OP_SIZE;
+        NEXT();
+    TARGET(OP_LD_KEY)
+        chip8_ctx->pc = pc;
+        wait_key(chip8_ctx, op->x);
+        pc = chip8_ctx->pc;
+        SPIN_CHECK();
+        NEXT();
+    TARGET(OP_LD_DT_X)
+        chip8_ctx->delay_timer = v[op->x];
+        pc += OP_SIZE;
+        NEXT();
+    TARGET(OP_LD_ST_X)
+        chip8_ctx->sound_timer = v[op->x];
+        pc += OP_SIZE;
+        NEXT();
+    TARGET(OP_ADD_I)
+        v_x = v[op->x];
+        if(HAS(QUIRK_ADD_I_VF)){
+            v[VF_IDX] = !((0xFFFF - chip8_ctx->I) < v_x);
+        }
+        chip8_ctx->I += v_x;
+        pc += OP_SIZE;
+        NEXT();
+    TARGET(OP_LD_F)
+        chip8_ctx->I = v[op->x] * 5;
+        pc += OP_SIZE;
+        NEXT();
+    TARGET(OP_LD_HF)
+        chip8_ctx->I = FONT_SET_SIZE + v[op->x] * 10;
+        pc += OP_SIZE;
+        NEXT();
+    TARGET(OP_BCD)
+        v_x = v[op->x];
+        store_bcd(chip8_ctx, v_x);
+        mem_written(chip8_ctx, chip8_ctx->I, 3);
+        pc += OP_SIZE;
+        NEXT();
+    TARGET(OP_STORE)
+        store_registers(chip8_ctx, v, op->x + 1);
+        mem_written(chip8_ctx, chip8_ctx->I, op->x + 1);
+        if(HAS(QUIRK_MEMORY_I)){
+            chip8_ctx->I += op->x + 1;
+        }
+        pc += OP_SIZE;
+        NEXT();
+    TARGET(OP_LOAD)
+        load_registers(chip8_ctx, v, op->x + 1);
+        if(HAS(QUIRK_MEMORY_I)){
+            chip8_ctx->I += op->x + 1;
+        }
+        pc += OP_SIZE;
+        NEXT();
+    TARGET(OP_SAVE_FLAGS)
+        memcpy(chip8_ctx->flags, v, NUM_FLAGS);
+        pc += OP_SIZE;
+        NEXT();
+    TARGET(OP_LOAD_FLAGS)
+        memcpy(v, chip8_ctx->flags, NUM_FLAGS);
+        pc += OP_SIZE;
+        NEXT();
+    TARGET(OP_AUDIO)
+        load_audio_pattern(chip8_ctx);
+        pc += OP_SIZE;
+        NEXT();
+    TARGET(OP_PITCH)
+        chip8_ctx->pitch = v[op->x];
+        pc += OP_SIZE;
+        NEXT();
+    TARGET(OP_LD_I_LONG)
+        chip8_ctx->I = op->addr;
+        pc += LONG_OP_SIZE;
+        NEXT();
+    TARGET(OP_PLANE)
+        chip8_ctx->planes = op->x & ((1 << NUM_PLANES) - 1);
+        pc += OP_SIZE;
+        NEXT();
+    TARGET(OP_UNKNOWN)
+        chip8_ctx->pc = pc;
+        unknown_opcode(chip8_ctx, chip8_ctx->mem[pc & ADDR_MASK] << 8 | chip8_ctx->mem[(pc + 1) & ADDR_MASK]);
+        goto done;
+    TARGET(OP_LD_KK_TIMER)
+        STAT_ADD(chip8_ctx, fusions[op->handler - FIRST_FUSED], 1);
+        v[op->x] = op->kk;
+        pc += OP_SIZE;
+        CHAIN();
+        if(op->handler == OP_LD_DT_X){
+            chip8_ctx->delay_timer = v[op->x];
+        }else{
+            chip8_ctx->sound_timer = v[op->x];
+        }
+        pc += OP_SIZE;
+        NEXT();
+    TARGET(OP_POLL_DT)
+        STAT_ADD(chip8_ctx, fusions[op->handler - FIRST_FUSED], 1);
+        v[op->x] = chip8_ctx->delay_timer;
+        pc += OP_SIZE;
+        CHAIN();
+        if((v[op->x] == op->kk) == (op->handler == OP_SE_KK)){
+            // stepped over the jump
+            SKIP(1);
+            NEXT();
+        }
+        pc += OP_SIZE;
+        CHAIN();
+        if(op->addr == pc || op->addr + 2 * OP_SIZE == pc){
+            detect_spin(chip8_ctx, pc, op->addr);
+        }
+        pc = op->addr;
+        SPIN_CHECK();
+        NEXT();
+    TARGET(OP_ADD_KK_SKIP)
+        STAT_ADD(chip8_ctx, fusions[op->handler - FIRST_FUSED], 1);
+        v[op->x] += op->kk;
+        pc += OP_SIZE;
+        CHAIN();
+        SKIP((v[op->x] == op->kk) == (op->handler == OP_SE_KK));
+        NEXT();
+    TARGET(OP_LD_I_DRW)
+        STAT_ADD(chip8_ctx, fusions[op->handler - FIRST_FUSED], 1);
+        chip8_ctx->I = op->addr;
+        pc += OP_SIZE;
+        CHAIN();
+        DRAW(op->x, op->y, op->n);
+        pc += OP_SIZE;
+        NEXT();
+    TARGET(OP_LD_I_LOAD)
+        STAT_ADD(chip8_ctx, fusions[op->handler - FIRST_FUSED], 1);
+        chip8_ctx->I = op->addr;
+        pc += OP_SIZE;
+        CHAIN();
+        load_registers(chip8_ctx, v, op->x + 1);
+        if(HAS(QUIRK_MEMORY_I)){
+            chip8_ctx->I += op->x + 1;
+        }
+        pc += OP_SIZE;
+        NEXT();
+#ifndef USE_COMPUTED_GOTO
+        default:
+            goto done;
+    }
+#endif
+
+done:
+    chip8_ctx->pc = pc;
+    return executed;
+
+#undef NEXT
+#undef CHAIN
+#undef SKIP
+#undef SPIN_CHECK
+#undef DISPATCH
+#undef TARGET
+}
+
+#undef HAS
+#undef DRAW
+#undef WIDE_DRAW
+#undef CORE_NAME
+#undef CORE_QUIRKS
@@ -0,0 +1,626 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "chip8.h"
+#include "interp.h"
+#include "jit.h"
+
+/*
+* Basic block recompiler to x86-64.
+*
+* A block is a straight run of guest instructions starting at some address.
+* It ends after a jump, call, return, skip, DXYN, FX0A or a store to memory
+* (FX33/FX55), or before an opcode the interpreter would reject. Guest state
+* stays in the chip8 struct, the block keeps the context pointer in rbx and
+* the instruction budget of the current call in ebp. Simple ALU, load and
+* skip opcodes are emitted inline, everything else is handed to execute()
+* with pc pointing at the instruction so both engines share one definition
+* of the more involved opcodes. The quirks of the context's profile are
+* looked at while emitting, set_profile() drops the blocks built before.
+*
+* Before every instruction but the first the block compares the budget with
+* the number of instructions done so far and leaves early if it is spent, so
+* callers get exactly the instruction count they asked for.
+*/
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define JIT_X64
+#endif
+
+#ifdef JIT_X64
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#define CODE_SIZE (1 << 20)
+#define MAX_BLOCKS 4096
+#define MAX_BLOCK_OPS 64
+#define MAX_BLOCK_BYTES 8192        // upper bound of the code emitted for one block
+
+typedef uint32_t (*block_fn)(chip8* chip8_ctx, uint32_t budget);
+
+typedef struct {
+    block_fn code;
+    uint16_t start;                 // guest byte range [start, end)
+    uint16_t end;
+    uint16_t length;                // instructions in the block
+} jit_block;
+
+struct jit_state {
+    uint8_t* code;
+    size_t code_used;
+    jit_block blocks[MAX_BLOCKS];
+    size_t num_blocks;
+    jit_block* block_at[RAM_SIZE];
+    uint8_t covered[RAM_SIZE];      // set when some block was compiled from this byte
+};
+
+typedef struct {
+    uint8_t* start;
+    uint8_t* at;
+} emitter;
+
+#define CTX_OFF(field) ((uint32_t)offsetof(chip8, field))
+#define V_OFF(reg) (CTX_OFF(v) + (reg))
+
+// modrm byte for [rbx + disp32] with the given register field
+#define MODRM_RBX(reg) (0x80 | ((reg) << 3) | 3)
+
+enum { AL = 0, CL = 1 };
+
+
+static void emit8(emitter* e, uint8_t byte){
+    *e->at++ = byte;
+}
+
+static void emit16(emitter* e, uint16_t value){
+    memcpy(e->at, &value, 2);
+    e->at += 2;
+}
+
+static void emit32(emitter* e, uint32_t value){
+    memcpy(e->at, &value, 4);
+    e->at += 4;
+}
+
+static void emit64(emitter* e, uint64_t value){
+    memcpy(e->at, &value, 8);
+    e->at += 8;
+}
+
+// <op> reg8, byte [rbx + off] or byte [rbx + off], reg8 depending on the opcode
+static void emit_mem8(emitter* e, uint8_t opcode, uint8_t reg, uint32_t off){
+    emit8(e, opcode);
+    emit8(e, MODRM_RBX(reg));
+    emit32(e, off);
+}
+
+static void emit_load_al(emitter* e, uint32_t off){
+    emit_mem8(e, 0x8A, AL, off);
+}
+
+static void emit_store_al(emitter* e, uint32_t off){
+    emit_mem8(e, 0x88, AL, off);
+}
+
+static void emit_store_cl(emitter* e, uint32_t off){
+    emit_mem8(e, 0x88, CL, off);
+}
+
+// movzx eax, byte [rbx + off]
+static void emit_movzx_eax(emitter* e, uint32_t off){
+    emit8(e, 0x0F);
+    emit_mem8(e, 0xB6, AL, off);
+}
+
+// mov byte [rbx + off], imm8
+static void emit_store_imm8(emitter* e, uint32_t off, uint8_t value){
+    emit_mem8(e, 0xC6, 0, off);
+    emit8(e, value);
+}
+
+// mov word [rbx + off], imm16
+static void emit_store_imm16(emitter* e, uint32_t off, uint16_t value){
+    emit8(e, 0x66);
+    emit_mem8(e, 0xC7, 0, off);
+    emit16(e, value);
+}
+
+// mov word [rbx + off], ax
+static void emit_store_ax(emitter* e, uint32_t off){
+    emit8(e, 0x66);
+    emit_mem8(e, 0x89, AL, off);
+}
+
+static void emit_set_pc(emitter* e, uint16_t pc){
+    emit_store_imm16(e, CTX_OFF(pc), pc);
+}
+
+// mov eax, imm32
+static void emit_mov_eax(emitter* e, uint32_t value){
+    emit8(e, 0xB8);
+    emit32(e, value);
+}
+
+// jmp rel32 / jcc rel32, returns the position of the displacement to patch
+static uint8_t* emit_jump(emitter* e, uint8_t cc){
+    if(cc){
+        emit8(e, 0x0F);
+        emit8(e, cc);
+    }else{
+        emit8(e, 0xE9);
+    }
+    uint8_t* fixup = e->at;
+    emit32(e, 0);
+    return fixup;
+}
+
+static void patch_jump(uint8_t* fixup, const uint8_t* target){
+    int32_t rel = (int32_t)(target - (fixup + 4));
+    memcpy(fixup, &rel, 4);
+}
+
+static void emit_prologue(emitter* e){
+    emit8(e, 0x53);                                     // push rbx
+    emit8(e, 0x55);                                     // push rbp
+    emit8(e, 0x48); emit8(e, 0x83); emit8(e, 0xEC); emit8(e, 0x28);  // sub rsp, 40
+#ifdef WIN32
+    emit8(e, 0x48); emit8(e, 0x89); emit8(e, 0xCB);     // mov rbx, rcx
+    emit8(e, 0x89); emit8(e, 0xD5);                     // mov ebp, edx
+#else
+    emit8(e, 0x48); emit8(e, 0x89); emit8(e, 0xFB);     // mov rbx, rdi
+    emit8(e, 0x89); emit8(e, 0xF5);                     // mov ebp, esi
+#endif
+}
+
+static void emit_epilogue(emitter* e){
+    emit8(e, 0x48); emit8(e, 0x83); emit8(e, 0xC4); emit8(e, 0x28);  // add rsp, 40
+    emit8(e, 0x5D);                                     // pop rbp
+    emit8(e, 0x5B);                                     // pop rbx
+    emit8(e, 0xC3);                                     // ret
+}
+
+// execute(chip8_ctx) for the instruction at pc
+static void emit_execute(emitter* e, uint16_t pc){
+    emit_set_pc(e, pc);
+    emit8(e, 0x48); emit8(e, 0xB8);                     // mov rax, imm64
+    emit64(e, (uint64_t)(uintptr_t)&execute);
+#ifdef WIN32
+    emit8(e, 0x48); emit8(e, 0x89); emit8(e, 0xD9);     // mov rcx, rbx
+#else
+    emit8(e, 0x48); emit8(e, 0x89); emit8(e, 0xDF);     // mov rdi, rbx
+#endif
+    emit8(e, 0xFF); emit8(e, 0xD0);                     // call rax
+}
+
+// detect_spin(chip8_ctx, pc, target)
+static void emit_detect_spin(emitter* e, uint16_t pc, uint16_t target){
+    emit8(e, 0x48); emit8(e, 0xB8);                     // mov rax, imm64
+    emit64(e, (uint64_t)(uintptr_t)&detect_spin);
+#ifdef WIN32
+    emit8(e, 0x48); emit8(e, 0x89); emit8(e, 0xD9);     // mov rcx, rbx
+    emit8(e, 0xBA); emit32(e, pc);                      // mov edx, pc
+    emit8(e, 0x41); emit8(e, 0xB8); emit32(e, target);  // mov r8d, target
+#else
+    emit8(e, 0x48); emit8(e, 0x89); emit8(e, 0xDF);     // mov rdi, rbx
+    emit8(e, 0xBE); emit32(e, pc);                      // mov esi, pc
+    emit8(e, 0xBA); emit32(e, target);                  // mov edx, target
+#endif
+    emit8(e, 0xFF); emit8(e, 0xD0);                     // call rax
+}
+
+// pc = target when skipping, flags must hold the comparison, cc_no_skip jumps over the skip
+static void emit_skip(emitter* e, uint16_t target, uint8_t cc_no_skip){
+    emit8(e, cc_no_skip);
+    emit8(e, 9);                                        // length of the store below
+    emit_set_pc(e, target);
+}
+
+typedef enum {
+    KIND_INVALID,                   // not part of any block, left to the interpreter
+    KIND_INLINE,
+    KIND_INLINE_END,
+    KIND_HELPER,
+    KIND_HELPER_END
+} op_kind;
+
+static op_kind classify(uint16_t opcode){
+    uint8_t y = (opcode & 0x00f0) >> 4;
+    uint8_t n = opcode & 0xf;
+    uint8_t kk = opcode & 0xff;
+
+    switch (opcode >> 12) {
+        case 0:
+            if(y == 0x0) return KIND_INLINE;
+            if(y == 0xC) return KIND_HELPER;
+            if(y == 0xE && n == 0x0) return KIND_HELPER;
+            if(y == 0xE && n == 0xE) return KIND_HELPER_END;
+            if(y == 0xF && (n == 0xB || n == 0xC || n == 0xE || n == 0xF)) return KIND_HELPER;
+            if(y == 0xF && n == 0xD) return KIND_HELPER_END;
+            return KIND_INVALID;
+        case 1:
+        case 3:
+        case 4:
+        case 5:
+        case 9:
+            return KIND_INLINE_END;
+        case 2:
+        case 0xB:
+        case 0xD:
+            return KIND_HELPER_END;
+        case 6:
+        case 7:
+        case 0xA:
+            return KIND_INLINE;
+        case 8:
+            return (n <= 7 || n == 0xE) ? KIND_INLINE : KIND_INVALID;
+        case 0xC:
+            return KIND_HELPER;
+        case 0xE:
+            return (kk == 0x9E || kk == 0xA1) ? KIND_HELPER_END : KIND_INVALID;
+        case 0xF:
+            switch (kk) {
+                case 0x07:
+                case 0x15:
+                case 0x18:
+                case 0x1E:
+                case 0x29:
+                case 0x30:
+                    return KIND_INLINE;
+                case 0x01:
+                case 0x65:
+                case 0x75:
+                case 0x85:
+                case 0x3A:
+                    return KIND_HELPER;
+                case 0x00:
+                    return opcode == 0xF000 ? KIND_HELPER : KIND_INVALID;
+                case 0x02:
+                    return opcode == 0xF002 ? KIND_HELPER : KIND_INVALID;
+                case 0x0A:
+                case 0x33:
+                case 0x55:
+                    return KIND_HELPER_END;
+                default:
+                    return KIND_INVALID;
+            }
+        default:
+            return KIND_INVALID;
+    }
+}
+
+// next_size is the length of the instruction after pc, the one a skip steps over, quirks those of the profile
+static void emit_inline(emitter* e, uint16_t pc, uint16_t opcode, uint16_t next_size, uint8_t quirks){
+    uint8_t x = (opcode & 0x0f00) >> 8;
+    uint8_t y = (opcode & 0x00f0) >> 4;
+    uint8_t n = opcode & 0xf;
+    uint8_t kk = opcode & 0xff;
+
+    switch (opcode >> 12) {
+        case 0:
+            // ignore old SYS opcode
+            break;
+        case 1:
+            if((opcode & 0xfff) == pc){
+                emit_store_imm8(e, CTX_OFF(spin_length), 1);
+            }else if((opcode & 0xfff) + 2 * OP_SIZE == pc){
+                emit_detect_spin(e, pc, opcode & 0xfff);
+            }
+            emit_set_pc(e, opcode & 0xfff);
+            break;
+        case 3:
+        case 4:
+            emit_set_pc(e, pc + OP_SIZE);
+            emit_mem8(e, 0x80, 7, V_OFF(x));            // cmp byte [vx], kk
+            emit8(e, kk);
+            emit_skip(e, pc + OP_SIZE + next_size, (opcode >> 12) == 3 ? 0x75 : 0x74);
+            break;
+        case 5:
+        case 9:
+            emit_set_pc(e, pc + OP_SIZE);
+            emit_load_al(e, V_OFF(x));
+            emit_mem8(e, 0x3A, AL, V_OFF(y));           // cmp al, [vy]
+            emit_skip(e, pc + OP_SIZE + next_size, (opcode >> 12) == 5 ? 0x75 : 0x74);
+            break;
+        case 6:
+            emit_store_imm8(e, V_OFF(x), kk);
+            break;
+        case 7:
+            emit_mem8(e, 0x80, 0, V_OFF(x));            // add byte [vx], kk
+            emit8(e, kk);
+            break;
+        case 8:
+            switch (n) {
+                case 0:
+                    emit_load_al(e, V_OFF(y));
+                    emit_store_al(e, V_OFF(x));
+                    break;
+                case 1:
+                case 2:
+                case 3:
+                    emit_load_al(e, V_OFF(x));
+                    emit_mem8(e, n == 1 ? 0x0A : n == 2 ? 0x22 : 0x32, AL, V_OFF(y));
+                    emit_store_al(e, V_OFF(x));
+                    break;
+                case 4:
+                    emit_load_al(e, V_OFF(x));
+                    emit_mem8(e, 0x02, AL, V_OFF(y));   // add al, [vy]
+                    emit8(e, 0x0F); emit8(e, 0x92); emit8(e, 0xC1);  // setc cl
+                    emit_store_cl(e, V_OFF(VF_IDX));
+                    emit_store_al(e, V_OFF(x));
+                    break;
+                case 5:
+                case 7:
+                    emit_load_al(e, V_OFF(n == 5 ? x : y));
+                    emit_mem8(e, 0x2A, AL, V_OFF(n == 5 ? y : x));   // sub al, [..]
+                    emit8(e, 0x0F); emit8(e, 0x93); emit8(e, 0xC1);  // setnc cl
+                    emit_store_cl(e, V_OFF(VF_IDX));
+                    emit_store_al(e, V_OFF(x));
+                    break;
+                case 6:
+                    emit_load_al(e, V_OFF((quirks & QUIRK_SHIFT_VY) ? y : x));
+                    emit8(e, 0x88); emit8(e, 0xC1);                  // mov cl, al
+                    emit8(e, 0x80); emit8(e, 0xE1); emit8(e, 0x01);  // and cl, 1
+                    emit8(e, 0xD0); emit8(e, 0xE8);                  // shr al, 1
+                    emit_store_cl(e, V_OFF(VF_IDX));
+                    emit_store_al(e, V_OFF(x));
+                    break;
+                case 0xE:
+                    emit_load_al(e, V_OFF((quirks & QUIRK_SHIFT_VY) ? y : x));
+                    emit8(e, 0x88); emit8(e, 0xC1);                  // mov cl, al
+                    emit8(e, 0xC0); emit8(e, 0xE9); emit8(e, 0x07);  // shr cl, 7
+                    emit8(e, 0xD0); emit8(e, 0xE0);                  // shl al, 1
+                    emit_store_cl(e, V_OFF(VF_IDX));
+                    emit_store_al(e, V_OFF(x));
+                    break;
+            }
+            break;
+        case 0xA:
+            emit_store_imm16(e, CTX_OFF(I), opcode & 0xfff);
+            break;
+        case 0xF:
+            switch (kk) {
+                case 0x07:
+                    emit_load_al(e, CTX_OFF(delay_timer));
+                    emit_store_al(e, V_OFF(x));
+                    break;
+                case 0x15:
+                case 0x18:
+                    emit_load_al(e, V_OFF(x));
+                    emit_store_al(e, kk == 0x15 ? CTX_OFF(delay_timer) : CTX_OFF(sound_timer));
+                    break;
+                case 0x1E:
+                    emit_movzx_eax(e, V_OFF(x));
+                    emit8(e, 0x66);
+                    emit_mem8(e, 0x01, AL, CTX_OFF(I));              // add word [I], ax
+                    if(quirks & QUIRK_ADD_I_VF){
+                        emit8(e, 0x0F); emit8(e, 0x93); emit8(e, 0xC1);  // setnc cl
+                        emit_store_cl(e, V_OFF(VF_IDX));
+                    }
+                    break;
+                case 0x29:
+                case 0x30:
+                    emit_movzx_eax(e, V_OFF(x));
+                    emit8(e, 0x8D); emit8(e, 0x04); emit8(e, 0x80);  // lea eax, [rax + rax * 4]
+                    if(kk == 0x30){
+                        emit8(e, 0x01); emit8(e, 0xC0);              // add eax, eax
+                        emit8(e, 0x83); emit8(e, 0xC0); emit8(e, FONT_SET_SIZE);  // add eax, imm8
+                    }
+                    emit_store_ax(e, CTX_OFF(I));
+                    break;
+            }
+            break;
+    }
+}
+
+static void flush(jit_state* jit){
+    jit->code_used = 0;
+    jit->num_blocks = 0;
+    memset(jit->block_at, 0, sizeof(jit->block_at));
+    memset(jit->covered, 0, sizeof(jit->covered));
+}
+
+static jit_block* compile(jit_state* jit, chip8* chip8_ctx, uint16_t start){
+    if(jit->num_blocks == MAX_BLOCKS || jit->code_used + MAX_BLOCK_BYTES > CODE_SIZE){
+        flush(jit);
+    }
+
+    emitter e = {jit->code + jit->code_used, jit->code + jit->code_used};
+    uint8_t* exits[MAX_BLOCK_OPS];
+    uint16_t pcs[MAX_BLOCK_OPS];
+    uint16_t pc = start;
+    uint16_t end;
+    uint16_t length = 0;
+    op_kind kind = KIND_INVALID;
+
+    emit_prologue(&e);
+
+    // stop short of the top of memory so pc and the block end never wrap
+    while(length < MAX_BLOCK_OPS && pc + 2 * LONG_OP_SIZE <= RAM_SIZE){
+        uint16_t opcode = chip8_ctx->mem[pc] << 8 | chip8_ctx->mem[pc + 1];
+        kind = classify(opcode);
+        if(kind == KIND_INVALID){
+            break;
+        }
+
+        if(length > 0){
+            // leave once the budget is spent
+            emit8(&e, 0x81); emit8(&e, 0xFD); emit32(&e, length);   // cmp ebp, length
+            exits[length] = emit_jump(&e, 0x84);                     // je exit
+        }
+        pcs[length] = pc;
+
+        if(kind == KIND_INLINE || kind == KIND_INLINE_END){
+#ifdef CHIP8_STATS
+            // helpers count themselves in execute()
+            emit8(&e, 0x48);
+            emit_mem8(&e, 0x83, 0, CTX_OFF(stats.op_class) + (opcode >> 12) * 8);
+            emit8(&e, 1);                                            // add qword [class], 1
+#endif
+            emit_inline(&e, pc, opcode, op_size(chip8_ctx, pc + OP_SIZE), PROFILE_QUIRKS[chip8_ctx->profile]);
+        }else{
+            emit_execute(&e, pc);
+        }
+        length++;
+        pc += op_size(chip8_ctx, pc);
+
+        if(kind == KIND_INLINE_END || kind == KIND_HELPER_END){
+            break;
+        }
+    }
+
+    if(length == 0){
+        // the interpreter reports the bad opcode
+        return NULL;
+    }
+
+    end = pc;
+    if(kind != KIND_INLINE_END && kind != KIND_HELPER_END){
+        // fell off the end of the block, continue after the last instruction
+        emit_set_pc(&e, pc);
+    }else if(kind == KIND_INLINE_END){
+        // an inline skip baked in the size of the next instruction, cover its opcode
+        end += OP_SIZE;
+    }
+    emit_mov_eax(&e, length);
+    uint8_t* done = emit_jump(&e, 0);
+
+    // early exits, resume at the first instruction not executed
+    for(uint16_t i = 1; i < length; i++){
+        patch_jump(exits[i], e.at);
+        emit_set_pc(&e, pcs[i]);
+        emit_mov_eax(&e, i);
+        exits[i] = emit_jump(&e, 0);
+    }
+    for(uint16_t i = 1; i < length; i++){
+        patch_jump(exits[i], e.at);
+    }
+    patch_jump(done, e.at);
+    emit_epilogue(&e);
+
+    jit_block* block = &jit->blocks[jit->num_blocks++];
+    block->code = (block_fn)(void*)e.start;
+    block->start = start;
+    block->end = end;
+    block->length = length;
+    jit->block_at[start] = block;
+    memset(jit->covered + start, 1, end - start);
+    jit->code_used += e.at - e.start;
+    return block;
+}
+
+jit_state* jit_create(void){
+    jit_state* jit = calloc(1, sizeof(jit_state));
+    if(!jit){
+        return NULL;
+    }
+#ifdef WIN32
+    jit->code = VirtualAlloc(NULL, CODE_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+#else
+    jit->code = mmap(NULL, CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(jit->code == MAP_FAILED){
+        jit->code = NULL;
+    }
+#endif
+    if(!jit->code){
+        free(jit);
+        return NULL;
+    }
+    return jit;
+}
+
+void jit_free(jit_state* jit){
+    if(!jit){
+        return;
+    }
+#ifdef WIN32
+    VirtualFree(jit->code, 0, MEM_RELEASE);
+#else
+    munmap(jit->code, CODE_SIZE);
+#endif
+    free(jit);
+}
+
+void jit_invalidate(jit_state* jit, uint16_t addr, uint32_t size){
+    uint8_t hit = 0;
+    for(uint32_t i = 0; i < size; i++){
+        hit |= jit->covered[(addr + i) & ADDR_MASK];
+    }
+    if(!hit){
+        return;
+    }
+    for(size_t b = 0; b < jit->num_blocks; b++){
+        jit_block* block = &jit->blocks[b];
+        if(block->length && addr < block->end && addr + size > block->start){
+            if(jit->block_at[block->start] == block){
+                jit->block_at[block->start] = NULL;
+            }
+            block->length = 0;
+        }
+    }
+}
+
+uint8_t jit_available(void){
+    return 1;
+}
+
+uint32_t run_jit(chip8* chip8_ctx, uint32_t n){
+    jit_state* jit = chip8_ctx->jit;
+    uint32_t executed = 0;
+
+    if(!jit){
+        jit = chip8_ctx->jit = jit_create();
+        if(!jit){
+            return run_interpreter(chip8_ctx, n);
+        }
+    }
+
+    while(executed < n){
+        uint16_t pc = chip8_ctx->pc;
+        jit_block* block = jit->block_at[pc];
+        if(!block){
+            block = compile(jit, chip8_ctx, pc);
+        }
+        if(block){
+            executed += block->code(chip8_ctx, n - executed);
+            // a call or return that faulted ends its block through execute(), it did not run
+            executed -= chip8_ctx->fault != 0;
+        }else{
+            executed += run_interpreter(chip8_ctx, 1);
+        }
+        if(chip8_ctx->spin_length || chip8_ctx->fault){
+            break;
+        }
+    }
+    return executed;
+}
+
+#else
+
+jit_state* jit_create(void){
+    return NULL;
+}
+
+void jit_free(jit_state* jit){
+    (void)jit;
+}
+
+void jit_invalidate(jit_state* jit, uint16_t addr, uint32_t size){
+    (void)jit;
+    (void)addr;
+    (void)size;
+}
+
+uint8_t jit_available(void){
+    return 0;
+}
+
+uint32_t run_jit(chip8* chip8_ctx, uint32_t n){
+    return run_interpreter(chip8_ctx, n);
+}
+
+#endif
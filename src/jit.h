@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "chip8.h"
+
+jit_state* jit_create(void);
+
+void jit_free(jit_state* jit);
+
+// drop compiled blocks overlapping a guest memory write
+void jit_invalidate(jit_state* jit, uint16_t addr, uint32_t size);
+
+// 1 if the host can run recompiled code, run_jit() falls back to the interpreter otherwise
+uint8_t jit_available(void);
+
+// run up to n instructions through recompiled blocks, returns the number executed
+uint32_t run_jit(chip8* chip8_ctx, uint32_t n);
@@ -0,0 +1,459 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "lanes.h"
+
+// copy the registers of one lane from the rows into its context, and back
+static void context_from_lanes(const chip8_lanes* l, int lane, chip8* ctx){
+    for(int reg = 0; reg < NUM_REGISTERS; reg++){
+        ctx->v[reg] = l->v[reg][lane];
+    }
+    ctx->pc = l->pc[lane];
+    ctx->I = l->I[lane];
+    ctx->delay_timer = l->delay_timer[lane];
+    ctx->sound_timer = l->sound_timer[lane];
+}
+
+static void lanes_from_context(chip8_lanes* l, int lane, const chip8* ctx){
+    for(int reg = 0; reg < NUM_REGISTERS; reg++){
+        l->v[reg][lane] = ctx->v[reg];
+    }
+    l->pc[lane] = ctx->pc;
+    l->I[lane] = ctx->I;
+    l->delay_timer[lane] = ctx->delay_timer;
+    l->sound_timer[lane] = ctx->sound_timer;
+}
+
+
+#if defined(__GNUC__) || defined(__clang__)
+
+/*
+* GCC vector extensions, one lane per element. With LANES at 16 the byte
+* registers fill an SSE register and the 16 bit ones an AVX2 register, the
+* compiler splits them up on hosts with narrower vectors.
+*/
+typedef uint8_t lane_u8 __attribute__((vector_size(LANES)));
+typedef int8_t lane_i8 __attribute__((vector_size(LANES)));
+typedef uint16_t lane_u16 __attribute__((vector_size(LANES * 2)));
+typedef int16_t lane_i16 __attribute__((vector_size(LANES * 2)));
+typedef uint32_t lane_u32 __attribute__((vector_size(LANES * 4)));
+typedef int32_t lane_i32 __attribute__((vector_size(LANES * 4)));
+
+// new where the mask is set, old elsewhere
+#define BLEND(old, new, mask) (((new) & (mask)) | ((old) & ~(mask)))
+
+// the lanes' registers while run_lanes() is going
+typedef struct {
+    lane_u8 v[NUM_REGISTERS];
+    lane_u16 pc;
+    lane_u16 I;
+    lane_u8 delay_timer;
+    lane_u8 sound_timer;
+} lane_regs;
+
+typedef enum {
+    STEP_SCALAR,                    // not done, run it through execute()
+    STEP_DONE,
+    STEP_BRANCHED                   // done, the lanes may disagree on pc now
+} step_result;
+
+// lanes taking part in a step, all ones or all zeros per lane
+typedef struct {
+    lane_u8 bytes;
+    lane_u16 words;
+} lane_mask;
+
+
+// masks are all ones or all zeros per lane, look at them 64 bits at a time
+static int all_lanes(const void* mask, size_t size){
+    uint64_t word;
+    for(size_t i = 0; i < size; i += sizeof(word)){
+        memcpy(&word, (const uint8_t*)mask + i, sizeof(word));
+        if(word != ~0ULL){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int any_lane(const void* mask, size_t size){
+    uint64_t word;
+    for(size_t i = 0; i < size; i += sizeof(word)){
+        memcpy(&word, (const uint8_t*)mask + i, sizeof(word));
+        if(word){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void load_regs(const chip8_lanes* l, lane_regs* r){
+    memcpy(r->v, l->v, sizeof(r->v));
+    memcpy(&r->pc, l->pc, sizeof(r->pc));
+    memcpy(&r->I, l->I, sizeof(r->I));
+    memcpy(&r->delay_timer, l->delay_timer, sizeof(r->delay_timer));
+    memcpy(&r->sound_timer, l->sound_timer, sizeof(r->sound_timer));
+}
+
+static void store_regs(chip8_lanes* l, const lane_regs* r){
+    memcpy(l->v, r->v, sizeof(r->v));
+    memcpy(l->pc, &r->pc, sizeof(r->pc));
+    memcpy(l->I, &r->I, sizeof(r->I));
+    memcpy(l->delay_timer, &r->delay_timer, sizeof(r->delay_timer));
+    memcpy(l->sound_timer, &r->sound_timer, sizeof(r->sound_timer));
+}
+
+// copy the registers of one lane into its context, and back
+static void regs_to_context(const lane_regs* r, int lane, chip8* ctx){
+    for(int reg = 0; reg < NUM_REGISTERS; reg++){
+        ctx->v[reg] = r->v[reg][lane];
+    }
+    ctx->pc = r->pc[lane];
+    ctx->I = r->I[lane];
+    ctx->delay_timer = r->delay_timer[lane];
+    ctx->sound_timer = r->sound_timer[lane];
+}
+
+static void regs_from_context(lane_regs* r, int lane, const chip8* ctx){
+    for(int reg = 0; reg < NUM_REGISTERS; reg++){
+        r->v[reg][lane] = ctx->v[reg];
+    }
+    r->pc[lane] = ctx->pc;
+    r->I[lane] = ctx->I;
+    r->delay_timer[lane] = ctx->delay_timer;
+    r->sound_timer[lane] = ctx->sound_timer;
+}
+
+static void mark_written(chip8_lanes* l, uint16_t addr, uint32_t size){
+    // an instruction starting up to three bytes before the store overlaps it
+    for(uint32_t i = 0; i < size + LONG_OP_SIZE - 1 && i < RAM_SIZE; i++){
+        l->written[(addr - (LONG_OP_SIZE - 1) + i) & ADDR_MASK] = 1;
+    }
+}
+
+// run the instruction at pc of every masked lane through execute()
+static void step_scalar(chip8_lanes* l, lane_regs* r, const lane_mask* mask){
+    for(int lane = 0; lane < LANES; lane++){
+        if(!mask->bytes[lane]){
+            continue;
+        }
+        chip8* ctx = l->lanes[lane];
+        regs_to_context(r, lane, ctx);
+
+        uint16_t pc = ctx->pc;
+        uint16_t opcode = ctx->mem[pc] << 8 | ctx->mem[(pc + 1) & ADDR_MASK];
+        if((opcode & 0xF0FF) == 0xF033){
+            mark_written(l, ctx->I, 3);
+        }else if((opcode & 0xF0FF) == 0xF055){
+            mark_written(l, ctx->I, ((opcode >> 8) & 0xf) + 1);
+        }else if(opcode == 0x00FD){
+            // reset clears the area between the fonts and the program
+            mark_written(l, FONT_SET_SIZE + SUPER_FONT_SET_SIZE, PROGRAM_START - (FONT_SET_SIZE + SUPER_FONT_SET_SIZE));
+        }
+
+        execute(ctx);
+        // busy-waits are run through here, not skipped
+        ctx->spin_length = 0;
+        regs_from_context(r, lane, ctx);
+    }
+}
+
+/*
+* Run the instruction at pc on the masked lanes as vector operations, mirroring
+* execute(). Returns STEP_SCALAR if the opcode has to go through step_scalar()
+* instead.
+*/
+static inline step_result step_vector(chip8_lanes* l, lane_regs* r, uint16_t pc, const lane_mask* mask){
+    lane_u8 m8 = mask->bytes;
+    lane_u16 m16 = mask->words;
+    uint16_t opcode = l->code[pc] << 8 | l->code[(pc + 1) & ADDR_MASK];
+    uint8_t x = (opcode & 0x0f00) >> 8;
+    uint8_t y = (opcode & 0x00f0) >> 4;
+    uint8_t n = opcode & 0xf;
+    uint8_t kk = opcode & 0xff;
+    uint16_t addr = opcode & 0xfff;
+
+    lane_u8 v_x = r->v[x];
+    lane_u8 v_y = r->v[y];
+    lane_u8 flag, result;
+    lane_u8 cond;
+    lane_u16 wide;
+
+    switch (opcode >> 12) {
+        case 0:
+            if(y != 0){
+                return STEP_SCALAR;
+            }
+            // ignore old SYS opcode
+            r->pc = BLEND(r->pc, r->pc + OP_SIZE, m16);
+            return STEP_DONE;
+        case 1:
+            r->pc = BLEND(r->pc, (lane_u16){0} + addr, m16);
+            return STEP_DONE;
+        case 3:
+            cond = (lane_u8)(v_x == kk);
+            break;
+        case 4:
+            cond = (lane_u8)(v_x != kk);
+            break;
+        case 5:
+            if(n != 0){
+                return STEP_SCALAR;
+            }
+            cond = (lane_u8)(v_x == v_y);
+            break;
+        case 9:
+            if(n != 0){
+                return STEP_SCALAR;
+            }
+            cond = (lane_u8)(v_x != v_y);
+            break;
+        case 6:
+            r->v[x] = BLEND(v_x, (lane_u8){0} + kk, m8);
+            r->pc = BLEND(r->pc, r->pc + OP_SIZE, m16);
+            return STEP_DONE;
+        case 7:
+            r->v[x] = BLEND(v_x, v_x + kk, m8);
+            r->pc = BLEND(r->pc, r->pc + OP_SIZE, m16);
+            return STEP_DONE;
+        case 8:
+            // VF is written before Vx, so 8FyN leaves the result in VF like execute() does
+            switch (n) {
+                case 0x0: result = v_y; break;
+                case 0x1: result = v_x | v_y; break;
+                case 0x2: result = v_x & v_y; break;
+                case 0x3: result = v_x ^ v_y; break;
+                case 0x4:
+                    result = v_x + v_y;
+                    flag = (lane_u8)(result < v_x) & 1;
+                    r->v[VF_IDX] = BLEND(r->v[VF_IDX], flag, m8);
+                    break;
+                case 0x5:
+                    flag = (lane_u8)(v_x >= v_y) & 1;
+                    r->v[VF_IDX] = BLEND(r->v[VF_IDX], flag, m8);
+                    result = v_x - v_y;
+                    break;
+                case 0x6:
+                    v_x = (l->quirks & QUIRK_SHIFT_VY) ? v_y : v_x;
+                    r->v[VF_IDX] = BLEND(r->v[VF_IDX], v_x & 1, m8);
+                    result = v_x >> 1;
+                    break;
+                case 0x7:
+                    flag = (lane_u8)(v_y >= v_x) & 1;
+                    r->v[VF_IDX] = BLEND(r->v[VF_IDX], flag, m8);
+                    result = v_y - v_x;
+                    break;
+                case 0xE:
+                    v_x = (l->quirks & QUIRK_SHIFT_VY) ? v_y : v_x;
+                    r->v[VF_IDX] = BLEND(r->v[VF_IDX], v_x >> 7, m8);
+                    result = v_x << 1;
+                    break;
+                default:
+                    return STEP_SCALAR;
+            }
+            r->v[x] = BLEND(r->v[x], result, m8);
+            r->pc = BLEND(r->pc, r->pc + OP_SIZE, m16);
+            return STEP_DONE;
+        case 0xA:
+            r->I = BLEND(r->I, (lane_u16){0} + addr, m16);
+            r->pc = BLEND(r->pc, r->pc + OP_SIZE, m16);
+            return STEP_DONE;
+        case 0xB:
+            wide = __builtin_convertvector(r->v[(l->quirks & QUIRK_JUMP_VX) ? x : 0], lane_u16) + addr;
+            r->pc = BLEND(r->pc, wide, m16);
+            return STEP_BRANCHED;
+        case 0xF:
+            switch (kk) {
+                case 0x07:
+                    r->v[x] = BLEND(v_x, r->delay_timer, m8);
+                    break;
+                case 0x15:
+                    r->delay_timer = BLEND(r->delay_timer, v_x, m8);
+                    break;
+                case 0x18:
+                    r->sound_timer = BLEND(r->sound_timer, v_x, m8);
+                    break;
+                case 0x1E:
+                    // VF = no carry out of the 16 bit I
+                    wide = r->I + __builtin_convertvector(v_x, lane_u16);
+                    if(l->quirks & QUIRK_ADD_I_VF){
+                        flag = (lane_u8)__builtin_convertvector((lane_i16)(wide >= r->I), lane_i8) & 1;
+                        r->v[VF_IDX] = BLEND(r->v[VF_IDX], flag, m8);
+                    }
+                    r->I = BLEND(r->I, wide, m16);
+                    break;
+                case 0x29:
+                    r->I = BLEND(r->I, __builtin_convertvector(v_x, lane_u16) * 5, m16);
+                    break;
+                case 0x30:
+                    r->I = BLEND(r->I, __builtin_convertvector(v_x, lane_u16) * 10 + FONT_SET_SIZE, m16);
+                    break;
+                default:
+                    return STEP_SCALAR;
+            }
+            r->pc = BLEND(r->pc, r->pc + OP_SIZE, m16);
+            return STEP_DONE;
+        default:
+            return STEP_SCALAR;
+    }
+
+    // skips, step over the whole next instruction
+    lane_u16 skip = (lane_u16)__builtin_convertvector((lane_i8)cond, lane_i16);
+    uint16_t next_size = l->code[(pc + OP_SIZE) & ADDR_MASK] == 0xF0 && l->code[(pc + OP_SIZE + 1) & ADDR_MASK] == 0x00
+                         ? LONG_OP_SIZE : OP_SIZE;
+    r->pc = BLEND(r->pc, r->pc + OP_SIZE + (skip & next_size), m16);
+    return STEP_BRANCHED;
+}
+
+
+uint32_t run_lanes(chip8_lanes* l, uint32_t n){
+    const lane_mask all = {(lane_u8){0} - 1, (lane_u16){0} - 1};
+    lane_regs r;
+    lane_u32 executed = {0};
+    uint32_t steps = 0;
+
+    load_regs(l, &r);
+    for(;;){
+        lane_i32 budget = executed < n;
+        if(!any_lane(&budget, sizeof(budget))){
+            break;
+        }
+
+        uint16_t pc = r.pc[0];
+        lane_i16 mask = (r.pc == pc) & __builtin_convertvector(budget, lane_i16);
+        if(all_lanes(&mask, sizeof(mask))){
+            // all lanes together, run them unmasked until they may split up or one runs out
+            uint32_t ahead = 0;
+            for(int lane = 0; lane < LANES; lane++){
+                ahead = executed[lane] > ahead ? executed[lane] : ahead;
+            }
+            uint32_t run = 0;
+            uint8_t together = 1;
+            while(together && run < n - ahead){
+                pc = r.pc[0];
+                step_result result = STEP_SCALAR;
+                // the shared copy of the code only holds where no lane has stored over it
+                if(!l->written[pc] && !l->written[(pc + OP_SIZE) & ADDR_MASK]){
+                    result = step_vector(l, &r, pc, &all);
+                }
+                if(result == STEP_SCALAR){
+                    step_scalar(l, &r, &all);
+                }
+                if(result != STEP_DONE){
+                    lane_i16 same = r.pc == r.pc[0];
+                    together = all_lanes(&same, sizeof(same));
+                }
+                run++;
+            }
+            executed += run;
+            steps += run;
+            continue;
+        }
+
+        // apart, the lane furthest behind picks the pc and the lanes at it take the step
+        int leader = -1;
+        for(int lane = 0; lane < LANES; lane++){
+            if(budget[lane] && (leader < 0 || executed[lane] < executed[leader])){
+                leader = lane;
+            }
+        }
+        pc = r.pc[leader];
+        mask = (r.pc == pc) & __builtin_convertvector(budget, lane_i16);
+        lane_mask m = {(lane_u8)__builtin_convertvector(mask, lane_i8), (lane_u16)mask};
+
+        if(l->written[pc] || l->written[(pc + OP_SIZE) & ADDR_MASK] || step_vector(l, &r, pc, &m) == STEP_SCALAR){
+            step_scalar(l, &r, &m);
+        }
+        executed -= (lane_u32)__builtin_convertvector(mask, lane_i32);
+        steps++;
+    }
+    store_regs(l, &r);
+
+    for(int lane = 0; lane < LANES; lane++){
+        l->lanes[lane]->cycles += n;
+        STAT_ADD(l->lanes[lane], instructions, n);
+    }
+    return steps;
+}
+
+#else
+
+// no vector extensions (MSVC), every lane runs its n instructions through execute() in turn
+uint32_t run_lanes(chip8_lanes* l, uint32_t n){
+    for(int lane = 0; lane < LANES; lane++){
+        chip8* ctx = l->lanes[lane];
+        context_from_lanes(l, lane, ctx);
+        for(uint32_t i = 0; i < n; i++){
+            execute(ctx);
+            // busy-waits are run through here, not skipped
+            ctx->spin_length = 0;
+        }
+        lanes_from_context(l, lane, ctx);
+        ctx->cycles += n;
+        STAT_ADD(ctx, instructions, n);
+    }
+    return n * LANES;
+}
+
+#endif
+
+chip8_lanes* lanes_create(const uint8_t* rom, size_t size, const uint64_t seeds[LANES]){
+    chip8_lanes* l = calloc(1, sizeof(chip8_lanes));
+    if(!l){
+        return NULL;
+    }
+    for(int lane = 0; lane < LANES; lane++){
+        chip8* ctx = malloc(sizeof(chip8));
+        if(!ctx){
+            lanes_free(l);
+            return NULL;
+        }
+        init_emulator_rom(rom, size, ctx);
+        seed_random(ctx, seeds ? seeds[lane] : DEFAULT_SEED);
+        l->lanes[lane] = ctx;
+        lanes_from_context(l, lane, ctx);
+    }
+    memcpy(l->code, l->lanes[0]->mem, RAM_SIZE);
+    l->quirks = PROFILE_QUIRKS[PROFILE_DEFAULT];
+    return l;
+}
+
+void lanes_free(chip8_lanes* l){
+    if(!l){
+        return;
+    }
+    for(int lane = 0; lane < LANES; lane++){
+        free(l->lanes[lane]);
+    }
+    free(l);
+}
+
+void lanes_set_profile(chip8_lanes* l, QUIRK_PROFILE profile){
+    // the lanes that step through execute() go by their own context
+    for(int lane = 0; lane < LANES; lane++){
+        l->lanes[lane]->profile = profile;
+    }
+    l->quirks = PROFILE_QUIRKS[profile];
+}
+
+void lanes_set_keys(chip8_lanes* l, int lane, uint16_t keys){
+    for(uint8_t k = 0; k < NUM_KEYS; k++){
+        l->lanes[lane]->keyboard[k] = (keys >> k) & 1;
+    }
+}
+
+uint32_t run_lanes_frame(chip8_lanes* l, uint32_t ipf){
+    uint32_t steps = run_lanes(l, ipf);
+    for(int lane = 0; lane < LANES; lane++){
+        l->delay_timer[lane] -= (l->delay_timer[lane] > 0);
+        l->sound_timer[lane] -= (l->sound_timer[lane] > 0);
+        STAT_ADD(l->lanes[lane], frames, 1);
+    }
+    return steps;
+}
+
+const chip8* lane_context(chip8_lanes* l, int lane){
+    chip8* ctx = l->lanes[lane];
+    context_from_lanes(l, lane, ctx);
+    return ctx;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip8.h"
+
+/*
+* Lockstep engine for many copies of one program. The registers, I, pc and
+* timers of LANES machines are kept as structure of arrays, one row of LANES
+* bytes per register, so an instruction the lanes agree on is a few vector
+* operations for all of them at once. Every step runs the lanes sitting at
+* the pc of the lane furthest behind and masks the others out, lanes that
+* branch apart take turns and run together again once their pcs meet.
+*
+* Memory, stack, screen, keypad and random generator stay in a chip8 context
+* per lane. Instructions touching those, and any instruction at an address
+* some lane has stored over, go through execute() one lane at a time. Every
+* lane ends up exactly where the reference engine would have taken it, the
+* engines test in tests/engines.c checks that.
+* Compilers without GCC vector extensions step the lanes one after another.
+*/
+
+#define LANES 16
+
+typedef struct {
+    uint8_t v[NUM_REGISTERS][LANES];
+    uint16_t pc[LANES];
+    uint16_t I[LANES];
+    uint8_t delay_timer[LANES];
+    uint8_t sound_timer[LANES];
+    chip8* lanes[LANES];            // everything else, registers there are stale until lane_context()
+    uint8_t code[RAM_SIZE];         // memory as loaded, the same in every lane until stored over
+    uint8_t written[RAM_SIZE];      // set where an instruction may overlap a store by some lane
+    uint8_t quirks;                 // of the profile every lane runs
+} chip8_lanes;
+
+// every lane loads rom and seeds its random generator from seeds[lane], NULL on failure
+chip8_lanes* lanes_create(const uint8_t* rom, size_t size, const uint64_t seeds[LANES]);
+
+void lanes_free(chip8_lanes* l);
+
+void lanes_set_keys(chip8_lanes* l, int lane, uint16_t keys);
+
+// run every lane with another quirk profile, PROFILE_DEFAULT until then
+void lanes_set_profile(chip8_lanes* l, QUIRK_PROFILE profile);
+
+// run n instructions on every lane, returns the number of steps it took
+uint32_t run_lanes(chip8_lanes* l, uint32_t n);
+
+// run one frame of ipf instructions on every lane then count the timers down
+uint32_t run_lanes_frame(chip8_lanes* l, uint32_t ipf);
+
+// bring the context of a lane up to date and return it
+const chip8* lane_context(chip8_lanes* l, int lane);
@@ -0,0 +1,116 @@
+#include <stdlib.h>
+
+#include "libchip8.h"
+#include "chip8.h"
+#include "engine.h"
+
+// the public layout constants are promises about chip8.screen
+typedef char framebuffer_layout_matches[
+    (LIBCHIP8_PLANES == NUM_PLANES && LIBCHIP8_WIDTH == SCREEN_WIDTH
+     && LIBCHIP8_HEIGHT == SCREEN_HEIGHT && LIBCHIP8_ROW_WORDS == SCREEN_ROW_WORDS) ? 1 : -1];
+// and the error codes are the core's faults
+typedef char error_codes_match[(LIBCHIP8_OK == FAULT_NONE && LIBCHIP8_BAD_OPCODE == FAULT_BAD_OPCODE
+                                && LIBCHIP8_STACK_FAULT == FAULT_STACK) ? 1 : -1];
+
+struct chip8_vm {
+    chip8 ctx;
+    ENGINE engine;
+    uint32_t ipf;
+    QUIRK_PROFILE profile;
+};
+
+
+chip8_vm* chip8_create(const char* engine, uint64_t seed, uint32_t ipf){
+    ENGINE selected = ENGINE_INTERP;
+    if(engine && !parse_engine(engine, &selected)){
+        return NULL;
+    }
+    chip8_vm* vm = malloc(sizeof(chip8_vm));
+    if(!vm){
+        return NULL;
+    }
+    vm->engine = selected;
+    vm->ipf = ipf ? ipf : INSTRUCTIONS_PER_FRAME;
+    vm->profile = PROFILE_DEFAULT;
+    init_emulator_rom(NULL, 0, &vm->ctx);
+    seed_random(&vm->ctx, seed);
+    return vm;
+}
+
+void chip8_destroy(chip8_vm* vm){
+    if(!vm){
+        return;
+    }
+    free_engines(&vm->ctx);
+    free(vm);
+}
+
+int chip8_load_rom(chip8_vm* vm, const uint8_t* rom, size_t size){
+    if(size > PROGRAM_END - PROGRAM_START){
+        return 0;
+    }
+    uint64_t seed = vm->ctx.seed;
+    // cached code belongs to the old program
+    free_engines(&vm->ctx);
+    init_emulator_rom(rom, size, &vm->ctx);
+    seed_random(&vm->ctx, seed);
+    set_profile(&vm->ctx, vm->profile);
+    return 1;
+}
+
+int chip8_set_quirks(chip8_vm* vm, const char* profile){
+    if(!parse_profile(profile, &vm->profile)){
+        return 0;
+    }
+    set_profile(&vm->ctx, vm->profile);
+    return 1;
+}
+
+uint32_t chip8_step(chip8_vm* vm, uint32_t n){
+    return run_engine(vm->engine, &vm->ctx, n);
+}
+
+uint32_t chip8_run_frames(chip8_vm* vm, uint32_t n){
+    uint32_t executed = 0;
+    for(uint32_t f = 0; f < n && !vm->ctx.fault; f++){
+        executed += run_frame(vm->engine, &vm->ctx, vm->ipf);
+    }
+    return executed;
+}
+
+int chip8_error(const chip8_vm* vm, uint16_t* pc, uint16_t* opcode){
+    if(vm->ctx.fault && pc){
+        *pc = vm->ctx.fault_pc;
+    }
+    if(vm->ctx.fault && opcode){
+        *opcode = vm->ctx.fault_opcode;
+    }
+    return vm->ctx.fault;
+}
+
+void chip8_set_keys(chip8_vm* vm, uint16_t keys){
+    for(uint8_t k = 0; k < NUM_KEYS; k++){
+        vm->ctx.keyboard[k] = (keys >> k) & 1;
+    }
+}
+
+const uint64_t* chip8_framebuffer(const chip8_vm* vm){
+    return &vm->ctx.screen[0][0][0];
+}
+
+uint64_t chip8_screen_hash(const chip8_vm* vm){
+    return screen_hash(&vm->ctx);
+}
+
+void chip8_step_batch(chip8_vm* const* vms, size_t count, uint32_t n){
+    for(size_t i = 0; i < count; i++){
+        run_engine(vms[i]->engine, &vms[i]->ctx, n);
+    }
+}
+
+void chip8_run_frames_batch(chip8_vm* const* vms, size_t count, uint32_t n){
+    // one vm at a time, its memory and compiled blocks stay in cache for all n frames
+    for(size_t i = 0; i < count; i++){
+        chip8_run_frames(vms[i], n);
+    }
+}
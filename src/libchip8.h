@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+* Embedding API. A chip8_vm is one emulator instance the host drives itself,
+* there is no frame clock, window, audio or input thread behind it. Stepping
+* runs the same engines as the emulator, so a ROM, seed and key sequence give
+* the same screen here as in a headless run. The library never prints or
+* exits, a vm that hits an opcode it does not know, or a call or return the
+* stack has no room for, stops there and reports it through chip8_error()
+* until the next chip8_load_rom().
+*/
+
+// framebuffer layout, see chip8_framebuffer()
+#define LIBCHIP8_PLANES 2
+#define LIBCHIP8_WIDTH 128
+#define LIBCHIP8_HEIGHT 64
+#define LIBCHIP8_ROW_WORDS 2
+
+// chip8_error() codes
+#define LIBCHIP8_OK 0
+#define LIBCHIP8_BAD_OPCODE 1
+#define LIBCHIP8_STACK_FAULT 2
+
+typedef struct chip8_vm chip8_vm;
+
+// engine is a name as given to --engine ("ref", "interp" or "jit") or NULL for the interpreter, "aot"
+// has no module to run here and interprets. An ipf of 0 is the emulator default. Returns NULL if the
+// engine is unknown or memory runs out
+chip8_vm* chip8_create(const char* engine, uint64_t seed, uint32_t ipf);
+
+void chip8_destroy(chip8_vm* vm);
+
+// reset the machine and load a program from memory, returns 0 if it does not fit
+int chip8_load_rom(chip8_vm* vm, const uint8_t* rom, size_t size);
+
+// quirk profile as given to --quirks ("default", "chip8", "schip" or "xochip"), kept across
+// chip8_load_rom(). Returns 0 if the profile is unknown
+int chip8_set_quirks(chip8_vm* vm, const char* profile);
+
+// run n instructions, returns the number executed including skipped busy-wait iterations.
+// Stops early on an error, see chip8_error()
+uint32_t chip8_step(chip8_vm* vm, uint32_t n);
+
+// run n frames of ipf instructions, the timers count down once per frame. Stops early on an error
+uint32_t chip8_run_frames(chip8_vm* vm, uint32_t n);
+
+// LIBCHIP8_OK while the vm runs. Otherwise why it stopped, pc and opcode (either may be NULL)
+// get the instruction it stopped on. A stopped vm executes nothing until chip8_load_rom()
+int chip8_error(const chip8_vm* vm, uint16_t* pc, uint16_t* opcode);
+
+// bit k set while key k is held, the guest sees it from its next instruction on
+void chip8_set_keys(chip8_vm* vm, uint16_t keys);
+
+/*
+* The live framebuffer, LIBCHIP8_PLANES planes of LIBCHIP8_HEIGHT rows of
+* LIBCHIP8_ROW_WORDS words, one bit per pixel with the msb of word 0 the
+* leftmost. Low resolution screens are drawn 2 x 2 pixels per guest pixel.
+* The pointer stays valid until chip8_destroy() and is never copied to.
+*/
+const uint64_t* chip8_framebuffer(const chip8_vm* vm);
+
+// framebuffer hash as printed by headless runs
+uint64_t chip8_screen_hash(const chip8_vm* vm);
+
+// run every vm of the array for n instructions or n frames in one call
+void chip8_step_batch(chip8_vm* const* vms, size_t count, uint32_t n);
+void chip8_run_frames_batch(chip8_vm* const* vms, size_t count, uint32_t n);
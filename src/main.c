@@ -1,25 +1,331 @@
-#ifdef WIN32
-#include <windows.h>
-#else
-#include <unistd.h>
-#endif
-
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
-#include "gfx.h"
+#include "aot.h"
 #include "chip8.h"
+#include "engine.h"
+#include "input.h"
+#include "jit.h"
+#include "movie.h"
+#include "platform.h"
+#include "quirks.h"
+#include "rewind.h"
+#include "scheduler.h"
+#include "snapshot.h"
+#include "stats.h"
 #include "utils.h"
 
-static void wait_for_event(chip8* ctx);
+#define STATS_INTERVAL_NS 1000000000ULL
+
+
+static void usage(const char* name){
+    printf("usage: %s [--engine=interp|jit|ref|aot] [--ipf N] [--turbo N | --uncapped] \n"
+           "          [--seed N] [--stats FILE] [--trace FILE] [--state FILE] [--load FILE] [--save FILE] \n"
+           "          [--rewind SECONDS] [--record FILE | --replay FILE] [--audio-buffer SAMPLES] \n"
+           "          [--quirks default|chip8|schip|xochip] [--quirk-db FILE] \n"
+           "          [--headless --cycles N [--wav FILE]] <rom> \n", name);
+}
+
+static void dump_trace(const trace_ring* trace){
+    int64_t count = trace_dump(trace);
+    if(count < 0){
+        printf("ERROR > Could not write trace to %s \n", trace->path);
+    }else{
+        printf("TRACE > %llu instructions written to %s \n", (unsigned long long)count, trace->path);
+    }
+}
+
+static void run_headless(chip8* ctx, platform* p, ENGINE engine, uint32_t ipf, unsigned long long max_cycles, FILE* stats_out){
+    unsigned long long cycles = 0;
+    uint64_t start = time_ns();
+
+    // whole emulated frames, then whatever is left of the budget
+    while (!ctx->exit && max_cycles - cycles >= ipf){
+        STAT_TIMED(ctx, execute_ns, cycles += run_frame(engine, ctx, ipf));
+        p->set_sound(p, ctx, ctx->sound_timer > 0);
+        if(ctx->draw){
+            STAT_TIMED(ctx, render_ns, p->render(p, ctx));
+            ctx->draw = 0;
+        }
+    }
+    if(!ctx->exit && cycles < max_cycles){
+        STAT_TIMED(ctx, execute_ns, cycles += run_engine(engine, ctx, max_cycles - cycles));
+    }
+    if(ctx->fault){
+        return;
+    }
+
+    uint64_t elapsed = time_ns() - start;
+    printf("CYCLES > %llu \n", cycles);
+    printf("HASH > %016llx \n", (unsigned long long)screen_hash(ctx));
+    printf("IPS > %.0f \n", elapsed > 0 ? cycles * 1e9 / elapsed : 0.0);
+    if(stats_out){
+        write_stats(stats_out, &ctx->stats, elapsed, 0);
+    }
+}
+
+#ifdef CHIP8_SDL
+static void run_realtime(chip8* ctx, platform* p, ENGINE engine, scheduler* s, rewind_buffer* history, FILE* stats_out){
+    uint64_t start = time_ns();
+    uint64_t next_report = start + STATS_INTERVAL_NS;
+    uint64_t target_ips = s->uncapped ? 0 : (uint64_t)s->ipf * s->turbo * FRAME_RATE;
+
+    while (!ctx->exit){
+        p->poll_events(p, ctx);
+        // a replay owns the keyboard until it runs out
+        if(!ctx->movie || ctx->movie->mode == MOVIE_RECORD || movie_finished(ctx->movie)){
+            sync_keys(ctx, &p->keys);
+        }
+
+        if(ctx->rewind && history){
+            // one frame back per host frame for as long as the key is held
+            rewind_step(history, ctx);
+            p->set_sound(p, ctx, 0);
+            if(ctx->draw){
+                p->render(p, ctx);
+                ctx->draw = 0;
+            }
+            wait_next_frame(s);
+            continue;
+        }
+
+        uint8_t idle = ctx->wait;
+        if(!ctx->wait){
+            STAT_TIMED(ctx, execute_ns,
+                for(uint32_t f = 0; f < s->turbo && !ctx->exit; f++){
+                    run_frame(engine, ctx, s->ipf);
+                }
+            );
+            idle = ctx->idle;
+            p->set_sound(p, ctx, ctx->sound_timer > 0);
+            if(history){
+                rewind_capture(history, ctx);
+            }
+
+            if(s->uncapped){
+                // keep emulating until the next host frame is due
+                STAT_TIMED(ctx, execute_ns,
+                    while (!idle && !ctx->exit && !frame_due(s)){
+                        run_frame(engine, ctx, s->ipf);
+                        idle = ctx->idle;
+                    }
+                );
+            }
+        }
+
+        if(ctx->draw){
+            STAT_TIMED(ctx, render_ns, p->render(p, ctx));
+            ctx->draw = 0;
+        }
+
+        if(STATS_ENABLED && time_ns() >= next_report){
+            char line[160];
+            uint64_t elapsed = time_ns() - start;
+            format_stats(line, sizeof(line), &ctx->stats, elapsed, target_ips);
+            p->show_stats(p, line);
+            if(stats_out){
+                write_stats(stats_out, &ctx->stats, elapsed, target_ips);
+            }
+            next_report += STATS_INTERVAL_NS;
+        }
+
+        if(idle){
+            // paused or spinning, nothing changes before the next timer tick or key event
+            STAT_TIMED(ctx, wait_ns,
+                while (!ctx->exit && !frame_due(s)){
+                    p->wait_events(p, ctx, until_next_frame(s));
+                }
+            );
+        }else if(!s->uncapped){
+            STAT_TIMED(ctx, wait_ns, wait_next_frame(s));
+        }
+    }
+}
+
+typedef struct {
+    chip8* ctx;
+    platform* p;
+    ENGINE engine;
+    scheduler* s;
+    rewind_buffer* history;
+    FILE* stats_out;
+} realtime_run;
+
+// run_realtime for platform run(), which may call it on a thread of its own
+static int realtime_loop(void* arg){
+    realtime_run* r = arg;
+    run_realtime(r->ctx, r->p, r->engine, r->s, r->history, r->stats_out);
+    return 0;
+}
+#endif
 
 
 int main(int argc, char *argv[]){
-    if(argc < 2){
+    const char* rom = NULL;
+    uint8_t headless = 0;
+    unsigned long long max_cycles = 0;
+    ENGINE engine = ENGINE_INTERP;
+    uint32_t ipf = INSTRUCTIONS_PER_FRAME;
+    uint32_t turbo = 1;
+    uint8_t seeded = 0;
+    uint64_t seed = DEFAULT_SEED;
+    const char* stats_path = NULL;
+    const char* trace_path = NULL;
+    const char* load_path = NULL;
+    const char* save_path = NULL;
+    const char* record_path = NULL;
+    const char* replay_path = NULL;
+    uint32_t audio_buffer = AUDIO_DEFAULT_BUFFER;
+    const char* wav_path = NULL;
+    uint8_t quirks_given = 0;
+    QUIRK_PROFILE profile = PROFILE_DEFAULT;
+    const char* quirk_db_path = QUIRK_DB;
+#ifdef CHIP8_SDL
+    // only the window has a frame clock, quick saves and rewind
+    uint8_t uncapped = 0;
+    const char* state_path = NULL;
+    uint32_t rewind_seconds = 60;
+#endif
+
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--headless") == 0){
+            headless = 1;
+        }else if(strncmp(argv[i], "--engine=", 9) == 0){
+            if(!parse_engine(argv[i] + 9, &engine)){
+                printf("ERROR > Unknown engine %s \n", argv[i] + 9);
+                exit(EXIT_FAILURE);
+            }
+        }else if(strcmp(argv[i], "--cycles") == 0 && i + 1 < argc){
+            max_cycles = strtoull(argv[++i], NULL, 10);
+        }else if(strcmp(argv[i], "--ipf") == 0 && i + 1 < argc){
+            ipf = strtoul(argv[++i], NULL, 10);
+        }else if(strcmp(argv[i], "--turbo") == 0 && i + 1 < argc){
+            turbo = strtoul(argv[++i], NULL, 10);
+        }else if(strcmp(argv[i], "--seed") == 0 && i + 1 < argc){
+            seed = strtoull(argv[++i], NULL, 10);
+            seeded = 1;
+        }else if(strcmp(argv[i], "--stats") == 0 && i + 1 < argc){
+            stats_path = argv[++i];
+        }else if(strcmp(argv[i], "--trace") == 0 && i + 1 < argc){
+            trace_path = argv[++i];
+        }else if(strcmp(argv[i], "--load") == 0 && i + 1 < argc){
+            load_path = argv[++i];
+        }else if(strcmp(argv[i], "--save") == 0 && i + 1 < argc){
+            save_path = argv[++i];
+        }else if(strcmp(argv[i], "--record") == 0 && i + 1 < argc){
+            record_path = argv[++i];
+        }else if(strcmp(argv[i], "--replay") == 0 && i + 1 < argc){
+            replay_path = argv[++i];
+        }else if(strcmp(argv[i], "--audio-buffer") == 0 && i + 1 < argc){
+            audio_buffer = strtoul(argv[++i], NULL, 10);
+        }else if(strcmp(argv[i], "--wav") == 0 && i + 1 < argc){
+            wav_path = argv[++i];
+        }else if(strcmp(argv[i], "--quirks") == 0 && i + 1 < argc){
+            if(!parse_profile(argv[++i], &profile)){
+                printf("ERROR > Unknown quirk profile %s \n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+            quirks_given = 1;
+        }else if(strcmp(argv[i], "--quirk-db") == 0 && i + 1 < argc){
+            quirk_db_path = argv[++i];
+#ifdef CHIP8_SDL
+        }else if(strcmp(argv[i], "--uncapped") == 0){
+            uncapped = 1;
+        }else if(strcmp(argv[i], "--state") == 0 && i + 1 < argc){
+            state_path = argv[++i];
+        }else if(strcmp(argv[i], "--rewind") == 0 && i + 1 < argc){
+            rewind_seconds = strtoul(argv[++i], NULL, 10);
+#endif
+        }else if(argv[i][0] == '-' && argv[i][1] == '-'){
+            printf("ERROR > Unknown option %s \n", argv[i]);
+            usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }else{
+            rom = argv[i];
+        }
+    }
+
+    if(!rom){
         printf("ERROR > Input file not provided \n");
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if(engine == ENGINE_JIT && !jit_available()){
+        printf("ERROR > The JIT is not supported on this host \n");
         exit(EXIT_FAILURE);
     }
 
-    FILE* input = fopen(argv[1], "rb");
+    if(ipf == 0 || turbo == 0){
+        printf("ERROR > --ipf and --turbo must be at least 1 \n");
+        exit(EXIT_FAILURE);
+    }
+
+    if(audio_buffer < 64 || audio_buffer > 8192 || (audio_buffer & (audio_buffer - 1))){
+        printf("ERROR > --audio-buffer must be a power of two between 64 and 8192 \n");
+        exit(EXIT_FAILURE);
+    }
+
+    if(wav_path && !headless){
+        printf("ERROR > --wav is only available with --headless \n");
+        exit(EXIT_FAILURE);
+    }
+
+    if(record_path && replay_path){
+        printf("ERROR > --record and --replay are exclusive \n");
+        exit(EXIT_FAILURE);
+    }
+
+    // a movie starts from power on, a loaded state would put it out of step
+    if(load_path && (record_path || replay_path)){
+        printf("ERROR > --load cannot be combined with --record or --replay \n");
+        exit(EXIT_FAILURE);
+    }
+
+    movie* replay = NULL;
+    if(replay_path){
+        if(!(replay = movie_read(replay_path))){
+            printf("ERROR > %s is not a usable input movie \n", replay_path);
+            exit(EXIT_FAILURE);
+        }
+        // the run is only repeated with the seed and frame length it was recorded with
+        if(!seeded){
+            seed = replay->seed;
+            seeded = 1;
+        }
+        if(replay->ipf){
+            ipf = replay->ipf;
+        }
+        if(headless && max_cycles == 0){
+            max_cycles = replay->length;
+        }
+    }
+
+    if(headless && max_cycles == 0){
+        printf("ERROR > --headless requires --cycles N \n");
+        exit(EXIT_FAILURE);
+    }
+
+#ifndef CHIP8_SDL
+    if(!headless){
+        printf("ERROR > Built without SDL, only --headless is available \n");
+        exit(EXIT_FAILURE);
+    }
+#endif
+
+    if(stats_path && !STATS_ENABLED){
+        printf("ERROR > Built without CHIP8_STATS, --stats is not available \n");
+        exit(EXIT_FAILURE);
+    }
+
+    FILE* stats_out = NULL;
+    if(stats_path && !(stats_out = fopen(stats_path, "w"))){
+        printf("ERROR > Could not open %s \n", stats_path);
+        exit(EXIT_FAILURE);
+    }
+
+    FILE* input = fopen(rom, "rb");
     if(!input){
         printf("ERROR > Input file not found \n");
         exit(EXIT_FAILURE);
@@ -30,87 +336,123 @@ int main(int argc, char *argv[]){
         exit(EXIT_FAILURE);
     }
 
-    chip8 ctx;
+    // headless runs are reproducible unless asked otherwise, play sessions are not
+    if(!seeded && !headless){
+        seed = (uint64_t)time(0);
+    }
+
+    // the decode cache over 64 KB of memory is too big for the stack
+    static chip8 ctx;
     init_emulator(input, &ctx);
-    ctx.debug = 0;
+    seed_random(&ctx, seed);
+
+    // the profile listed for this ROM unless one was asked for, the default one if it is not listed
+    if(!quirks_given){
+        quirk_db* db = quirk_db_read(quirk_db_path);
+        quirk_db_lookup(db, program_hash(&ctx), &profile);
+        quirk_db_free(db);
+    }
+    set_profile(&ctx, profile);
+    printf("QUIRKS > %s (ROM %016llx) \n", profile_name(profile), (unsigned long long)program_hash(&ctx));
+
+    // chip8-aot leaves the module next to the ROM, checked against the program as loaded
+    if(engine == ENGINE_AOT){
+        char module_path[4096];
+        const char* error = "path too long";
+        snprintf(module_path, sizeof(module_path), "%s%s", rom, AOT_SUFFIX);
+        if(strlen(rom) + strlen(AOT_SUFFIX) >= sizeof(module_path)
+           || !(ctx.aot = aot_load(module_path, &ctx, &error))){
+            printf("ERROR > %s: %s, run chip8-aot %s first \n", module_path, error, rom);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if(replay){
+        if(replay->rom_hash && replay->rom_hash != program_hash(&ctx)){
+            printf("ERROR > %s was recorded with a different ROM \n", replay_path);
+            exit(EXIT_FAILURE);
+        }
+        ctx.movie = replay;
+    }else if(record_path && !(ctx.movie = movie_create(MOVIE_RECORD, seed, program_hash(&ctx), ipf))){
+        printf("ERROR > Could not allocate the input movie \n");
+        exit(EXIT_FAILURE);
+    }
+
+    if(load_path){
+        chip8_snapshot snapshot;
+        if(!read_snapshot(&snapshot, load_path)){
+            printf("ERROR > %s is not a usable save state \n", load_path);
+            exit(EXIT_FAILURE);
+        }
+        if(!load_snapshot(&ctx, &snapshot)){
+            printf("ERROR > %s was saved with the %s quirks, not %s \n", load_path,
+                   profile_name((QUIRK_PROFILE)snapshot.profile), profile_name(ctx.profile));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if(trace_path && !(ctx.trace = trace_create(TRACE_DEFAULT_SIZE, trace_path))){
+        printf("ERROR > Could not allocate the trace buffer \n");
+        exit(EXIT_FAILURE);
+    }
     fclose(input);
 
-    GraphicsContext g_ctx;
-    g_ctx.width = SCREEN_WIDTH;
-    g_ctx.height = SCREEN_HEIGHT;
-    g_ctx.scale = WINDOW_WIDTH / SCREEN_WIDTH;
-    get_graphics_context(&g_ctx);
-    int paused = 1;
-    SDL_PauseAudioDevice(g_ctx.audio_device, paused);
-
-    while (!ctx.exit){
-        execute(&ctx);
-        ctx.step_cycles++;
-        if(ctx.draw){
-            render_graphics(&g_ctx, ctx.screen);
-            ctx.draw = 0;
-        }
-
-        do{
-            wait_for_event(&ctx);
-        } while (ctx.wait && !ctx.exit);
-
-        if(ctx.step_cycles == CLOCK_DIV){
-            ctx.delay_timer -= (ctx.delay_timer > 0);
-            ctx.sound_timer -= (ctx.sound_timer > 0);
-            if(ctx.sound_timer > 0 && paused){
-                paused = 0;
-                SDL_PauseAudioDevice(g_ctx.audio_device, paused);
-            }
-            if(ctx.sound_timer == 0) {
-                paused = 1;
-                SDL_PauseAudioDevice(g_ctx.audio_device, paused);
-            }
-            ctx.step_cycles = 0;
+    platform p;
+    if(headless){
+        init_null_platform(&p, wav_path);
+        run_headless(&ctx, &p, engine, ipf, max_cycles, stats_out);
+    }else{
+#ifdef CHIP8_SDL
+        scheduler s;
+        // quick saves go next to the ROM unless asked otherwise
+        char default_state[1024];
+        if(!state_path){
+            snprintf(default_state, sizeof(default_state), "%s.state", rom);
+            state_path = default_state;
         }
-#ifdef WIN32
-        Sleep(CPU_CLOCK_DELAY);
-#else
-        usleep(CPU_CLOCK_DELAY);
+        init_sdl_platform(&p, state_path, (uint16_t)audio_buffer);
+        init_scheduler(&s, ipf, turbo, uncapped);
+        rewind_buffer* history = NULL;
+        if(rewind_seconds && !(history = rewind_create(REWIND_ARENA_SIZE, rewind_seconds * FRAME_RATE, REWIND_KEYFRAME_INTERVAL))){
+            printf("ERROR > Could not allocate the rewind buffer \n");
+            exit(EXIT_FAILURE);
+        }
+        realtime_run r = {&ctx, &p, engine, &s, history, stats_out};
+        p.run(&p, realtime_loop, &r);
+        rewind_free(history);
 #endif
     }
-    free_graphics(&g_ctx);
-    return 0;
-}
-
-static void wait_for_event(chip8* ctx){
-    SDL_Event e;
-    while (SDL_PollEvent(&e)){
-        switch (e.type) {
-            case SDL_KEYDOWN:
-                switch (e.key.keysym.sym) {
-                    case SDLK_ESCAPE:
-                        ctx->exit = 1;
-                        break;
-                    case SDLK_SPACE:
-                        ctx->wait = !ctx->wait;
-                        break;
-                    case SDLK_F5:
-                        reset_emulator(ctx);
-                        break;
-                    default:
-                        break;
-                }
-                for(size_t i = 0; i < NUM_KEYS; i++){
-                    if(e.key.keysym.sym == KEYMAP[i]){
-                        ctx->keyboard[i] = 1;
-                    }
-                }
-                break;
-            case SDL_KEYUP:
-                for (int i = 0; i < NUM_KEYS; i++) {
-                    if (e.key.keysym.sym == KEYMAP[i]) {
-                        ctx->keyboard[i] = 0;
-                    }
-                }
-                break;
-            case SDL_QUIT:
-                ctx->exit = 1;
+    p.destroy(&p);
+    if(ctx.fault){
+        if(ctx.fault == FAULT_STACK){
+            printf("ERROR > Stack %s by %X at %X \n", ctx.sp ? "overflow" : "underflow", ctx.fault_opcode, ctx.fault_pc);
+        }else{
+            printf("ERROR > Opcode %X not recognized at %X \n", ctx.fault_opcode, ctx.fault_pc);
+        }
+        if(ctx.trace){
+            dump_trace(ctx.trace);
         }
+        exit(EXIT_FAILURE);
+    }
+    if(save_path){
+        chip8_snapshot snapshot;
+        memset(&snapshot, 0, sizeof(snapshot));
+        save_snapshot(&ctx, &snapshot);
+        if(!write_snapshot(&snapshot, save_path)){
+            printf("ERROR > Could not save state to %s \n", save_path);
+        }
+    }
+    if(record_path && !movie_write(ctx.movie, &ctx, record_path)){
+        printf("ERROR > Could not save the input movie to %s \n", record_path);
     }
+    movie_free(ctx.movie);
+    free_engines(&ctx);
+    if(ctx.trace){
+        dump_trace(ctx.trace);
+        trace_free(ctx.trace);
+    }
+    if(stats_out){
+        fclose(stats_out);
+    }
+    return 0;
 }
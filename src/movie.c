@@ -0,0 +1,225 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "movie.h"
+#include "utils.h"
+
+#define MAX_LINE 256
+// magic, version, seed, ROM hash, length, ipf and event count, little endian whatever the host
+#define HEADER_SIZE 40
+
+
+movie* movie_create(MOVIE_MODE mode, uint64_t seed, uint64_t rom_hash, uint32_t ipf){
+    movie* m = calloc(1, sizeof(movie));
+    if(!m){
+        return NULL;
+    }
+    m->mode = mode;
+    m->seed = seed;
+    m->rom_hash = rom_hash;
+    m->ipf = ipf;
+    return m;
+}
+
+void movie_free(movie* m){
+    if(!m){
+        return;
+    }
+    free(m->events);
+    free(m);
+}
+
+uint64_t program_hash(const chip8* chip8_ctx){
+    // programs that fit the classic 4 KB hash as they did before XO-CHIP memory
+    const uint8_t* mem = chip8_ctx->mem;
+    for(uint32_t i = CLASSIC_RAM_SIZE; i < RAM_SIZE; i++){
+        if(mem[i]){
+            return hash_bytes(mem + PROGRAM_START, RAM_SIZE - PROGRAM_START);
+        }
+    }
+    return hash_bytes(mem + PROGRAM_START, CLASSIC_RAM_SIZE - PROGRAM_START);
+}
+
+static int add_event(movie* m, uint64_t cycle, uint8_t code){
+    if(m->count == m->capacity){
+        uint32_t capacity = m->capacity ? m->capacity * 2 : 256;
+        movie_event* events = realloc(m->events, capacity * sizeof(movie_event));
+        if(!events){
+            return 0;
+        }
+        m->events = events;
+        m->capacity = capacity;
+    }
+    m->events[m->count].cycle = cycle;
+    m->events[m->count].code = code;
+    m->count++;
+    return 1;
+}
+
+uint32_t movie_sync(movie* m, chip8* chip8_ctx, uint32_t n, uint8_t* changed){
+    *changed = 0;
+    if(m->mode == MOVIE_RECORD){
+        for(uint8_t k = 0; k < NUM_KEYS; k++){
+            if(chip8_ctx->keyboard[k] != m->keyboard[k]){
+                m->keyboard[k] = chip8_ctx->keyboard[k];
+                // a lost event would replay differently, so nothing after it is recorded either
+                if(!m->failed && !add_event(m, chip8_ctx->cycles, k | (m->keyboard[k] ? MOVIE_KEY_DOWN : 0))){
+                    m->failed = 1;
+                }
+                *changed = 1;
+            }
+        }
+        return n;
+    }
+
+    if(movie_finished(m)){
+        return n;
+    }
+    while(m->next < m->count && m->events[m->next].cycle <= chip8_ctx->cycles){
+        uint8_t code = m->events[m->next++].code;
+        m->keyboard[code & 0xf] = (code & MOVIE_KEY_DOWN) != 0;
+        *changed = 1;
+    }
+    // the recording owns the keyboard until it runs out
+    memcpy(chip8_ctx->keyboard, m->keyboard, NUM_KEYS);
+    if(m->next < m->count && m->events[m->next].cycle - chip8_ctx->cycles < n){
+        n = (uint32_t)(m->events[m->next].cycle - chip8_ctx->cycles);
+    }
+    return n;
+}
+
+int movie_finished(const movie* m){
+    return m->mode == MOVIE_REPLAY && m->next == m->count;
+}
+
+static void put32(uint8_t* p, uint32_t value){
+    for(int i = 0; i < 4; i++){
+        p[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+static void put64(uint8_t* p, uint64_t value){
+    put32(p, (uint32_t)value);
+    put32(p + 4, (uint32_t)(value >> 32));
+}
+
+static uint32_t get32(const uint8_t* p){
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t get64(const uint8_t* p){
+    return get32(p) | (uint64_t)get32(p + 4) << 32;
+}
+
+static uint8_t* write_varint(uint8_t* out, uint64_t value){
+    while(value >= 0x80){
+        *out++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (uint8_t)value;
+    return out;
+}
+
+static int read_varint(FILE* input, uint64_t* value){
+    uint64_t result = 0;
+    int shift = 0;
+    int c;
+    do {
+        if((c = fgetc(input)) == EOF || shift > 63){
+            return 0;
+        }
+        result |= (uint64_t)(c & 0x7f) << shift;
+        shift += 7;
+    } while(c & 0x80);
+    *value = result;
+    return 1;
+}
+
+int movie_write(movie* m, const chip8* chip8_ctx, const char* path){
+    if(m->failed){
+        return 0;
+    }
+    FILE* out = fopen(path, "wb");
+    if(!out){
+        return 0;
+    }
+    if(m->mode == MOVIE_RECORD){
+        m->length = chip8_ctx->cycles;
+    }
+    uint8_t header[HEADER_SIZE];
+    memcpy(header, MOVIE_MAGIC, 4);
+    put32(header + 4, MOVIE_VERSION);
+    put64(header + 8, m->seed);
+    put64(header + 16, m->rom_hash);
+    put64(header + 24, m->length);
+    put32(header + 32, m->ipf);
+    put32(header + 36, m->count);
+    int ok = fwrite(header, sizeof(header), 1, out) == 1;
+
+    uint64_t last = 0;
+    for(uint32_t i = 0; i < m->count && ok; i++){
+        uint8_t buffer[11];
+        uint8_t* end = write_varint(buffer, m->events[i].cycle - last);
+        *end++ = m->events[i].code;
+        ok = fwrite(buffer, 1, end - buffer, out) == (size_t)(end - buffer);
+        last = m->events[i].cycle;
+    }
+    return fclose(out) == 0 && ok;
+}
+
+// text script, for hand written input in batch manifests
+static movie* read_script(FILE* input){
+    movie* m = movie_create(MOVIE_REPLAY, DEFAULT_SEED, 0, 0);
+    char line[MAX_LINE];
+    char state[8];
+    unsigned long long cycle;
+    unsigned key;
+    while(m && fgets(line, sizeof(line), input)){
+        if(line[0] == '#' || sscanf(line, "%llu %x %7s", &cycle, &key, state) != 3){
+            continue;
+        }
+        if(key >= NUM_KEYS || (m->count && cycle < m->events[m->count - 1].cycle)
+           || !add_event(m, cycle, key | (strcmp(state, "down") == 0 ? MOVIE_KEY_DOWN : 0))){
+            movie_free(m);
+            return NULL;
+        }
+        m->length = cycle;
+    }
+    return m;
+}
+
+movie* movie_read(const char* path){
+    FILE* input = fopen(path, "rb");
+    if(!input){
+        return NULL;
+    }
+    uint8_t header[HEADER_SIZE];
+    if(fread(header, sizeof(header), 1, input) != 1 || memcmp(header, MOVIE_MAGIC, 4) != 0){
+        rewind(input);
+        movie* m = read_script(input);
+        fclose(input);
+        return m;
+    }
+    if(get32(header + 4) != MOVIE_VERSION){
+        fclose(input);
+        return NULL;
+    }
+
+    movie* m = movie_create(MOVIE_REPLAY, get64(header + 8), get64(header + 16), get32(header + 32));
+    if(m){
+        m->length = get64(header + 24);
+    }
+    uint32_t count = get32(header + 36);
+    uint64_t cycle = 0;
+    for(uint32_t i = 0; m && i < count; i++){
+        uint64_t delta;
+        int code = EOF;
+        if(!read_varint(input, &delta) || (code = fgetc(input)) == EOF || !add_event(m, cycle + delta, (uint8_t)code)){
+            movie_free(m);
+            m = NULL;
+        }
+        cycle += delta;
+    }
+    fclose(input);
+    return m;
+}
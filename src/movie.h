@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "chip8.h"
+
+/*
+* Input movies. A movie attached to chip8_ctx->movie either records every key
+* transition the host makes, stamped with the instruction count it became
+* visible to the guest at, or feeds recorded transitions back in at exactly
+* those instruction counts. run_engine() syncs with it before every run of
+* instructions and never runs past the next recorded event, so together with
+* the seed a replay repeats the recorded run instruction for instruction.
+*
+* Files hold a header with the seed, a hash of the loaded program and the
+* instructions per frame, then one varint cycle delta and one key byte per
+* event. Replay also accepts text scripts of "<cycle> <key> <down|up>" lines.
+*/
+
+#define MOVIE_MAGIC "C8MV"
+#define MOVIE_VERSION 1
+#define MOVIE_KEY_DOWN 0x10
+
+typedef enum {
+    MOVIE_RECORD = 0,
+    MOVIE_REPLAY = 1
+} MOVIE_MODE;
+
+typedef struct {
+    uint64_t cycle;
+    uint8_t code;                   // key in the low nibble, MOVIE_KEY_DOWN if pressed
+} movie_event;
+
+struct movie {
+    MOVIE_MODE mode;
+    uint64_t seed;
+    uint64_t rom_hash;              // program_hash() of the recorded ROM, 0 if unknown
+    uint32_t ipf;
+    uint64_t length;                // instructions the recording covers
+
+    movie_event* events;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t next;                  // replay position
+    uint8_t keyboard[NUM_KEYS];     // key state as of the last event
+    uint8_t failed;                 // an event could not be stored, the recording stopped there
+};
+
+movie* movie_create(MOVIE_MODE mode, uint64_t seed, uint64_t rom_hash, uint32_t ipf);
+
+void movie_free(movie* m);
+
+// hash of the program area, identifies the ROM a movie was recorded with
+uint64_t program_hash(const chip8* chip8_ctx);
+
+/*
+* Record new key transitions or apply the ones due at the current cycle. Returns
+* the number of instructions, at most n, that can run before the next event and
+* sets *changed if the guest sees a different keyboard from now on.
+*/
+uint32_t movie_sync(movie* m, chip8* chip8_ctx, uint32_t n, uint8_t* changed);
+
+// 1 once a replay has applied every event
+int movie_finished(const movie* m);
+
+// both return 0 on failure, movie_write also for a recording that failed, movie_read gives a replay movie
+int movie_write(movie* m, const chip8* chip8_ctx, const char* path);
+movie* movie_read(const char* path);
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "chip8.h"
+#include "input.h"
+
+/*
+* A platform bundles the host video, audio and input backends the main loop
+* talks to. The SDL platform opens a window and an audio device, the null
+* platform does nothing at all so the core can run on hosts without a display.
+* The main loop runs inside run(), every other callback is made from the thread
+* running it, which for the SDL platform is not the one that owns the window.
+*/
+
+#define AUDIO_DEFAULT_BUFFER 512        // samples per audio callback, about 12 ms
+
+typedef struct platform platform;
+
+struct platform {
+    void* data;
+    key_state keys;                 // published by the platform, see input.h
+
+    // run loop(arg) to the end, the SDL platform keeps the calling thread for the window meanwhile
+    void (*run)(platform* p, int (*loop)(void* arg), void* arg);
+
+    void (*render)(platform* p, chip8* chip8_ctx);
+    // handle pending events, key changes only reach the core through keys
+    void (*poll_events)(platform* p, chip8* chip8_ctx);
+    // block until an input event arrives or the timeout passes, handling what arrived
+    void (*wait_events)(platform* p, chip8* chip8_ctx, uint64_t timeout_ns);
+    // called once per frame, on is whether the guest sound timer is running
+    void (*set_sound)(platform* p, const chip8* chip8_ctx, uint8_t on);
+    // show a line of statistics if the user turned the overlay on
+    void (*show_stats)(platform* p, const char* text);
+    void (*destroy)(platform* p);
+};
+
+// wav_path, if not NULL, gets one frame of the guest sound per set_sound call
+void init_null_platform(platform* p, const char* wav_path);
+
+#ifdef CHIP8_SDL
+// state_path is where F6 saves and F9 loads the quick save state, audio_buffer is in samples
+void init_sdl_platform(platform* p, const char* state_path, uint16_t audio_buffer);
+#endif
@@ -0,0 +1,87 @@
+#include <stdlib.h>
+
+#include "platform.h"
+#include "sound.h"
+#include "utils.h"
+
+#define SAMPLES_PER_FRAME (AUDIO_RATE / FRAME_RATE)
+
+typedef struct {
+    wav_writer wav;
+    sound_synth synth;
+} null_platform;
+
+
+static void null_run(platform* p, int (*loop)(void* arg), void* arg){
+    (void)p;
+    loop(arg);
+}
+
+static void null_render(platform* p, chip8* chip8_ctx){
+    (void)p;
+    (void)chip8_ctx;
+}
+
+static void null_poll_events(platform* p, chip8* chip8_ctx){
+    (void)p;
+    (void)chip8_ctx;
+}
+
+static void null_wait_events(platform* p, chip8* chip8_ctx, uint64_t timeout_ns){
+    (void)p;
+    (void)chip8_ctx;
+    sleep_ns(timeout_ns);
+}
+
+static void null_set_sound(platform* p, const chip8* chip8_ctx, uint8_t on){
+    null_platform* null = p->data;
+    if(!null){
+        return;
+    }
+    // emulated time, one frame of samples per call however fast the run goes
+    sound_voice voice;
+    int16_t samples[SAMPLES_PER_FRAME];
+    get_voice(&voice, chip8_ctx, on);
+    if(memcmp(&voice, &null->synth.voice, sizeof(voice)) != 0){
+        set_voice(&null->synth, &voice);
+    }
+    render_sound(&null->synth, samples, SAMPLES_PER_FRAME);
+    write_wav(&null->wav, samples, SAMPLES_PER_FRAME);
+}
+
+static void null_show_stats(platform* p, const char* text){
+    (void)p;
+    (void)text;
+}
+
+static void null_destroy(platform* p){
+    null_platform* null = p->data;
+    if(null){
+        if(!close_wav(&null->wav)){
+            printf("ERROR > Could not finish the WAV file \n");
+        }
+        free(null);
+        p->data = NULL;
+    }
+}
+
+void init_null_platform(platform* p, const char* wav_path){
+    p->data = NULL;
+    if(wav_path){
+        null_platform* null = malloc(sizeof(null_platform));
+        if(!null || !open_wav(&null->wav, wav_path)){
+            printf("ERROR > Could not open %s \n", wav_path);
+            exit(EXIT_FAILURE);
+        }
+        init_synth(&null->synth);
+        p->data = null;
+    }
+    publish_keys(&p->keys, 0, 0);
+    p->run = null_run;
+    p->render = null_render;
+    p->poll_events = null_poll_events;
+    p->wait_events = null_wait_events;
+    p->set_sound = null_set_sound;
+    p->show_stats = null_show_stats;
+    p->destroy = null_destroy;
+}
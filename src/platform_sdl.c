@@ -0,0 +1,390 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "atomics.h"
+#include "audio.h"
+#include "gfx.h"
+#include "platform.h"
+#include "snapshot.h"
+#include "triple_buffer.h"
+#include "utils.h"
+
+// physical key positions, the same keypad whatever the keyboard layout
+const static SDL_Scancode KEYMAP[0x10] = {
+        SDL_SCANCODE_X, // 0
+        SDL_SCANCODE_1, // 1
+        SDL_SCANCODE_2, // 2
+        SDL_SCANCODE_3, // 3
+        SDL_SCANCODE_Q, // 4
+        SDL_SCANCODE_W, // 5
+        SDL_SCANCODE_E, // 6
+        SDL_SCANCODE_A, // 7
+        SDL_SCANCODE_S, // 8
+        SDL_SCANCODE_D, // 9
+        SDL_SCANCODE_Z, // A
+        SDL_SCANCODE_C, // B
+        SDL_SCANCODE_4, // C
+        SDL_SCANCODE_R, // D
+        SDL_SCANCODE_F, // E
+        SDL_SCANCODE_V  // F
+};
+
+// inverse of KEYMAP filled in by init_sdl_platform, -1 for keys that are not on the keypad
+static int8_t KEY_FOR_SCANCODE[SDL_NUM_SCANCODES];
+
+// what the main thread asks of the emulation thread, applied at its next poll
+#define COMMAND_EXIT        1
+#define COMMAND_PAUSE       2
+#define COMMAND_RESET       4
+#define COMMAND_SAVE        8
+#define COMMAND_LOAD        16
+#define COMMAND_TRACE       32
+
+typedef struct {
+    GraphicsContext g_ctx;
+    audio_engine audio;
+    uint8_t overlay;                // F1, statistics in the title bar
+    const char* state_path;
+    uint16_t keys;                  // keypad state, published to the core on every change
+
+    // the main thread keeps the window and presents, emulation runs on its own thread
+    SDL_Thread* emulation_thread;
+    int (*loop)(void* arg);
+    void* loop_arg;
+    uint32_t done;                  // set once loop returned
+    uint32_t wake_event;            // pushed to the main thread when a frame, statistics or the end is waiting
+    triple_buffer frames;
+    uint64_t shown[NUM_PLANES][SCREEN_HEIGHT][SCREEN_ROW_WORDS];      // last frame taken, main thread
+    uint64_t presented;             // written by the main thread
+    uint64_t unchanged;             // written by the main thread
+    uint64_t dropped;               // frames replaced before the main thread got to them
+
+    uint32_t commands;              // COMMAND_ bits not applied yet
+    uint32_t rewinding;             // backspace held
+    SDL_sem* input_ready;           // posted with every key change and command, wait_events blocks on it
+    SDL_mutex* stats_lock;
+    char stats[256];                // newest statistics line, under stats_lock
+    uint8_t stats_fresh;            // under stats_lock
+} sdl_platform;
+
+
+static void quick_save(sdl_platform* sdl, const chip8* ctx){
+    chip8_snapshot snapshot;
+    memset(&snapshot, 0, sizeof(snapshot));
+    save_snapshot(ctx, &snapshot);
+    if(write_snapshot(&snapshot, sdl->state_path)){
+        printf("STATE > Saved to %s \n", sdl->state_path);
+    }else{
+        printf("ERROR > Could not save state to %s \n", sdl->state_path);
+    }
+}
+
+static void quick_load(sdl_platform* sdl, chip8* ctx){
+    chip8_snapshot snapshot;
+    if(!read_snapshot(&snapshot, sdl->state_path)){
+        printf("ERROR > No usable save state at %s \n", sdl->state_path);
+    }else if(!load_snapshot(ctx, &snapshot)){
+        printf("ERROR > %s was saved with the %s quirks, not %s \n", sdl->state_path,
+               profile_name((QUIRK_PROFILE)snapshot.profile), profile_name(ctx->profile));
+    }else{
+        printf("STATE > Loaded %s \n", sdl->state_path);
+    }
+}
+
+
+// emulation thread side
+
+static void wake_main(sdl_platform* sdl){
+    SDL_Event e;
+    SDL_zero(e);
+    e.type = sdl->wake_event;
+    SDL_PushEvent(&e);
+}
+
+static int emulation_main(void* data){
+    sdl_platform* sdl = data;
+    sdl->loop(sdl->loop_arg);
+    store_release_u32(&sdl->done, 1);
+    wake_main(sdl);
+    return 0;
+}
+
+static void sdl_render(platform* p, chip8* chip8_ctx){
+    sdl_platform* sdl = p->data;
+    memcpy(back_frame(&sdl->frames)->screen, chip8_ctx->screen, sizeof(chip8_ctx->screen));
+    // a frame still waiting means the main thread has a wake up coming for it already
+    if(publish_frame(&sdl->frames)){
+        sdl->dropped++;
+    }else{
+        wake_main(sdl);
+    }
+    chip8_ctx->dirty_rows = 0;
+
+    // catch the counters up with what the main thread has done since the last frame
+    STAT_ADD(chip8_ctx, frames_rendered, load_relaxed_u64(&sdl->presented) - chip8_ctx->stats.frames_rendered);
+    STAT_ADD(chip8_ctx, frames_skipped, load_relaxed_u64(&sdl->unchanged) + sdl->dropped
+                                        - chip8_ctx->stats.frames_skipped);
+}
+
+static void apply_commands(sdl_platform* sdl, chip8* ctx){
+    uint32_t commands = exchange_u32(&sdl->commands, 0);
+    if(commands & COMMAND_EXIT){
+        ctx->exit = 1;
+    }
+    if(commands & COMMAND_PAUSE){
+        ctx->wait = !ctx->wait;
+    }
+    if(commands & COMMAND_RESET){
+        reset_emulator(ctx);
+    }
+    if(commands & COMMAND_SAVE){
+        quick_save(sdl, ctx);
+    }
+    if(commands & COMMAND_LOAD){
+        quick_load(sdl, ctx);
+    }
+    if((commands & COMMAND_TRACE) && ctx->trace && trace_dump(ctx->trace) < 0){
+        printf("ERROR > Could not write trace to %s \n", ctx->trace->path);
+    }
+    ctx->rewind = (uint8_t)load_acquire_u32(&sdl->rewinding);
+}
+
+static void sdl_poll_events(platform* p, chip8* ctx){
+    sdl_platform* sdl = p->data;
+    // whatever was posted so far is handled now
+    while(SDL_SemTryWait(sdl->input_ready) == 0){
+    }
+    apply_commands(sdl, ctx);
+}
+
+static void sdl_wait_events(platform* p, chip8* ctx, uint64_t timeout_ns){
+    sdl_platform* sdl = p->data;
+    // round up so a sub-millisecond remainder does not turn into a busy poll
+    uint32_t timeout_ms = (uint32_t)((timeout_ns + 999999) / 1000000);
+    if(SDL_SemWaitTimeout(sdl->input_ready, timeout_ms) == 0){
+        sdl_poll_events(p, ctx);
+    }
+}
+
+static void sdl_set_sound(platform* p, const chip8* chip8_ctx, uint8_t on){
+    sdl_platform* sdl = p->data;
+    sound_voice voice;
+    get_voice(&voice, chip8_ctx, on);
+    set_audio_voice(&sdl->audio, &voice);
+}
+
+static void sdl_show_stats(platform* p, const char* text){
+    sdl_platform* sdl = p->data;
+    SDL_LockMutex(sdl->stats_lock);
+    snprintf(sdl->stats, sizeof(sdl->stats), "%s", text);
+    sdl->stats_fresh = 1;
+    SDL_UnlockMutex(sdl->stats_lock);
+    wake_main(sdl);
+}
+
+
+// main thread side
+
+static void send_command(sdl_platform* sdl, uint32_t command){
+    fetch_or_u32(&sdl->commands, command);
+    SDL_SemPost(sdl->input_ready);
+}
+
+static void set_key(platform* p, const SDL_KeyboardEvent* key, uint8_t down){
+    sdl_platform* sdl = p->data;
+    if(key->repeat || (unsigned)key->keysym.scancode >= SDL_NUM_SCANCODES || KEY_FOR_SCANCODE[key->keysym.scancode] < 0){
+        return;
+    }
+    uint16_t bit = 1 << KEY_FOR_SCANCODE[key->keysym.scancode];
+    uint16_t keys = down ? sdl->keys | bit : sdl->keys & ~bit;
+    if(keys != sdl->keys){
+        // back date the stamp to when SDL queued the event, so latency covers the wait for the next poll
+        uint32_t age_ms = SDL_GetTicks() - key->timestamp;
+        uint64_t now = time_ns();
+        uint64_t age_ns = age_ms < 1000 ? age_ms * 1000000ULL : 0;
+        sdl->keys = keys;
+        publish_keys(&p->keys, keys, now > age_ns ? now - age_ns : now);
+        SDL_SemPost(sdl->input_ready);
+    }
+}
+
+static void handle_event(platform* p, const SDL_Event* e){
+    sdl_platform* sdl = p->data;
+    switch (e->type) {
+        case SDL_KEYDOWN:
+            switch (e->key.keysym.sym) {
+                case SDLK_ESCAPE:
+                    send_command(sdl, COMMAND_EXIT);
+                    break;
+                case SDLK_SPACE:
+                    send_command(sdl, COMMAND_PAUSE);
+                    break;
+                case SDLK_F5:
+                    send_command(sdl, COMMAND_RESET);
+                    break;
+                case SDLK_BACKSPACE:
+                    store_release_u32(&sdl->rewinding, 1);
+                    SDL_SemPost(sdl->input_ready);
+                    break;
+                case SDLK_F6:
+                    send_command(sdl, COMMAND_SAVE);
+                    break;
+                case SDLK_F9:
+                    send_command(sdl, COMMAND_LOAD);
+                    break;
+                case SDLK_F8:
+                    send_command(sdl, COMMAND_TRACE);
+                    break;
+                case SDLK_F1:
+                    sdl->overlay = !sdl->overlay;
+                    if(!sdl->overlay){
+                        SDL_SetWindowTitle(sdl->g_ctx.window, WINDOW_TITLE);
+                    }
+                    break;
+                default:
+                    break;
+            }
+            set_key(p, &e->key, 1);
+            break;
+        case SDL_KEYUP:
+            if(e->key.keysym.sym == SDLK_BACKSPACE){
+                store_release_u32(&sdl->rewinding, 0);
+                SDL_SemPost(sdl->input_ready);
+            }
+            set_key(p, &e->key, 0);
+            break;
+        case SDL_QUIT:
+            send_command(sdl, COMMAND_EXIT);
+    }
+}
+
+static void present_frame(sdl_platform* sdl){
+    const video_frame* frame = take_frame(&sdl->frames);
+    if(!frame){
+        return;
+    }
+    // frames in between may have been dropped, so work out the changed rows here
+    uint64_t dirty_rows = 0;
+    for(int p = 0; p < NUM_PLANES; p++){
+        for(int y = 0; y < SCREEN_HEIGHT; y++){
+            if(memcmp(sdl->shown[p][y], frame->screen[p][y], sizeof(sdl->shown[p][y])) != 0){
+                dirty_rows |= 1ULL << y;
+            }
+        }
+    }
+    memcpy(sdl->shown, frame->screen, sizeof(sdl->shown));
+    if(render_graphics(&sdl->g_ctx, frame->screen, dirty_rows)){
+        fetch_add_u64(&sdl->presented, 1);
+    }else{
+        fetch_add_u64(&sdl->unchanged, 1);
+    }
+}
+
+static void show_title(sdl_platform* sdl){
+    char title[sizeof(sdl->stats) + sizeof(WINDOW_TITLE) + 3];
+    uint8_t fresh;
+    SDL_LockMutex(sdl->stats_lock);
+    if((fresh = sdl->stats_fresh && sdl->overlay)){
+        snprintf(title, sizeof(title), "%s | %s", WINDOW_TITLE, sdl->stats);
+    }
+    sdl->stats_fresh = 0;
+    SDL_UnlockMutex(sdl->stats_lock);
+    if(fresh){
+        SDL_SetWindowTitle(sdl->g_ctx.window, title);
+    }
+}
+
+static void sdl_run(platform* p, int (*loop)(void* arg), void* arg){
+    sdl_platform* sdl = p->data;
+    sdl->loop = loop;
+    sdl->loop_arg = arg;
+    sdl->emulation_thread = SDL_CreateThread(emulation_main, "emulation", sdl);
+    if(!sdl->emulation_thread){
+        printf(
+            "ERROR > Could not start the emulation thread \n"
+            "SDL_ERROR > %s \n",
+            SDL_GetError()
+        );
+        exit(EXIT_FAILURE);
+    }
+
+    while(!load_acquire_u32(&sdl->done)){
+        SDL_Event e;
+        // the timeout only matters if a wake up event got lost to a full queue
+        if(SDL_WaitEventTimeout(&e, 100)){
+            do{
+                handle_event(p, &e);
+            }while(SDL_PollEvent(&e));
+        }
+        present_frame(sdl);
+        show_title(sdl);
+    }
+    SDL_WaitThread(sdl->emulation_thread, NULL);
+    sdl->emulation_thread = NULL;
+}
+
+static void sdl_destroy(platform* p){
+    sdl_platform* sdl = p->data;
+    SDL_DestroySemaphore(sdl->input_ready);
+    SDL_DestroyMutex(sdl->stats_lock);
+    close_audio(&sdl->audio);
+    free_graphics(&sdl->g_ctx);
+    free(sdl);
+    p->data = NULL;
+}
+
+void init_sdl_platform(platform* p, const char* state_path, uint16_t audio_buffer){
+    sdl_platform* sdl = malloc(sizeof(sdl_platform));
+    if(!sdl){
+        printf("ERROR > Could not allocate SDL platform \n");
+        exit(EXIT_FAILURE);
+    }
+
+    sdl->g_ctx.width = SCREEN_WIDTH;
+    sdl->g_ctx.height = SCREEN_HEIGHT;
+    sdl->g_ctx.scale = WINDOW_WIDTH / SCREEN_WIDTH;
+    get_graphics_context(&sdl->g_ctx);
+    init_renderer(&sdl->g_ctx);
+    open_audio(&sdl->audio, audio_buffer);
+    sdl->overlay = 0;
+    sdl->state_path = state_path;
+    sdl->keys = 0;
+    memset(KEY_FOR_SCANCODE, -1, sizeof(KEY_FOR_SCANCODE));
+    for(int8_t k = 0; k < NUM_KEYS; k++){
+        KEY_FOR_SCANCODE[KEYMAP[k]] = k;
+    }
+    publish_keys(&p->keys, 0, 0);
+
+    sdl->emulation_thread = NULL;
+    sdl->done = 0;
+    init_triple_buffer(&sdl->frames);
+    memset(sdl->shown, 0, sizeof(sdl->shown));
+    sdl->presented = 0;
+    sdl->unchanged = 0;
+    sdl->dropped = 0;
+    sdl->commands = 0;
+    sdl->rewinding = 0;
+    sdl->stats[0] = '\0';
+    sdl->stats_fresh = 0;
+    sdl->wake_event = SDL_RegisterEvents(1);
+    sdl->input_ready = SDL_CreateSemaphore(0);
+    sdl->stats_lock = SDL_CreateMutex();
+    if(sdl->wake_event == (uint32_t)-1 || !sdl->input_ready || !sdl->stats_lock){
+        printf(
+            "ERROR > Could not set up the emulation thread \n"
+            "SDL_ERROR > %s \n",
+            SDL_GetError()
+        );
+        exit(EXIT_FAILURE);
+    }
+
+    p->data = sdl;
+    p->run = sdl_run;
+    p->render = sdl_render;
+    p->poll_events = sdl_poll_events;
+    p->wait_events = sdl_wait_events;
+    p->set_sound = sdl_set_sound;
+    p->show_stats = sdl_show_stats;
+    p->destroy = sdl_destroy;
+}
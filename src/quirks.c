@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "quirks.h"
+
+#define MAX_LINE 1024
+
+static const char* PROFILE_NAMES[NUM_PROFILES] = {
+        "default",
+        "chip8",
+        "schip",
+        "xochip"
+};
+
+
+int parse_profile(const char* name, QUIRK_PROFILE* profile){
+    for(int i = 0; i < NUM_PROFILES; i++){
+        if(strcmp(name, PROFILE_NAMES[i]) == 0){
+            *profile = (QUIRK_PROFILE)i;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+const char* profile_name(QUIRK_PROFILE profile){
+    return PROFILE_NAMES[profile];
+}
+
+quirk_db* quirk_db_read(const char* path){
+    FILE* input = fopen(path, "r");
+    if(!input){
+        return NULL;
+    }
+    quirk_db* db = calloc(1, sizeof(quirk_db));
+    uint32_t capacity = 0;
+    char line[MAX_LINE];
+    char name[MAX_LINE];
+    unsigned long long hash;
+    QUIRK_PROFILE profile;
+
+    while(db && fgets(line, sizeof(line), input)){
+        // the rest of the line is free for the title
+        if(line[0] == '#' || sscanf(line, "%llx %1023s", &hash, name) != 2 || !parse_profile(name, &profile)){
+            continue;
+        }
+        if(db->count == capacity){
+            capacity = capacity ? capacity * 2 : 64;
+            quirk_entry* entries = realloc(db->entries, capacity * sizeof(quirk_entry));
+            if(!entries){
+                quirk_db_free(db);
+                db = NULL;
+                break;
+            }
+            db->entries = entries;
+        }
+        db->entries[db->count].hash = hash;
+        db->entries[db->count].profile = profile;
+        db->count++;
+    }
+    fclose(input);
+    return db;
+}
+
+void quirk_db_free(quirk_db* db){
+    if(!db){
+        return;
+    }
+    free(db->entries);
+    free(db);
+}
+
+int quirk_db_lookup(const quirk_db* db, uint64_t hash, QUIRK_PROFILE* profile){
+    if(!db){
+        return 0;
+    }
+    for(uint32_t i = 0; i < db->count; i++){
+        if(db->entries[i].hash == hash){
+            *profile = db->entries[i].profile;
+            return 1;
+        }
+    }
+    return 0;
+}
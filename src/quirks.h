@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+* Quirk profiles. The CHIP-8 descendants disagree on a handful of opcodes and
+* ROMs written for one often misbehave on another. A profile fixes every
+* choice at once, the interpreter is compiled once per profile with the
+* quirks as constants (see interp_core.h) and the recompilers bake them in
+* when they emit a block, so no engine looks at a quirk flag per instruction.
+* execute() is the reference and reads them as it goes.
+*
+* A ROM's profile comes from --quirks or, failing that, from a database of
+* "<program hash> <profile> [title]" lines, see quirk_db_read().
+*/
+
+#define QUIRK_SHIFT_VY 0x01         // 8XY6/8XYE shift Vy into Vx instead of Vx in place
+#define QUIRK_MEMORY_I 0x02         // FX55/FX65 leave I past the last register moved
+#define QUIRK_ADD_I_VF 0x04         // FX1E sets VF, 1 unless I + Vx overflows 16 bits
+#define QUIRK_JUMP_VX 0x08          // BXNN jumps to XNN + Vx instead of NNN + V0
+#define QUIRK_WRAP 0x10             // sprite pixels past an edge wrap around instead of being clipped
+
+// quirks of every profile, constants so the specialized cores fold them away
+#define DEFAULT_QUIRKS QUIRK_ADD_I_VF
+#define CHIP8_QUIRKS (QUIRK_SHIFT_VY | QUIRK_MEMORY_I)
+#define SCHIP_QUIRKS QUIRK_JUMP_VX
+#define XOCHIP_QUIRKS (QUIRK_SHIFT_VY | QUIRK_MEMORY_I | QUIRK_WRAP)
+
+#define QUIRK_DB "quirks.txt"       // looked up in the working directory unless given
+
+typedef enum {
+    PROFILE_DEFAULT = 0,            // what this emulator always did
+    PROFILE_CHIP8 = 1,              // COSMAC VIP interpreter
+    PROFILE_SCHIP = 2,              // SUPER-CHIP 1.1
+    PROFILE_XOCHIP = 3,
+    NUM_PROFILES
+} QUIRK_PROFILE;
+
+static const uint8_t PROFILE_QUIRKS[NUM_PROFILES] = {
+        DEFAULT_QUIRKS,
+        CHIP8_QUIRKS,
+        SCHIP_QUIRKS,
+        XOCHIP_QUIRKS
+};
+
+typedef struct {
+    uint64_t hash;
+    QUIRK_PROFILE profile;
+} quirk_entry;
+
+typedef struct {
+    quirk_entry* entries;
+    uint32_t count;
+} quirk_db;
+
+// parse a profile name as given to --quirks, returns 0 if it is not known
+int parse_profile(const char* name, QUIRK_PROFILE* profile);
+
+const char* profile_name(QUIRK_PROFILE profile);
+
+/*
+* Read a profile database, NULL if the file cannot be opened. Blank lines,
+* lines starting with # and lines naming an unknown profile are skipped.
+*/
+quirk_db* quirk_db_read(const char* path);
+
+void quirk_db_free(quirk_db* db);
+
+// profile listed for a program_hash(), returns 0 if there is none or db is NULL
+int quirk_db_lookup(const quirk_db* db, uint64_t hash, QUIRK_PROFILE* profile);
@@ -0,0 +1,224 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "rewind.h"
+
+#define SNAPSHOT_BYTES SNAPSHOT_STATE_SIZE
+// worst case of the encoding, alternating changed and unchanged bytes
+#define MAX_RECORD_SIZE (2 * SNAPSHOT_BYTES + 16)
+
+// keyframes are encoded against an all zero state
+static const chip8_snapshot ZERO_STATE;
+
+
+rewind_buffer* rewind_create(size_t arena_size, uint32_t max_frames, uint32_t keyframe_interval){
+    if(arena_size < 2 * MAX_RECORD_SIZE || max_frames < 2){
+        return NULL;
+    }
+    rewind_buffer* buffer = calloc(1, sizeof(rewind_buffer));
+    if(!buffer){
+        return NULL;
+    }
+    buffer->arena = malloc(arena_size);
+    if(buffer->arena){
+        // touch every page now rather than one page fault at a time while playing
+        memset(buffer->arena, 0, arena_size);
+    }
+    buffer->records = malloc(max_frames * sizeof(rewind_record));
+    // zeroed once so the struct padding never shows up as a change and neither matches a context yet
+    buffer->current = calloc(1, sizeof(chip8_snapshot));
+    buffer->last = calloc(1, sizeof(chip8_snapshot));
+    if(!buffer->arena || !buffer->records || !buffer->current || !buffer->last){
+        rewind_free(buffer);
+        return NULL;
+    }
+    buffer->arena_size = arena_size;
+    buffer->max_frames = max_frames;
+    buffer->keyframe_interval = keyframe_interval ? keyframe_interval : 1;
+    return buffer;
+}
+
+void rewind_free(rewind_buffer* buffer){
+    if(!buffer){
+        return;
+    }
+    free(buffer->arena);
+    free(buffer->records);
+    free(buffer->current);
+    free(buffer->last);
+    free(buffer);
+}
+
+static uint8_t* write_varint(uint8_t* out, size_t value){
+    while(value >= 0x80){
+        *out++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (uint8_t)value;
+    return out;
+}
+
+static const uint8_t* read_varint(const uint8_t* in, size_t* value){
+    size_t result = 0;
+    int shift = 0;
+    do {
+        result |= (size_t)(*in & 0x7f) << shift;
+        shift += 7;
+    } while(*in++ & 0x80);
+    *value = result;
+    return in;
+}
+
+static uint64_t load64(const uint8_t* p){
+    uint64_t value;
+    memcpy(&value, p, 8);
+    return value;
+}
+
+/*
+* cur XOR prev as runs of (unchanged byte count, changed byte count, changed
+* bytes XORed). Unchanged stretches are skipped a word at a time, ranges known
+* to be unchanged are not looked at at all.
+*/
+typedef struct {
+    uint8_t* out;
+    size_t unchanged;               // bytes since the last change, not written out yet
+} delta_writer;
+
+static void encode_range(delta_writer* w, const uint8_t* cur, const uint8_t* prev, size_t from, size_t to){
+    size_t i = from;
+    while(i < to){
+        size_t run = i;
+        while(i + 8 <= to && load64(cur + i) == load64(prev + i)){
+            i += 8;
+        }
+        while(i < to && cur[i] == prev[i]){
+            i++;
+        }
+        w->unchanged += i - run;
+        if(i == to){
+            break;
+        }
+
+        size_t literal = i;
+        while(i < to && cur[i] != prev[i]){
+            i++;
+        }
+        w->out = write_varint(w->out, w->unchanged);
+        w->out = write_varint(w->out, i - literal);
+        for(size_t j = literal; j < i; j++){
+            *w->out++ = cur[j] ^ prev[j];
+        }
+        w->unchanged = 0;
+    }
+}
+
+// cur against prev, only the memory pages the context wrote since prev was saved from it can differ
+static size_t encode_delta(const chip8_snapshot* cur, const chip8_snapshot* prev, const chip8* chip8_ctx, uint8_t* out){
+    delta_writer w = {out, 0};
+    // mem comes first in a snapshot
+    for(uint32_t p = 0; p < NUM_PAGES; p++){
+        if(prev->epoch != chip8_ctx->mem_epoch || chip8_ctx->page_stamp[p] > prev->stamp){
+            encode_range(&w, (const uint8_t*)cur, (const uint8_t*)prev, p * MEM_PAGE_SIZE, (p + 1) * MEM_PAGE_SIZE);
+        }else{
+            w.unchanged += MEM_PAGE_SIZE;
+        }
+    }
+    encode_range(&w, (const uint8_t*)cur, (const uint8_t*)prev, RAM_SIZE, SNAPSHOT_BYTES);
+    if(w.unchanged){
+        w.out = write_varint(w.out, w.unchanged);
+        w.out = write_varint(w.out, 0);
+    }
+    return w.out - out;
+}
+
+static void apply_delta(uint8_t* state, const uint8_t* in, size_t size){
+    const uint8_t* end = in + size;
+    size_t at = 0;
+    while(in < end){
+        size_t run, literal;
+        in = read_varint(in, &run);
+        in = read_varint(in, &literal);
+        at += run;
+        for(size_t j = 0; j < literal; j++){
+            state[at++] ^= *in++;
+        }
+    }
+}
+
+static rewind_record* record_at(rewind_buffer* buffer, uint32_t index){
+    return &buffer->records[(buffer->first + index) % buffer->max_frames];
+}
+
+static void drop_oldest(rewind_buffer* buffer){
+    buffer->first = (buffer->first + 1) % buffer->max_frames;
+    buffer->count--;
+}
+
+void rewind_capture(rewind_buffer* buffer, const chip8* chip8_ctx){
+    // room for a worst case record, wrapping to the start of the arena if the end is too close
+    if(buffer->write_at + MAX_RECORD_SIZE > buffer->arena_size){
+        buffer->write_at = 0;
+    }
+    size_t window_end = buffer->write_at + MAX_RECORD_SIZE;
+    while(buffer->count){
+        rewind_record* oldest = record_at(buffer, 0);
+        uint8_t overlaps = oldest->offset < window_end && oldest->offset + oldest->size > buffer->write_at;
+        if(!overlaps && buffer->count < buffer->max_frames){
+            break;
+        }
+        drop_oldest(buffer);
+    }
+    // history has to start at a keyframe
+    while(buffer->count && !record_at(buffer, 0)->keyframe){
+        drop_oldest(buffer);
+    }
+
+    save_snapshot(chip8_ctx, buffer->current);
+
+    uint8_t keyframe = buffer->count == 0 || buffer->since_keyframe + 1 >= buffer->keyframe_interval;
+    rewind_record* record = record_at(buffer, buffer->count);
+    record->offset = buffer->write_at;
+    record->keyframe = keyframe;
+    record->size = encode_delta(buffer->current, keyframe ? &ZERO_STATE : buffer->last, chip8_ctx, buffer->arena + buffer->write_at);
+    buffer->count++;
+    buffer->write_at += record->size;
+    buffer->since_keyframe = keyframe ? 0 : buffer->since_keyframe + 1;
+
+    chip8_snapshot* swap = buffer->last;
+    buffer->last = buffer->current;
+    buffer->current = swap;
+}
+
+int rewind_step(rewind_buffer* buffer, chip8* chip8_ctx){
+    if(buffer->count < 2){
+        return 0;
+    }
+
+    rewind_record* newest = record_at(buffer, buffer->count - 1);
+    buffer->count--;
+    buffer->write_at = newest->offset;
+
+    if(!newest->keyframe){
+        // XOR is its own inverse, undoing the delta gives the frame before
+        apply_delta((uint8_t*)buffer->last, buffer->arena + newest->offset, newest->size);
+        buffer->since_keyframe--;
+    }else{
+        // rebuild forward from the keyframe before it
+        uint32_t key = buffer->count - 1;
+        while(!record_at(buffer, key)->keyframe){
+            key--;
+        }
+        memset(buffer->last, 0, SNAPSHOT_BYTES);
+        for(uint32_t i = key; i < buffer->count; i++){
+            rewind_record* record = record_at(buffer, i);
+            apply_delta((uint8_t*)buffer->last, buffer->arena + record->offset, record->size);
+        }
+        buffer->since_keyframe = buffer->count - 1 - key;
+    }
+
+    // the deltas changed its memory behind the page stamps
+    buffer->last->epoch = 0;
+    load_snapshot(chip8_ctx, buffer->last);
+    return 1;
+}
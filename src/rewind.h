@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip8.h"
+#include "snapshot.h"
+
+/*
+* Rewind history. Every captured frame is stored as the XOR of its snapshot
+* against the one before, run-length encoded, so unchanged memory and screen
+* cost next to nothing. Every keyframe_interval frames the snapshot is stored
+* whole (encoded against zero) so the oldest frames can be dropped without
+* losing the base later deltas build on. Records live in a byte ring allocated
+* up front, the oldest frames are evicted when it or the frame limit is full.
+*/
+
+#define REWIND_ARENA_SIZE (16 * 1024 * 1024)
+#define REWIND_KEYFRAME_INTERVAL 60
+
+typedef struct {
+    size_t offset;                  // into the arena
+    size_t size;
+    uint8_t keyframe;
+} rewind_record;
+
+typedef struct {
+    uint8_t* arena;
+    size_t arena_size;
+    size_t write_at;
+
+    rewind_record* records;         // ring of max_frames, oldest at first
+    uint32_t max_frames;
+    uint32_t first;
+    uint32_t count;
+    uint32_t keyframe_interval;
+    uint32_t since_keyframe;
+
+    chip8_snapshot* current;        // scratch for the frame being captured
+    chip8_snapshot* last;           // state of the newest record
+} rewind_buffer;
+
+rewind_buffer* rewind_create(size_t arena_size, uint32_t max_frames, uint32_t keyframe_interval);
+
+void rewind_free(rewind_buffer* buffer);
+
+// record the current machine state as the newest frame
+void rewind_capture(rewind_buffer* buffer, const chip8* chip8_ctx);
+
+// drop the newest frame and load the one before it, returns 0 once there is nothing older
+int rewind_step(rewind_buffer* buffer, chip8* chip8_ctx);
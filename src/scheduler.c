@@ -0,0 +1,53 @@
+#ifdef WIN32
+#include <windows.h>
+#endif
+
+#include "chip8.h"
+#include "scheduler.h"
+#include "utils.h"
+
+// drop frames instead of trying to catch up when the host falls this far behind
+#define MAX_FRAME_LAG 4
+
+
+void init_scheduler(scheduler* s, uint32_t ipf, uint32_t turbo, uint8_t uncapped){
+    s->ipf = ipf;
+    s->turbo = turbo ? turbo : 1;
+    s->uncapped = uncapped;
+    s->frame_ns = 1000000000ULL / FRAME_RATE;
+    s->next_frame = time_ns() + s->frame_ns;
+#ifdef WIN32
+    // ask for 1 ms sleep granularity instead of the default ~15 ms
+    timeBeginPeriod(1);
+#endif
+}
+
+static void advance(scheduler* s, uint64_t now){
+    s->next_frame += s->frame_ns;
+    if(now > s->next_frame + MAX_FRAME_LAG * s->frame_ns){
+        s->next_frame = now + s->frame_ns;
+    }
+}
+
+uint8_t frame_due(scheduler* s){
+    uint64_t now = time_ns();
+    if(now < s->next_frame){
+        return 0;
+    }
+    advance(s, now);
+    return 1;
+}
+
+uint64_t until_next_frame(const scheduler* s){
+    uint64_t now = time_ns();
+    return now < s->next_frame ? s->next_frame - now : 0;
+}
+
+void wait_next_frame(scheduler* s){
+    uint64_t now = time_ns();
+    if(now < s->next_frame){
+        sleep_ns(s->next_frame - now);
+        now = time_ns();
+    }
+    advance(s, now);
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+* Paces emulation against the host clock. Every host frame (1/60 s) the main
+* loop runs `turbo` emulated frames of `ipf` instructions each, counting the
+* timers down after every emulated frame, then sleeps once until the next
+* frame boundary. Uncapped mode never sleeps and only uses the frame clock
+* to decide when to poll input and present.
+*/
+
+typedef struct {
+    uint32_t ipf;                   // instructions per emulated frame
+    uint32_t turbo;                 // emulated frames per host frame
+    uint8_t uncapped;
+    uint64_t frame_ns;
+    uint64_t next_frame;            // host time of the next frame boundary
+} scheduler;
+
+void init_scheduler(scheduler* s, uint32_t ipf, uint32_t turbo, uint8_t uncapped);
+
+// 1 once the current host frame is over, advancing to the next one
+uint8_t frame_due(scheduler* s);
+
+// host time left until the next frame boundary
+uint64_t until_next_frame(const scheduler* s);
+
+// sleep until the next host frame boundary
+void wait_next_frame(scheduler* s);
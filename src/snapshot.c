@@ -0,0 +1,151 @@
+#include <string.h>
+
+#include "snapshot.h"
+
+typedef struct {
+    size_t offset;
+    size_t size;
+} snapshot_field;
+
+#define FIELD(name) {offsetof(chip8_snapshot, name), sizeof(((chip8_snapshot*)0)->name)}
+
+// the order of a save state file
+static const snapshot_field FIELDS[] = {
+        FIELD(mem), FIELD(stack), FIELD(flags), FIELD(v), FIELD(I), FIELD(pc), FIELD(sp),
+        FIELD(delay_timer), FIELD(sound_timer), FIELD(screen_mode), FIELD(planes), FIELD(pitch),
+        FIELD(xo_audio), FIELD(profile), FIELD(audio_pattern), FIELD(seed), FIELD(rng), FIELD(screen)
+};
+
+#define NUM_FIELDS (sizeof(FIELDS) / sizeof(FIELDS[0]))
+
+static uint32_t state_size(void){
+    size_t size = 0;
+    for(size_t i = 0; i < NUM_FIELDS; i++){
+        size += FIELDS[i].size;
+    }
+    return (uint32_t)size;
+}
+
+// whether a page of the context may differ from the snapshot, only pages written since it was saved can
+static int page_changed(const chip8* chip8_ctx, const chip8_snapshot* snapshot, uint32_t page){
+    return snapshot->epoch != chip8_ctx->mem_epoch || chip8_ctx->page_stamp[page] > snapshot->stamp;
+}
+
+void save_snapshot(const chip8* chip8_ctx, chip8_snapshot* snapshot){
+    for(uint32_t p = 0; p < NUM_PAGES; p++){
+        if(page_changed(chip8_ctx, snapshot, p)){
+            memcpy(snapshot->mem + p * MEM_PAGE_SIZE, chip8_ctx->mem + p * MEM_PAGE_SIZE, MEM_PAGE_SIZE);
+        }
+    }
+    snapshot->epoch = chip8_ctx->mem_epoch;
+    snapshot->stamp = chip8_ctx->mem_stamp;
+    memcpy(snapshot->stack, chip8_ctx->stack, sizeof(snapshot->stack));
+    memcpy(snapshot->flags, chip8_ctx->flags, NUM_FLAGS);
+    memcpy(snapshot->v, chip8_ctx->v, NUM_REGISTERS);
+    snapshot->I = chip8_ctx->I;
+    snapshot->pc = chip8_ctx->pc;
+    snapshot->sp = chip8_ctx->sp;
+    snapshot->delay_timer = chip8_ctx->delay_timer;
+    snapshot->sound_timer = chip8_ctx->sound_timer;
+    snapshot->screen_mode = (uint8_t)chip8_ctx->screen_mode;
+    snapshot->planes = chip8_ctx->planes;
+    snapshot->pitch = chip8_ctx->pitch;
+    snapshot->xo_audio = chip8_ctx->xo_audio;
+    snapshot->profile = (uint8_t)chip8_ctx->profile;
+    memcpy(snapshot->audio_pattern, chip8_ctx->audio_pattern, AUDIO_PATTERN_SIZE);
+    snapshot->seed = chip8_ctx->seed;
+    snapshot->rng = chip8_ctx->rng;
+    memcpy(snapshot->screen, chip8_ctx->screen, sizeof(snapshot->screen));
+}
+
+int load_snapshot(chip8* chip8_ctx, const chip8_snapshot* snapshot){
+    if(snapshot->profile != chip8_ctx->profile){
+        return 0;
+    }
+    // only the range that differs needs its cached decodes and blocks dropped
+    int first = -1, last = -1;
+    for(uint32_t p = 0; p < NUM_PAGES; p++){
+        int at = p * MEM_PAGE_SIZE;
+        if(!page_changed(chip8_ctx, snapshot, p) || memcmp(chip8_ctx->mem + at, snapshot->mem + at, MEM_PAGE_SIZE) == 0){
+            continue;
+        }
+        if(first < 0){
+            first = at;
+            while(chip8_ctx->mem[first] == snapshot->mem[first]){
+                first++;
+            }
+        }
+        last = at + MEM_PAGE_SIZE - 1;
+        while(chip8_ctx->mem[last] == snapshot->mem[last]){
+            last--;
+        }
+    }
+    if(first >= 0){
+        memcpy(chip8_ctx->mem + first, snapshot->mem + first, last - first + 1);
+        mem_written(chip8_ctx, (uint16_t)first, (uint32_t)(last - first + 1));
+    }
+
+    memcpy(chip8_ctx->stack, snapshot->stack, sizeof(snapshot->stack));
+    memcpy(chip8_ctx->flags, snapshot->flags, NUM_FLAGS);
+    memcpy(chip8_ctx->v, snapshot->v, NUM_REGISTERS);
+    chip8_ctx->I = snapshot->I;
+    chip8_ctx->pc = snapshot->pc;
+    chip8_ctx->sp = snapshot->sp;
+    chip8_ctx->delay_timer = snapshot->delay_timer;
+    chip8_ctx->sound_timer = snapshot->sound_timer;
+    chip8_ctx->screen_mode = (SCREEN_MODE)snapshot->screen_mode;
+    chip8_ctx->planes = snapshot->planes;
+    chip8_ctx->pitch = snapshot->pitch;
+    chip8_ctx->xo_audio = snapshot->xo_audio;
+    memcpy(chip8_ctx->audio_pattern, snapshot->audio_pattern, AUDIO_PATTERN_SIZE);
+    chip8_ctx->seed = snapshot->seed;
+    chip8_ctx->rng = snapshot->rng;
+    memcpy(chip8_ctx->screen, snapshot->screen, sizeof(snapshot->screen));
+
+    chip8_ctx->draw = 1;
+    chip8_ctx->dirty_rows = ~0ULL;
+    chip8_ctx->spin_length = 0;
+    chip8_ctx->idle = 0;
+    return 1;
+}
+
+int write_snapshot(const chip8_snapshot* snapshot, const char* path){
+    FILE* out = fopen(path, "wb");
+    if(!out){
+        return 0;
+    }
+    snapshot_header header;
+    memcpy(header.magic, SNAPSHOT_MAGIC, 4);
+    header.version = SNAPSHOT_VERSION;
+    header.size = state_size();
+    int ok = fwrite(&header, sizeof(header), 1, out) == 1;
+    for(size_t i = 0; ok && i < NUM_FIELDS; i++){
+        ok = fwrite((const uint8_t*)snapshot + FIELDS[i].offset, FIELDS[i].size, 1, out) == 1;
+    }
+    return fclose(out) == 0 && ok;
+}
+
+int read_snapshot(chip8_snapshot* snapshot, const char* path){
+    FILE* input = fopen(path, "rb");
+    if(!input){
+        return 0;
+    }
+    // zeroed so no padding is left uninitialized, and the memory came from a file rather than any context
+    memset(snapshot, 0, sizeof(chip8_snapshot));
+    snapshot_header header;
+    int ok = fread(&header, sizeof(header), 1, input) == 1
+             && memcmp(header.magic, SNAPSHOT_MAGIC, 4) == 0
+             && header.version == SNAPSHOT_VERSION
+             && header.size == state_size();
+    for(size_t i = 0; ok && i < NUM_FIELDS; i++){
+        ok = fread((uint8_t*)snapshot + FIELDS[i].offset, FIELDS[i].size, 1, input) == 1;
+    }
+    // nothing the guest could not have got into on its own
+    ok = ok && snapshot->sp <= STACK_SIZE
+         && snapshot->screen_mode <= HIGH_RES128
+         && snapshot->planes < (1 << NUM_PLANES)
+         && snapshot->profile < NUM_PROFILES
+         && snapshot->rng != 0;
+    fclose(input);
+    return ok;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip8.h"
+
+/*
+* Save states. A snapshot is the guest visible machine state only, host side
+* parts of the context (input, caches, recompiled code, counters, trace) are
+* left alone. A snapshot remembers the context it was last saved from and the
+* mem_stamp at the time, saving that context into it again copies only the
+* memory pages written since and restoring it only compares those, so taking
+* one from a running machine costs about its registers and screen. Restoring
+* throws away cached code for the memory that actually differs.
+*/
+
+#define SNAPSHOT_MAGIC "C8ST"
+#define SNAPSHOT_VERSION 4
+
+typedef struct {
+    uint8_t mem[RAM_SIZE];
+    uint16_t stack[STACK_SIZE];
+    uint8_t flags[NUM_FLAGS];
+    uint8_t v[NUM_REGISTERS];
+    uint16_t I;
+    uint16_t pc;
+    uint16_t sp;
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    uint8_t screen_mode;
+    uint8_t planes;
+    uint8_t pitch;
+    uint8_t xo_audio;
+    uint8_t profile;                // QUIRK_PROFILE, the state only makes sense under the quirks it was reached with
+    uint8_t audio_pattern[AUDIO_PATTERN_SIZE];
+    uint64_t seed;
+    uint64_t rng;
+    uint64_t screen[NUM_PLANES][SCREEN_HEIGHT][SCREEN_ROW_WORDS];
+
+    // not part of the state, see save_snapshot()
+    uint64_t epoch;                 // mem_epoch of the context mem was saved from, 0 if none
+    uint64_t stamp;                 // its mem_stamp then
+} chip8_snapshot;
+
+// bytes of a snapshot that hold machine state, the ones rewind deltas cover
+#define SNAPSHOT_STATE_SIZE offsetof(chip8_snapshot, epoch)
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t size;                  // bytes of state that follow, the fields one after the other
+} snapshot_header;
+
+// snapshot has to be zeroed or have been used with the snapshot functions before
+void save_snapshot(const chip8* chip8_ctx, chip8_snapshot* snapshot);
+
+// returns 0 and leaves the machine alone if the snapshot was taken under another quirk profile
+int load_snapshot(chip8* chip8_ctx, const chip8_snapshot* snapshot);
+
+// save state files, both return 0 on failure. They go field by field so no struct padding ends up in a file
+int write_snapshot(const chip8_snapshot* snapshot, const char* path);
+int read_snapshot(chip8_snapshot* snapshot, const char* path);
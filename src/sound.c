@@ -0,0 +1,97 @@
+#include <math.h>
+#include <string.h>
+
+#include "sound.h"
+
+#define WAV_HEADER_SIZE 44
+
+
+void init_synth(sound_synth* synth){
+    for(int i = 0; i < WAVETABLE_SIZE; i++){
+        synth->sine[i] = (int16_t)(BEEP_AMPLITUDE * sin(2.0 * M_PI * i / WAVETABLE_SIZE));
+    }
+    synth->beep_step = (uint32_t)((double)BEEP_FREQUENCY / AUDIO_RATE * 4294967296.0);
+    // XO-CHIP plays 4000 * 2^((pitch - 64) / 48) pattern bits per second
+    for(int pitch = 0; pitch < 256; pitch++){
+        double bits_per_second = 4000.0 * pow(2.0, (pitch - 64) / 48.0);
+        synth->pitch_step[pitch] = (uint32_t)(bits_per_second / AUDIO_RATE * (4294967296.0 / WAVETABLE_SIZE));
+    }
+    memset(&synth->voice, 0, sizeof(synth->voice));
+    memset(synth->wavetable, 0, sizeof(synth->wavetable));
+    synth->phase = 0;
+    synth->step = 0;
+}
+
+void set_voice(sound_synth* synth, const sound_voice* voice){
+    synth->voice = *voice;
+    if(voice->xo){
+        for(int i = 0; i < WAVETABLE_SIZE; i++){
+            uint8_t bit = (voice->pattern[i >> 3] >> (7 - (i & 7))) & 1;
+            synth->wavetable[i] = bit ? PATTERN_AMPLITUDE : -PATTERN_AMPLITUDE;
+        }
+        synth->step = synth->pitch_step[voice->pitch];
+    }else{
+        memcpy(synth->wavetable, synth->sine, sizeof(synth->wavetable));
+        synth->step = synth->beep_step;
+    }
+}
+
+void render_sound(sound_synth* synth, int16_t* out, int count){
+    if(!synth->voice.on){
+        memset(out, 0, count * sizeof(int16_t));
+        return;
+    }
+    uint32_t phase = synth->phase;
+    for(int i = 0; i < count; i++){
+        out[i] = synth->wavetable[phase >> (32 - WAVETABLE_BITS)];
+        phase += synth->step;
+    }
+    synth->phase = phase;
+}
+
+static void put16(uint8_t* p, uint16_t value){
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+}
+
+static void put32(uint8_t* p, uint32_t value){
+    put16(p, (uint16_t)value);
+    put16(p + 2, (uint16_t)(value >> 16));
+}
+
+static int write_wav_header(FILE* file, uint32_t samples){
+    uint8_t header[WAV_HEADER_SIZE];
+    uint32_t data_size = samples * sizeof(int16_t);
+    memcpy(header, "RIFF", 4);
+    put32(header + 4, 36 + data_size);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    put32(header + 16, 16);                     // fmt chunk size
+    put16(header + 20, 1);                      // PCM
+    put16(header + 22, 1);                      // mono
+    put32(header + 24, AUDIO_RATE);
+    put32(header + 28, AUDIO_RATE * sizeof(int16_t));
+    put16(header + 32, sizeof(int16_t));
+    put16(header + 34, 16);
+    memcpy(header + 36, "data", 4);
+    put32(header + 40, data_size);
+    return fwrite(header, sizeof(header), 1, file) == 1;
+}
+
+int open_wav(wav_writer* wav, const char* path){
+    wav->samples = 0;
+    wav->file = fopen(path, "wb");
+    // sizes are patched in by close_wav once they are known
+    return wav->file && write_wav_header(wav->file, 0);
+}
+
+void write_wav(wav_writer* wav, const int16_t* samples, uint32_t count){
+    // WAV is little endian, so are all the hosts the emulator builds on
+    wav->samples += (uint32_t)fwrite(samples, sizeof(int16_t), count, wav->file);
+}
+
+int close_wav(wav_writer* wav){
+    int ok = fseek(wav->file, 0, SEEK_SET) == 0 && write_wav_header(wav->file, wav->samples);
+    ok = fclose(wav->file) == 0 && ok;
+    wav->file = NULL;
+    return ok;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "chip8.h"
+
+/*
+* Sound synthesis shared by the audio device and the WAV writer. Whatever the
+* guest plays, the classic beep or an XO-CHIP pattern, is first expanded into a
+* one period wavetable, then output is a table load per sample through a 32 bit
+* phase accumulator. The phase steps for every pitch are precomputed, so nothing
+* on the per sample path touches floating point.
+*/
+
+#define AUDIO_RATE 44100
+#define WAVETABLE_BITS 7
+#define WAVETABLE_SIZE (1 << WAVETABLE_BITS)    // one entry per XO-CHIP pattern bit
+#define BEEP_FREQUENCY 441
+#define BEEP_AMPLITUDE 12000
+#define PATTERN_AMPLITUDE 8000
+
+// what the guest wants to hear
+typedef struct {
+    uint8_t on;
+    uint8_t xo;                             // play the pattern instead of the beep
+    uint8_t pitch;
+    uint8_t pattern[AUDIO_PATTERN_SIZE];
+} sound_voice;
+
+typedef struct {
+    int16_t sine[WAVETABLE_SIZE];
+    uint32_t beep_step;
+    uint32_t pitch_step[256];               // pattern phase advance per sample for every pitch
+
+    sound_voice voice;
+    int16_t wavetable[WAVETABLE_SIZE];      // one period of the current voice
+    uint32_t phase;                         // top WAVETABLE_BITS index the wavetable
+    uint32_t step;
+} sound_synth;
+
+typedef struct {
+    FILE* file;
+    uint32_t samples;
+} wav_writer;
+
+static inline void get_voice(sound_voice* voice, const chip8* chip8_ctx, uint8_t on){
+    voice->on = on;
+    voice->xo = chip8_ctx->xo_audio;
+    voice->pitch = chip8_ctx->pitch;
+    memcpy(voice->pattern, chip8_ctx->audio_pattern, AUDIO_PATTERN_SIZE);
+}
+
+void init_synth(sound_synth* synth);
+
+void set_voice(sound_synth* synth, const sound_voice* voice);
+
+void render_sound(sound_synth* synth, int16_t* out, int count);
+
+// 16 bit mono at AUDIO_RATE, open and close return 0 on failure
+int open_wav(wav_writer* wav, const char* path);
+void write_wav(wav_writer* wav, const int16_t* samples, uint32_t count);
+int close_wav(wav_writer* wav);
@@ -0,0 +1,44 @@
+#include <string.h>
+
+#include "stats.h"
+
+
+void reset_stats(chip8_stats* stats){
+    memset(stats, 0, sizeof(chip8_stats));
+}
+
+static double per_second(uint64_t count, uint64_t elapsed_ns){
+    return elapsed_ns ? count * 1e9 / (double)elapsed_ns : 0.0;
+}
+
+void write_stats(FILE* out, const chip8_stats* stats, uint64_t elapsed_ns, uint64_t target_ips){
+    fprintf(out, "{\"elapsed_ms\": %.3f, \"instructions\": %llu, \"ips\": %.0f, \"target_ips\": %llu, "
+                 "\"frames\": %llu, \"rendered\": %llu, \"skipped\": %llu, \"pixels\": %llu, "
+                 "\"execute_ms\": %.3f, \"render_ms\": %.3f, \"wait_ms\": %.3f, "
+                 "\"key_changes\": %llu, \"key_latency_ms\": %.3f, \"key_latency_max_ms\": %.3f, \"ops\": [",
+            elapsed_ns / 1e6, (unsigned long long)stats->instructions, per_second(stats->instructions, elapsed_ns),
+            (unsigned long long)target_ips, (unsigned long long)stats->frames,
+            (unsigned long long)stats->frames_rendered, (unsigned long long)stats->frames_skipped,
+            (unsigned long long)stats->pixels_drawn, stats->execute_ns / 1e6, stats->render_ns / 1e6,
+            stats->wait_ns / 1e6, (unsigned long long)stats->key_changes,
+            stats->key_changes ? stats->key_latency_ns / 1e6 / stats->key_changes : 0.0,
+            stats->key_latency_max_ns / 1e6);
+    for(int i = 0; i < NUM_OP_CLASSES; i++){
+        fprintf(out, "%s%llu", i ? ", " : "", (unsigned long long)stats->op_class[i]);
+    }
+    fprintf(out, "], \"fusions\": [");
+    for(int i = 0; i < NUM_FUSIONS; i++){
+        fprintf(out, "%s%llu", i ? ", " : "", (unsigned long long)stats->fusions[i]);
+    }
+    fprintf(out, "], \"dispatches_saved\": %llu}\n", (unsigned long long)stats->dispatches_saved);
+    fflush(out);
+}
+
+void format_stats(char* buffer, size_t size, const chip8_stats* stats, uint64_t elapsed_ns, uint64_t target_ips){
+    double elapsed = elapsed_ns ? (double)elapsed_ns : 1.0;
+    snprintf(buffer, size, "%.0f / %llu ips | %.0f fps, %llu skipped | exec %.0f%% render %.0f%% wait %.0f%% | key %.1f ms",
+             per_second(stats->instructions, elapsed_ns), (unsigned long long)target_ips,
+             per_second(stats->frames_rendered, elapsed_ns), (unsigned long long)stats->frames_skipped,
+             100.0 * stats->execute_ns / elapsed, 100.0 * stats->render_ns / elapsed, 100.0 * stats->wait_ns / elapsed,
+             stats->key_latency_max_ns / 1e6);
+}
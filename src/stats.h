@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "utils.h"
+
+/*
+* Hot path counters, kept per context in chip8_ctx->stats. They are only
+* updated when built with CHIP8_STATS (the default, see CMakeLists.txt);
+* without it the STAT_* macros expand to nothing and the fields stay zero.
+*/
+
+#define NUM_OP_CLASSES 16
+#define NUM_FUSIONS 5               // fused instruction runs of the interpreter, see interp.c
+
+typedef struct {
+    uint64_t op_class[NUM_OP_CLASSES];  // instructions run by opcode high nibble, skipped spins not included
+    uint64_t instructions;              // everything the engines report as executed
+    uint64_t fusions[NUM_FUSIONS];      // fused runs the interpreter started, by kind
+    uint64_t dispatches_saved;          // instructions a fused run went on to without dispatching
+    uint64_t frames;                    // emulated frames, one per timer tick
+    uint64_t pixels_drawn;              // sprite pixels xored onto the screen by DXYN
+    uint64_t frames_rendered;
+    uint64_t frames_skipped;            // renders dropped because nothing changed
+    uint64_t execute_ns;                // host time in the engines
+    uint64_t render_ns;                 // host time in render, including present
+    uint64_t wait_ns;                   // host time blocked on events or the frame clock
+    uint64_t key_changes;               // host key state changes picked up by the core
+    uint64_t key_latency_ns;            // summed host time from key transition to the core seeing it
+    uint64_t key_latency_max_ns;
+} chip8_stats;
+
+#ifdef CHIP8_STATS
+#define STATS_ENABLED 1
+#define STAT_ADD(ctx, field, n) ((ctx)->stats.field += (n))
+// run code and add the host time it took to field
+#define STAT_TIMED(ctx, field, code) do { \
+        uint64_t stat_start_ = time_ns(); \
+        code; \
+        (ctx)->stats.field += time_ns() - stat_start_; \
+    } while(0)
+#else
+#define STATS_ENABLED 0
+#define STAT_ADD(ctx, field, n) ((void)0)
+#define STAT_TIMED(ctx, field, code) do { code; } while(0)
+#endif
+
+void reset_stats(chip8_stats* stats);
+
+// one JSON object per line, elapsed is the host time the counters cover
+void write_stats(FILE* out, const chip8_stats* stats, uint64_t elapsed_ns, uint64_t target_ips);
+
+// short human readable summary for the overlay
+void format_stats(char* buffer, size_t size, const chip8_stats* stats, uint64_t elapsed_ns, uint64_t target_ips);
@@ -0,0 +1,137 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+
+trace_ring* trace_create(uint32_t size, const char* path){
+    trace_ring* trace = malloc(sizeof(trace_ring));
+    if(!trace){
+        return NULL;
+    }
+    trace->entries = calloc(size, sizeof(trace_entry));
+    if(!trace->entries){
+        free(trace);
+        return NULL;
+    }
+    trace->mask = size - 1;
+    trace->cycle = 0;
+    trace->count = 0;
+    trace->path = path;
+    return trace;
+}
+
+void trace_free(trace_ring* trace){
+    if(!trace){
+        return;
+    }
+    free(trace->entries);
+    free(trace);
+}
+
+int64_t trace_dump(const trace_ring* trace){
+    FILE* out = fopen(trace->path, "wb");
+    if(!out){
+        return -1;
+    }
+
+    uint64_t size = (uint64_t)trace->mask + 1;
+    uint64_t count = trace->count < size ? trace->count : size;
+    trace_header header;
+    memcpy(header.magic, TRACE_MAGIC, 4);
+    header.version = TRACE_VERSION;
+    header.entry_size = sizeof(trace_entry);
+    header.count = (uint32_t)count;
+    fwrite(&header, sizeof(header), 1, out);
+
+    // the oldest record sits right after the newest once the ring has wrapped
+    for(uint64_t i = trace->count - count; i < trace->count; i++){
+        fwrite(&trace->entries[i & trace->mask], sizeof(trace_entry), 1, out);
+    }
+    fclose(out);
+    return (int64_t)count;
+}
+
+int trace_load(FILE* input, trace_entry** entries){
+    trace_header header;
+    if(fread(&header, sizeof(header), 1, input) != 1 || memcmp(header.magic, TRACE_MAGIC, 4) != 0
+       || header.version != TRACE_VERSION || header.entry_size != sizeof(trace_entry)){
+        return -1;
+    }
+    *entries = malloc((header.count ? header.count : 1) * sizeof(trace_entry));
+    if(!*entries){
+        return -1;
+    }
+    return (int)fread(*entries, sizeof(trace_entry), header.count, input);
+}
+
+void disassemble(uint16_t opcode, char* buffer, size_t size){
+    unsigned x = (opcode >> 8) & 0xf;
+    unsigned y = (opcode >> 4) & 0xf;
+    unsigned n = opcode & 0xf;
+    unsigned kk = opcode & 0xff;
+    unsigned addr = opcode & 0xfff;
+
+    switch (opcode >> 12) {
+        case 0x0:
+            if(opcode == 0x00E0) { snprintf(buffer, size, "CLS"); return; }
+            if(opcode == 0x00EE) { snprintf(buffer, size, "RET"); return; }
+            if(opcode == 0x00FB) { snprintf(buffer, size, "SCR"); return; }
+            if(opcode == 0x00FC) { snprintf(buffer, size, "SCL"); return; }
+            if(opcode == 0x00FD) { snprintf(buffer, size, "EXIT"); return; }
+            if(opcode == 0x00FE) { snprintf(buffer, size, "LOW"); return; }
+            if(opcode == 0x00FF) { snprintf(buffer, size, "HIGH"); return; }
+            if((opcode & 0xfff0) == 0x00C0) { snprintf(buffer, size, "SCD %X", n); return; }
+            snprintf(buffer, size, "SYS %03X", addr);
+            return;
+        case 0x1: snprintf(buffer, size, "JP %03X", addr); return;
+        case 0x2: snprintf(buffer, size, "CALL %03X", addr); return;
+        case 0x3: snprintf(buffer, size, "SE V%X, %02X", x, kk); return;
+        case 0x4: snprintf(buffer, size, "SNE V%X, %02X", x, kk); return;
+        case 0x5: snprintf(buffer, size, "SE V%X, V%X", x, y); return;
+        case 0x6: snprintf(buffer, size, "LD V%X, %02X", x, kk); return;
+        case 0x7: snprintf(buffer, size, "ADD V%X, %02X", x, kk); return;
+        case 0x8: {
+            static const char* const ALU[16] = {
+                "LD", "OR", "AND", "XOR", "ADD", "SUB", "SHR", "SUBN",
+                NULL, NULL, NULL, NULL, NULL, NULL, "SHL", NULL
+            };
+            if(ALU[n]){
+                snprintf(buffer, size, "%s V%X, V%X", ALU[n], x, y);
+                return;
+            }
+            break;
+        }
+        case 0x9: snprintf(buffer, size, "SNE V%X, V%X", x, y); return;
+        case 0xA: snprintf(buffer, size, "LD I, %03X", addr); return;
+        case 0xB: snprintf(buffer, size, "JP V0, %03X", addr); return;
+        case 0xC: snprintf(buffer, size, "RND V%X, %02X", x, kk); return;
+        case 0xD: snprintf(buffer, size, "DRW V%X, V%X, %X", x, y, n); return;
+        case 0xE:
+            if(kk == 0x9E) { snprintf(buffer, size, "SKP V%X", x); return; }
+            if(kk == 0xA1) { snprintf(buffer, size, "SKNP V%X", x); return; }
+            break;
+        case 0xF:
+            switch (kk) {
+                case 0x07: snprintf(buffer, size, "LD V%X, DT", x); return;
+                case 0x0A: snprintf(buffer, size, "LD V%X, K", x); return;
+                case 0x15: snprintf(buffer, size, "LD DT, V%X", x); return;
+                case 0x18: snprintf(buffer, size, "LD ST, V%X", x); return;
+                case 0x1E: snprintf(buffer, size, "ADD I, V%X", x); return;
+                case 0x29: snprintf(buffer, size, "LD F, V%X", x); return;
+                case 0x30: snprintf(buffer, size, "LD HF, V%X", x); return;
+                case 0x33: snprintf(buffer, size, "LD B, V%X", x); return;
+                case 0x55: snprintf(buffer, size, "LD [I], V%X", x); return;
+                case 0x65: snprintf(buffer, size, "LD V%X, [I]", x); return;
+                case 0x75: snprintf(buffer, size, "LD R, V%X", x); return;
+                case 0x85: snprintf(buffer, size, "LD V%X, R", x); return;
+                case 0x3A: snprintf(buffer, size, "PITCH V%X", x); return;
+                case 0x02: if(x == 0) { snprintf(buffer, size, "AUDIO"); return; } break;
+                // the 16 bit address follows the opcode and is not part of the trace
+                case 0x00: if(x == 0) { snprintf(buffer, size, "LD I, LONG"); return; } break;
+                case 0x01: snprintf(buffer, size, "PLANE %X", x); return;
+            }
+            break;
+    }
+    snprintf(buffer, size, "DW %04X", opcode);
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+* Execution trace. While a context has a trace_ring attached every instruction
+* is stepped through execute() and leaves a fixed size record in the ring,
+* the oldest records are overwritten once it is full. The ring is written out
+* on demand, the emulator does it at the end of a run and when the guest hits
+* an unknown opcode.
+* chip8-trace turns a dump back into readable disassembly.
+*/
+
+#define TRACE_MAGIC "C8TR"
+#define TRACE_VERSION 1
+#define TRACE_DEFAULT_SIZE 65536        // records, must be a power of two
+
+typedef struct {
+    uint64_t cycle;                     // instructions executed before this one
+    uint16_t pc;
+    uint16_t opcode;
+    uint16_t I;                         // index register after the step
+    uint16_t changed;                   // bit n set if the step wrote Vn
+    uint8_t vx;                         // Vx after the step
+    uint8_t vf;                         // VF after the step
+    uint8_t sp;                         // stack depth after the step
+    uint8_t padding;
+} trace_entry;
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t entry_size;
+    uint32_t count;                     // records that follow, oldest first
+} trace_header;
+
+typedef struct {
+    trace_entry* entries;
+    uint32_t mask;                      // ring size - 1
+    uint64_t cycle;                     // instructions seen so far, skipped spins included
+    uint64_t count;                     // records written so far
+    const char* path;                   // where dumps go
+} trace_ring;
+
+trace_ring* trace_create(uint32_t size, const char* path);
+
+void trace_free(trace_ring* trace);
+
+// write the ring to trace->path, oldest record first. Returns the number of records, -1 if the file cannot be opened
+int64_t trace_dump(const trace_ring* trace);
+
+// read a dump, returns the number of records or -1 if it is not a trace
+int trace_load(FILE* input, trace_entry** entries);
+
+// mnemonic of an opcode, Cowgod's notation with the SUPER-CHIP extensions
+void disassemble(uint16_t opcode, char* buffer, size_t size);
@@ -0,0 +1,74 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+/*
+* Prints a trace dump as one line per instruction, oldest first:
+* cycle, address, opcode, disassembly, I and the registers the step wrote.
+*/
+
+static void usage(const char* name){
+    printf("usage: %s [--last N] <trace> \n", name);
+}
+
+int main(int argc, char *argv[]){
+    const char* path = NULL;
+    unsigned long last = 0;
+
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--last") == 0 && i + 1 < argc){
+            last = strtoul(argv[++i], NULL, 10);
+        }else if(argv[i][0] == '-' && argv[i][1] == '-'){
+            printf("ERROR > Unknown option %s \n", argv[i]);
+            usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }else{
+            path = argv[i];
+        }
+    }
+
+    if(!path){
+        printf("ERROR > Input file not provided \n");
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    FILE* input = fopen(path, "rb");
+    if(!input){
+        printf("ERROR > Input file not found \n");
+        exit(EXIT_FAILURE);
+    }
+
+    trace_entry* entries;
+    int count = trace_load(input, &entries);
+    fclose(input);
+    if(count < 0){
+        printf("ERROR > %s is not a trace dump \n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    int first = last && last < (unsigned long)count ? count - (int)last : 0;
+    char text[32];
+    for(int i = first; i < count; i++){
+        const trace_entry* e = &entries[i];
+        unsigned x = (e->opcode >> 8) & 0xf;
+        disassemble(e->opcode, text, sizeof(text));
+        printf("%12llu  %03X  %04X  %-16s I=%03X SP=%X", (unsigned long long)e->cycle, e->pc, e->opcode, text, e->I, e->sp);
+        for(unsigned r = 0; r < 16; r++){
+            if(!(e->changed & (1u << r))){
+                continue;
+            }
+            // only Vx and VF values are recorded, the rest of an FX65 load is in memory at I
+            if(r == x){
+                printf(" V%X=%02X", r, e->vx);
+            }else if(r == 0xF){
+                printf(" VF=%02X", e->vf);
+            }
+        }
+        printf("\n");
+    }
+
+    free(entries);
+    return 0;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include "atomics.h"
+#include "chip8.h"
+
+/*
+* Lock free single producer, single consumer handoff of finished frames. The
+* producer always owns one buffer to draw into and the consumer one to read
+* from, the third sits in between holding the newest finished frame. Both
+* sides only ever swap their own buffer with the middle one, so the producer
+* never waits for the consumer and the consumer always gets the newest frame,
+* older ones it did not get to are simply overwritten.
+*/
+
+#define TRIPLE_FRESH 4              // set in middle while it holds a frame the consumer has not taken
+
+typedef struct {
+    uint64_t screen[NUM_PLANES][SCREEN_HEIGHT][SCREEN_ROW_WORDS];     // plane major, as in chip8
+} video_frame;
+
+typedef struct {
+    video_frame frames[3];
+    uint32_t middle;                // index of the middle buffer, plus TRIPLE_FRESH
+    uint8_t back;                   // producer side
+    uint8_t front;                  // consumer side
+} triple_buffer;
+
+static inline void init_triple_buffer(triple_buffer* tb){
+    memset(tb->frames, 0, sizeof(tb->frames));
+    tb->back = 0;
+    tb->middle = 1;
+    tb->front = 2;
+}
+
+// buffer the producer fills before calling publish_frame
+static inline video_frame* back_frame(triple_buffer* tb){
+    return &tb->frames[tb->back];
+}
+
+// hand the back buffer over, returns 1 if it replaced a frame the consumer never took
+static inline int publish_frame(triple_buffer* tb){
+    uint32_t old = exchange_u32(&tb->middle, tb->back | TRIPLE_FRESH);
+    tb->back = old & 3;
+    return (old & TRIPLE_FRESH) != 0;
+}
+
+// newest frame published since the last call, NULL if there is none
+static inline const video_frame* take_frame(triple_buffer* tb){
+    if(!(load_relaxed_u32(&tb->middle) & TRIPLE_FRESH)){
+        return NULL;
+    }
+    uint32_t old = exchange_u32(&tb->middle, tb->front);
+    tb->front = old & 3;
+    return &tb->frames[tb->front];
+}
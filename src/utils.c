@@ -1,9 +1,59 @@
+#ifdef WIN32
+#include <windows.h>
+#else
+#define _POSIX_C_SOURCE 199309L
+#include <time.h>
+#endif
+
 #include <stdio.h>
 #include "utils.h"
 
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
 size_t file_size(FILE* file){
     fseek(file, 0, SEEK_END);
     size_t size = ftell(file);
     rewind(file);
     return size;
-}
\ No newline at end of file
+}
+
+// 64 bit FNV-1a
+uint64_t hash_bytes(const void* data, size_t size){
+    const uint8_t* bytes = data;
+    uint64_t hash = FNV_OFFSET;
+    for(size_t i = 0; i < size; i++){
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+// monotonic host clock in nanoseconds
+uint64_t time_ns(void){
+#ifdef WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    if(!freq.QuadPart){
+        QueryPerformanceFrequency(&freq);
+    }
+    QueryPerformanceCounter(&now);
+    return (uint64_t)(now.QuadPart / freq.QuadPart) * 1000000000ULL
+           + (uint64_t)(now.QuadPart % freq.QuadPart) * 1000000000ULL / freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+void sleep_ns(uint64_t ns){
+#ifdef WIN32
+    Sleep((DWORD)(ns / 1000000));
+#else
+    struct timespec ts;
+    ts.tv_sec = ns / 1000000000ULL;
+    ts.tv_nsec = ns % 1000000000ULL;
+    nanosleep(&ts, NULL);
+#endif
+}
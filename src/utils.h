@@ -1,3 +1,12 @@
 #pragma once
 
-size_t file_size(FILE* file);
\ No newline at end of file
+#include <stdint.h>
+#include <stdio.h>
+
+size_t file_size(FILE* file);
+
+uint64_t hash_bytes(const void* data, size_t size);
+
+uint64_t time_ns(void);
+
+void sleep_ns(uint64_t ns);
@@ -0,0 +1,398 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#ifdef WIN32
+#include <process.h>
+#else
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "aot.h"
+#include "chip8.h"
+#include "engine.h"
+#include "lanes.h"
+#include "utils.h"
+
+/*
+* Differential test of the execution engines. Random ROMs are run frame by
+* frame under every quirk profile on the reference engine and on each of
+* the others, with the same keys pressed before every frame, and after each
+* frame every engine has to agree with execute() on the instructions run,
+* registers, stack, timers, memory, screen and fault. The lockstep lanes run
+* each ROM with a different seed and keys per lane, every lane has to match
+* a context of its own stepped through execute().
+*
+* With the path of chip8-aot and a scratch directory on the command line a
+* smaller set of ROMs is compiled to modules and run on --engine=aot too.
+*
+* usage: chip8-engine-test [chip8-aot scratch-dir]
+*/
+
+#define NUM_ROMS 150
+#define NUM_AOT_ROMS 16
+#define NUM_LANES_ROMS 60
+#define AOT_PROFILES 2
+#define FRAMES 300
+#define IPF 64
+#define MIN_ROM_SIZE 64
+#define MAX_ROM_SIZE 1024
+#define MAX_PATH_LENGTH 4096
+
+static const ENGINE ENGINES[] = {ENGINE_INTERP, ENGINE_JIT};
+
+static uint64_t rng_state;
+
+// xorshift64*, fixed seed so a failure can be run again
+static uint32_t next_random(void){
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (uint32_t)((rng_state * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+static uint32_t random_below(uint32_t n){
+    return next_random() % n;
+}
+
+// an even address inside the ROM
+static uint16_t rom_address(size_t size){
+    return (uint16_t)(PROGRAM_START + random_below((uint32_t)size / OP_SIZE) * OP_SIZE);
+}
+
+static void put_op(uint8_t* rom, size_t* at, size_t size, uint16_t opcode){
+    if(*at + OP_SIZE <= size){
+        rom[(*at)++] = opcode >> 8;
+        rom[(*at)++] = opcode & 0xff;
+    }
+}
+
+/*
+* Mostly valid instructions with addresses inside the ROM, so programs run a
+* while, call and return, store over their own code and poll the timers the
+* way the spin detection and the fused interpreter runs look for. A few words
+* are left fully random and end up as bad opcodes.
+*/
+static void random_rom(uint8_t* rom, size_t size){
+    size_t at = 0;
+    while(at + OP_SIZE <= size){
+        uint8_t x = random_below(16);
+        uint8_t y = random_below(16);
+        uint8_t kk = random_below(4) ? random_below(8) : random_below(256);
+        uint16_t addr = rom_address(size);
+        uint16_t opcode;
+
+        switch (random_below(24)) {
+            case 0: {
+                static const uint16_t system_ops[] = {0x00E0, 0x00EE, 0x00EE, 0x00C3, 0x00FB, 0x00FC, 0x00FE, 0x00FF, 0x0123};
+                opcode = system_ops[random_below(sizeof(system_ops) / sizeof(system_ops[0]))];
+                break;
+            }
+            case 1:
+                // forwards more often than back, and sometimes to itself
+                opcode = 0x1000 | (random_below(8) ? addr : (uint16_t)(PROGRAM_START + at));
+                break;
+            case 2:
+                opcode = 0x2000 | addr;
+                break;
+            case 3:
+            case 4:
+                opcode = (random_below(2) ? 0x3000 : 0x4000) | x << 8 | kk;
+                break;
+            case 5:
+                opcode = (random_below(2) ? 0x5000 : 0x9000) | x << 8 | y << 4;
+                break;
+            case 6:
+            case 7:
+                opcode = 0x6000 | x << 8 | kk;
+                break;
+            case 8:
+                opcode = 0x7000 | x << 8 | kk;
+                break;
+            case 9:
+            case 10: {
+                static const uint8_t alu_ops[] = {0, 1, 2, 3, 4, 5, 6, 7, 0xE};
+                opcode = 0x8000 | x << 8 | y << 4 | alu_ops[random_below(sizeof(alu_ops))];
+                break;
+            }
+            case 11:
+                // the ROM for stores over code, the fonts for sprites
+                opcode = 0xA000 | (random_below(2) ? addr : random_below(FONT_SET_SIZE + SUPER_FONT_SET_SIZE));
+                break;
+            case 12:
+                opcode = 0xB000 | (addr - random_below(8));
+                break;
+            case 13:
+                opcode = 0xC000 | x << 8 | random_below(256);
+                break;
+            case 14:
+                opcode = 0xD000 | x << 8 | y << 4 | random_below(16);
+                break;
+            case 15:
+                opcode = (random_below(2) ? 0xE09E : 0xE0A1) | x << 8;
+                break;
+            case 16:
+            case 17: {
+                static const uint8_t f_ops[] = {0x01, 0x07, 0x0A, 0x15, 0x18, 0x1E, 0x29, 0x30, 0x33, 0x3A,
+                                                0x55, 0x65, 0x75, 0x85};
+                opcode = 0xF000 | x << 8 | f_ops[random_below(sizeof(f_ops))];
+                break;
+            }
+            case 18:
+                // XO-CHIP long load and audio pattern
+                if(random_below(2)){
+                    put_op(rom, &at, size, 0xF000);
+                    opcode = random_below(2) ? addr : random_below(RAM_SIZE);
+                }else{
+                    opcode = 0xF002;
+                }
+                break;
+            case 19:
+                // delay timer poll, Fx07; 3xkk; 1NNN back to the Fx07
+                put_op(rom, &at, size, 0xF007 | x << 8);
+                put_op(rom, &at, size, 0x3000 | x << 8);
+                opcode = 0x1000 | (uint16_t)((PROGRAM_START + at - 2 * OP_SIZE) & 0xfff);
+                break;
+            case 20:
+                // runs the interpreter fuses
+                put_op(rom, &at, size, 0x6000 | x << 8 | kk);
+                opcode = (random_below(2) ? 0xF015 : 0xF018) | x << 8;
+                break;
+            case 21:
+                put_op(rom, &at, size, 0xA000 | (random_below(2) ? addr : random_below(FONT_SET_SIZE)));
+                opcode = random_below(2) ? (uint16_t)(0xD000 | x << 8 | y << 4 | random_below(16)) : (uint16_t)(0xF065 | x << 8);
+                break;
+            case 22:
+                put_op(rom, &at, size, 0x7000 | x << 8 | kk);
+                opcode = (random_below(2) ? 0x3000 : 0x4000) | x << 8 | kk;
+                break;
+            default:
+                opcode = random_below(0x10000);
+                break;
+        }
+        put_op(rom, &at, size, opcode);
+    }
+}
+
+// keys held during frame f, the same for every engine
+static uint16_t frame_keys(uint64_t rom_seed, uint32_t frame){
+    uint64_t mix = (rom_seed + frame) * 0x9E3779B97F4A7C15ULL;
+    return (uint16_t)(mix >> 48) & (uint16_t)(mix >> 32);
+}
+
+static void set_keys(chip8* ctx, uint16_t keys){
+    for(uint8_t k = 0; k < NUM_KEYS; k++){
+        ctx->keyboard[k] = (keys >> k) & 1;
+    }
+}
+
+// everything the guest can observe, returns the name of the first thing that differs
+static const char* compare(const chip8* a, const chip8* b){
+    if(a->cycles != b->cycles) return "cycles";
+    if(a->fault != b->fault) return "fault";
+    if(a->fault && (a->fault_pc != b->fault_pc || a->fault_opcode != b->fault_opcode)) return "fault location";
+    if(a->pc != b->pc) return "pc";
+    if(a->I != b->I) return "I";
+    if(memcmp(a->v, b->v, NUM_REGISTERS) != 0) return "registers";
+    if(a->sp != b->sp || memcmp(a->stack, b->stack, a->sp * sizeof(a->stack[0])) != 0) return "stack";
+    if(a->delay_timer != b->delay_timer || a->sound_timer != b->sound_timer) return "timers";
+    if(memcmp(a->flags, b->flags, NUM_FLAGS) != 0) return "flags";
+    if(a->rng != b->rng) return "random generator";
+    if(a->screen_mode != b->screen_mode || a->planes != b->planes) return "screen mode";
+    if(screen_hash(a) != screen_hash(b)) return "screen";
+    if(a->pitch != b->pitch || a->xo_audio != b->xo_audio
+       || memcmp(a->audio_pattern, b->audio_pattern, AUDIO_PATTERN_SIZE) != 0) return "audio";
+    if(memcmp(a->mem, b->mem, RAM_SIZE) != 0) return "memory";
+    return NULL;
+}
+
+static chip8* load(const uint8_t* rom, size_t size, QUIRK_PROFILE profile){
+    chip8* ctx = malloc(sizeof(chip8));
+    if(!ctx){
+        printf("ERROR > Out of memory \n");
+        exit(EXIT_FAILURE);
+    }
+    init_emulator_rom(rom, size, ctx);
+    seed_random(ctx, size);
+    set_profile(ctx, profile);
+    return ctx;
+}
+
+// run the ROM on the reference engine and on engine side by side, returns 0 and says where on a mismatch
+static int check(const uint8_t* rom, size_t size, uint64_t rom_seed, QUIRK_PROFILE profile, ENGINE engine, aot_state* aot){
+    chip8* ref = load(rom, size, profile);
+    chip8* other = load(rom, size, profile);
+    other->aot = aot;
+    int ok = 1;
+
+    for(uint32_t f = 0; f < FRAMES && ok && !ref->fault; f++){
+        set_keys(ref, frame_keys(rom_seed, f));
+        set_keys(other, frame_keys(rom_seed, f));
+        run_frame(ENGINE_REF, ref, IPF);
+        run_frame(engine, other, IPF);
+        const char* differs = compare(ref, other);
+        if(differs){
+            printf("MISMATCH > rom %llu, %s quirks, %s engine, frame %u: %s (ref pc %X, %s pc %X) \n",
+                   (unsigned long long)rom_seed, profile_name(profile), engine_name(engine), f, differs,
+                   ref->pc, engine_name(engine), other->pc);
+            ok = 0;
+        }
+    }
+    free_engines(ref);
+    // the module belongs to the caller
+    other->aot = NULL;
+    free_engines(other);
+    free(ref);
+    free(other);
+    return ok;
+}
+
+// the lanes against LANES contexts stepped through execute() one instruction at a time
+static int check_lanes(const uint8_t* rom, size_t size, uint64_t rom_seed, QUIRK_PROFILE profile){
+    uint64_t seeds[LANES];
+    chip8* ref[LANES];
+    for(int lane = 0; lane < LANES; lane++){
+        seeds[lane] = rom_seed * LANES + lane;
+        ref[lane] = load(rom, size, profile);
+        seed_random(ref[lane], seeds[lane]);
+    }
+    chip8_lanes* l = lanes_create(rom, size, seeds);
+    if(!l){
+        printf("ERROR > Could not allocate the lanes \n");
+        exit(EXIT_FAILURE);
+    }
+    lanes_set_profile(l, profile);
+    int ok = 1;
+
+    for(uint32_t f = 0; f < FRAMES && ok; f++){
+        for(int lane = 0; lane < LANES; lane++){
+            set_keys(ref[lane], frame_keys(seeds[lane], f));
+            lanes_set_keys(l, lane, frame_keys(seeds[lane], f));
+            // busy-waits are not skipped on the lanes
+            for(uint32_t i = 0; i < IPF; i++){
+                execute(ref[lane]);
+                ref[lane]->spin_length = 0;
+            }
+            tick_timers(ref[lane]);
+            ref[lane]->cycles += IPF;
+        }
+        run_lanes_frame(l, IPF);
+        for(int lane = 0; lane < LANES && ok; lane++){
+            const char* differs = compare(ref[lane], lane_context(l, lane));
+            if(differs){
+                printf("MISMATCH > rom %llu, %s quirks, lane %d, frame %u: %s (ref pc %X, lane pc %X) \n",
+                       (unsigned long long)rom_seed, profile_name(profile), lane, f, differs,
+                       ref[lane]->pc, lane_context(l, lane)->pc);
+                ok = 0;
+            }
+        }
+    }
+    for(int lane = 0; lane < LANES; lane++){
+        free(ref[lane]);
+    }
+    lanes_free(l);
+    return ok;
+}
+
+// run a program with its arguments as given, returns its exit status
+static int run_program(const char* const* args){
+#ifdef WIN32
+    return (int)_spawnvp(_P_WAIT, args[0], args);
+#else
+    pid_t pid = fork();
+    if(pid == 0){
+        // keep the compiler's progress lines out of the test log
+        if(!freopen("/dev/null", "w", stdout)){
+            _exit(127);
+        }
+        execvp(args[0], (char* const*)args);
+        _exit(127);
+    }
+    int status;
+    if(pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status)){
+        return -1;
+    }
+    return WEXITSTATUS(status);
+#endif
+}
+
+// compile the ROM with chip8-aot and load the module, NULL with the reason printed on failure
+static aot_state* compile(const char* compiler, const char* dir, const uint8_t* rom, size_t size,
+                          uint64_t rom_seed, QUIRK_PROFILE profile){
+    char rom_path[MAX_PATH_LENGTH];
+    char module_path[MAX_PATH_LENGTH];
+    int length = snprintf(rom_path, sizeof(rom_path), "%s/engines-%llu.ch8", dir, (unsigned long long)rom_seed);
+    if(length < 0 || (size_t)length + strlen(AOT_SUFFIX) >= sizeof(rom_path)){
+        printf("ERROR > Scratch directory path too long \n");
+        return NULL;
+    }
+    memcpy(module_path, rom_path, (size_t)length);
+    strcpy(module_path + length, AOT_SUFFIX);
+
+    FILE* out = fopen(rom_path, "wb");
+    if(!out || fwrite(rom, 1, size, out) != size){
+        printf("ERROR > Could not write %s \n", rom_path);
+        if(out){
+            fclose(out);
+        }
+        return NULL;
+    }
+    fclose(out);
+
+    const char* args[] = {compiler, "--quirks", profile_name(profile), rom_path, NULL};
+    if(run_program(args) != 0){
+        printf("ERROR > %s could not compile %s \n", compiler, rom_path);
+        return NULL;
+    }
+    chip8* ctx = load(rom, size, profile);
+    const char* error = NULL;
+    aot_state* aot = aot_load(module_path, ctx, &error);
+    if(!aot){
+        printf("ERROR > %s: %s \n", module_path, error);
+    }
+    free(ctx);
+    return aot;
+}
+
+int main(int argc, char *argv[]){
+    const char* compiler = argc > 2 ? argv[1] : NULL;
+    const char* dir = argc > 2 ? argv[2] : NULL;
+    uint8_t rom[MAX_ROM_SIZE];
+    uint32_t failures = 0;
+    uint32_t checks = 0;
+
+    for(uint64_t r = 1; r <= NUM_ROMS; r++){
+        rng_state = r * 0x9E3779B97F4A7C15ULL;
+        size_t size = (MIN_ROM_SIZE + random_below(MAX_ROM_SIZE - MIN_ROM_SIZE)) & ~(size_t)1;
+        random_rom(rom, size);
+
+        for(int p = 0; p < NUM_PROFILES; p++){
+            for(size_t e = 0; e < sizeof(ENGINES) / sizeof(ENGINES[0]); e++){
+                failures += !check(rom, size, r, (QUIRK_PROFILE)p, ENGINES[e], NULL);
+                checks++;
+            }
+        }
+        if(r <= NUM_LANES_ROMS){
+            failures += !check_lanes(rom, size, r, (QUIRK_PROFILE)(r % NUM_PROFILES));
+            checks++;
+        }
+
+        if(!compiler || r > NUM_AOT_ROMS){
+            continue;
+        }
+        for(int p = 0; p < AOT_PROFILES; p++){
+            QUIRK_PROFILE profile = (QUIRK_PROFILE)((r + p) % NUM_PROFILES);
+            aot_state* aot = compile(compiler, dir, rom, size, r, profile);
+            if(!aot){
+                failures++;
+                continue;
+            }
+            failures += !check(rom, size, r, profile, ENGINE_AOT, aot);
+            checks++;
+            aot_free(aot);
+        }
+    }
+
+    printf("ENGINES > %u checks, %u failed \n", checks, failures);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}